@@ -0,0 +1,31 @@
+#include "Arena.hpp"
+
+// return a block of scratch memory which remains valid until the next reset
+char* Arena::allocate(size_t size) {
+    size = (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    if (chunks.empty() || used + size > chunks.back().size) {
+        // not enough room in the current chunk, so get another one that's at least big enough for this request
+        size_t chunkSize = std::max(size, (size_t)ARENA_CHUNK_SIZE);
+        chunks.push_back({ std::unique_ptr<char[]>(new char[chunkSize]), chunkSize });
+        used = 0;
+        TRACE(2, "arena chunk #%d of %zu bytes added\n", (int)chunks.size(), chunkSize);
+    }
+    char* memory = chunks.back().memory.get() + used;
+    used += size;
+    return memory;
+}
+
+// release all the scratch memory handed out since the last reset
+void Arena::reset() {
+    // keep a single chunk of the default size so the typical command never touches the heap; a chunk that was grown
+    // for one large request is given back rather than held for the rest of the session
+    auto keep = std::find_if(chunks.begin(), chunks.end(), [](const Chunk& c) { return c.size == ARENA_CHUNK_SIZE; });
+    if (keep != chunks.end()) {
+        std::swap(chunks.front(), *keep);
+        chunks.resize(1);
+    } else if (!chunks.empty()) {
+        chunks.clear();
+        chunks.push_back({ std::unique_ptr<char[]>(new char[ARENA_CHUNK_SIZE]), ARENA_CHUNK_SIZE });
+    }
+    used = 0;
+}
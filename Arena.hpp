@@ -0,0 +1,18 @@
+#pragma once
+#include "main.hpp"
+
+// a bump allocator for the scratch memory needed while running a single command; everything it hands out is
+// released at once when the arena is reset at the start of the next command
+class Arena {
+private:
+    struct Chunk {
+        std::unique_ptr<char[]> memory;
+        size_t size;
+    };
+    std::vector<Chunk> chunks; // blocks of memory obtained from the heap; only one of the default size is kept across resets
+    size_t used = 0; // number of bytes handed out from the last chunk
+
+public:
+    char* allocate(size_t size); // return a block of scratch memory which remains valid until the next reset
+    void reset(); // release all the scratch memory handed out since the last reset
+};
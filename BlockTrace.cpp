@@ -0,0 +1,119 @@
+#include "BlockTrace.hpp"
+#include "FileSystem.hpp"
+thread_local BlockUse blockUse = DATA_USE;
+
+static const char* useNames[BLOCK_USES] = { "data", "directory", "index", "inode table", "bitmap", "super" };
+
+// clear the buffer and start tracing
+void BlockTrace::start() {
+    events.resize(BLOCK_TRACE_EVENTS);
+    logged = 0;
+    began = std::chrono::steady_clock::now();
+    enabled = true;
+}
+
+// stop tracing, keeping what's in the buffer for the report
+void BlockTrace::stop() {
+    enabled = false;
+}
+
+// keep one read or write of a run of blocks, overwriting the oldest event once the buffer is full
+void BlockTrace::log(MountedDevice* device, int blockNum, int count, bool isWrite) {
+    BlockUse use = device->block_use(blockNum);
+    BlockEvent& event = events[logged.fetch_add(1, std::memory_order_relaxed) & (BLOCK_TRACE_EVENTS - 1)];
+    event.time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - began).count();
+    event.blockNum = blockNum;
+    event.count = std::min(count, UINT16_MAX);
+    event.device = device->fd;
+    event.use = use;
+    event.isWrite = isWrite;
+}
+
+// summarize the events in the buffer, device by device: the reads and writes for each use, how they're spread across
+// the device, and how far each one is from where the one before it ended, which is how far a disk would have to seek
+void BlockTrace::report() {
+    uint64_t logged = this->logged; // one snapshot of the count for the whole report
+    uint64_t kept = std::min(logged, (uint64_t)BLOCK_TRACE_EVENTS);
+    uint64_t first = logged - kept;
+    if (kept == 0) {
+        std::cout << "blktrace: no block reads or writes traced" << (enabled ? "" : ", start with blktrace on") << "\n";
+        return;
+    }
+    const BlockEvent& oldest = events[first & (BLOCK_TRACE_EVENTS - 1)];
+    const BlockEvent& newest = events[(logged - 1) & (BLOCK_TRACE_EVENTS - 1)];
+    std::cout << "blktrace: " << logged << " events over " << (newest.time - oldest.time) / 1e9 << " s";
+    if (first)
+        std::cout << ", only the last " << kept << " kept";
+    std::cout << "\n";
+
+    std::vector<int> devices; // the devices in the kept events, in order of first appearance
+    for (uint64_t i = first; i < logged; i++) {
+        int fd = events[i & (BLOCK_TRACE_EVENTS - 1)].device;
+        if (std::find(devices.begin(), devices.end(), fd) == devices.end())
+            devices.push_back(fd);
+    }
+    for (int fd : devices) {
+        MountedDevice* device = fs->mountTable.find(fd);
+        int nblocks = device ? device->nblocks : 0;
+        for (uint64_t i = first; i < logged; i++) { // a device that's been remounted may have shrunk
+            const BlockEvent& event = events[i & (BLOCK_TRACE_EVENTS - 1)];
+            if (event.device == fd)
+                nblocks = std::max(nblocks, event.blockNum + event.count);
+        }
+        int regionSize = (nblocks + BLOCK_TRACE_REGIONS - 1) / BLOCK_TRACE_REGIONS;
+
+        long ops[BLOCK_USES][2] = {}, blocks[BLOCK_USES][2] = {}; // by use, then read or write
+        long heat[BLOCK_TRACE_REGIONS][2] = {}; // blocks read and written in each region
+        long seeks[5] = {}; // none, up to 8 blocks, up to 64, up to 512, and further
+        long distances = 0, previousEnd = -1;
+        for (uint64_t i = first; i < logged; i++) {
+            const BlockEvent& event = events[i & (BLOCK_TRACE_EVENTS - 1)];
+            if (event.device != fd)
+                continue;
+            ops[event.use][event.isWrite]++;
+            blocks[event.use][event.isWrite] += event.count;
+            for (int b = event.blockNum; b < event.blockNum + event.count; b++)
+                heat[std::min(b / regionSize, BLOCK_TRACE_REGIONS - 1)][event.isWrite]++;
+            if (previousEnd >= 0) {
+                long distance = labs(event.blockNum - previousEnd);
+                distances += distance;
+                seeks[distance == 0 ? 0 : distance <= 8 ? 1 : distance <= 64 ? 2 : distance <= 512 ? 3 : 4]++;
+            }
+            previousEnd = event.blockNum + event.count;
+        }
+
+        std::cout << "\ndevice " << fd;
+        if (device)
+            std::cout << " mounted on " << device->mountPath;
+        std::cout << ", " << nblocks << " blocks\n";
+        std::cout << std::left << std::setw(14) << "  use" << std::right << std::setw(9) << "reads" << std::setw(9)
+                  << "blocks" << std::setw(9) << "writes" << std::setw(9) << "blocks\n";
+        for (int use = 0; use < BLOCK_USES; use++) {
+            if (ops[use][0] || ops[use][1])
+                std::cout << "  " << std::left << std::setw(12) << useNames[use] << std::right << std::setw(9)
+                          << ops[use][0] << std::setw(9) << blocks[use][0] << std::setw(9) << ops[use][1]
+                          << std::setw(8) << blocks[use][1] << "\n";
+        }
+
+        long hottest = 1;
+        for (auto& region : heat)
+            hottest = std::max(hottest, region[0] + region[1]);
+        std::cout << std::left << std::setw(16) << "  region" << std::right << std::setw(9) << "read"
+                  << std::setw(9) << "written\n";
+        for (int r = 0; r < BLOCK_TRACE_REGIONS && r * regionSize < nblocks; r++) {
+            std::string range = std::to_string(r * regionSize) + "-" +
+                std::to_string(std::min((r + 1) * regionSize, nblocks) - 1);
+            std::cout << "  " << std::left << std::setw(14) << range << std::right << std::setw(9) << heat[r][0]
+                      << std::setw(8) << heat[r][1] << " "
+                      << std::string((heat[r][0] + heat[r][1]) * 40 / hottest, '#') << "\n";
+        }
+
+        long moves = seeks[0] + seeks[1] + seeks[2] + seeks[3] + seeks[4];
+        if (moves) {
+            auto percent = [moves](long n) { return std::to_string(n * 100 / moves) + "%"; };
+            std::cout << "  seeks: " << percent(seeks[0]) << " sequential, " << percent(seeks[1]) << " up to 8 blocks, "
+                      << percent(seeks[2]) << " up to 64, " << percent(seeks[3]) << " up to 512, " << percent(seeks[4])
+                      << " further; mean distance " << distances / moves << " blocks\n";
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "main.hpp"
+#include <atomic>
+#include <chrono>
+class MountedDevice;
+
+#define BLOCK_TRACE_EVENTS 65536 // how many of the latest block reads and writes the tracer keeps; a power of 2
+#define BLOCK_TRACE_REGIONS 16 // how many equal regions the heatmap divides each device into
+
+// what a block is read or written for, as the block tracer reports it
+enum BlockUse : uint8_t {
+    DATA_USE, // file contents
+    DIRECTORY_USE, // directory entries
+    INDEX_USE, // indirect blocks and extent tree nodes
+    INODE_TABLE_USE, // the inodes table
+    BITMAP_USE, // the block and inode bitmaps
+    SUPER_USE, // the superblock and group descriptor
+    BLOCK_USES // the number of uses
+};
+
+extern thread_local BlockUse blockUse; // what the blocks this thread is reading and writing are for, if their location doesn't say
+
+// sets what the blocks read and written are for, until the end of the scope it's declared in
+class BlockUseScope {
+public:
+    BlockUseScope(BlockUse use) : saved(blockUse) { blockUse = use; }
+    ~BlockUseScope() { blockUse = saved; }
+
+private:
+    BlockUse saved; // the use to go back to
+};
+
+// one block read or write, or a run of them, as the tracer keeps it
+struct BlockEvent {
+    uint64_t time; // nanoseconds since tracing started
+    int32_t blockNum; // the first block
+    uint16_t count; // how many blocks
+    int16_t device; // the device's file descriptor
+    uint8_t use; // what the blocks are for, a BlockUse
+    bool isWrite; // was it a write?
+};
+
+// a blktrace-style tracer of the block reads and writes the file system asks its devices for: while it's on, each one
+// goes into a ring buffer of the latest BLOCK_TRACE_EVENTS, and the report summarizes them by use, by region of each
+// device and by the distance from the end of one to the start of the next
+class BlockTrace {
+public:
+    bool enabled = false; // is tracing on? the devices check this before calling log, so it costs one test when off
+
+    void start(); // clear the buffer and start tracing
+    void stop(); // stop tracing, keeping what's in the buffer for the report
+    void log(MountedDevice* device, int blockNum, int count, bool isWrite); // keep one read or write of a run of blocks
+    void report(); // summarize the events in the buffer
+
+private:
+    std::vector<BlockEvent> events; // the ring buffer, allocated when tracing first starts
+    std::atomic<uint64_t> logged{ 0 }; // how many events have been logged; each logger takes the next slot from it, as the worker threads log too
+    std::chrono::steady_clock::time_point began; // when tracing started
+};
@@ -1,28 +1,52 @@
 #include "CachedINode.hpp"
+#include "Profiler.hpp"
 #include "DataBlock.hpp"
 #include "Directory.hpp"
 #include "FileSystem.hpp"
 
+// does this table entry still hold an inode? it does while it's in use, and afterwards until its changes are written back
+bool CachedINode::is_held() {
+    return refCount || isDirty || timesDirty;
+}
+
+// update the access time after the file was read, as the device's mount options allow: never on read-only or noatime
+// devices, and with relatime only when the access time isn't already later than the last change or it's a day old;
+// with lazytime the update stays in memory until the inode is evicted from the table or synced
+void CachedINode::accessed() {
+    if (device->readOnly || device->atimeMode == NOATIME)
+        return;
+    __u32 now = time(0L);
+    if (device->atimeMode == RELATIME && inode.i_atime > inode.i_mtime && inode.i_atime > inode.i_ctime
+        && now - inode.i_atime < 24 * 60 * 60)
+        return;
+    inode.i_atime = now;
+    if (device->lazyTime)
+        timesDirty = true;
+    else
+        isDirty = true;
+}
+
 // find the full absolute path of this diretory
 std::string CachedINode::fullpath() {
+    BlockUseScope scope(DIRECTORY_USE);
     CachedINode* dir = this; // start at this inode
     CachedINode* parent;
     DataBlock block;
     DirectoryEntry* parentDirEntry;
     std::string fullpath, name;
 
-    if (dir == fs.root) // handle the special case of being at the root of the file system
+    if (dir == fs->root) // handle the special case of being at the root of the file system
         return "/";
 
     dir->refCount++; // increment the reference count of this cached inode
-    while (dir != fs.root) {
+    while (dir != fs->root) {
         if (dir == dir->device->root) { // if we reach the root of a mounted device, switch to the mount point
             dir->put();
-            dir = fs.inodeTable.get(device->mountPoint->device, device->mountPoint->inodeNum);
+            dir = fs->inodeTable.get(device->mountPoint->device, device->mountPoint->inodeNum);
         }
-        block.get(dir->device, dir->inode.i_block[0]);
+        block.get(dir->device, dir->logical2physical(0));
         parentDirEntry = (DirectoryEntry*)&block.buffer[PARENT_DIR_ENTRY_OFFSET];
-        parent = fs.inodeTable.get(dir->device, parentDirEntry->inode);
+        parent = fs->inodeTable.get(dir->device, parentDirEntry->inode);
         fullpath = "/" + parent->search(dir->inodeNum) + fullpath;
         dir->put();
         dir = parent;
@@ -41,115 +65,321 @@ std::string CachedINode::linkname() {
 
 // returns this file's mode as a string, e.g., 0644 is -rw-r--r--
 std::string CachedINode::mode() {
-    std::stringstream stream;
-    std::string permissions("xwrxwrxwr");
+    std::string mode; // short enough to be stored within the string object itself, no allocation needed
+    const char* permissions = "xwrxwrxwr";
 
     if (S_ISREG(inode.i_mode)) // regular file
-        stream << '-';
+        mode += '-';
     else if (S_ISDIR(inode.i_mode)) // directory
-        stream << 'd';
+        mode += 'd';
     else if (S_ISLNK(inode.i_mode)) // symbolic link
-        stream << 'l';
+        mode += 'l';
     for (int i = 8; i >= 0; i--) {
         if (inode.i_mode & (1 << i))
-            stream << permissions[i]; // print r, w, x
+            mode += permissions[i]; // print r, w, x
         else
-            stream << '-';
+            mode += '-';
     }
-    return stream.str();
+    return mode;
 }
 
 // search this directory for a given inode number and return its name (empty string if not found)
 std::string CachedINode::search(int inodeNum) {
     for (const auto& entry : Directory(this)) {
         if (entry.inodeNum == inodeNum)
-            return entry.name;
+            return std::string(entry.name);
     }
     return ""; // inode number not found, return empty string
 }
 
 // search this directory for a given name and return its inode number (0 if not found)
-int CachedINode::search(const std::string& targetName) {
+int CachedINode::search(std::string_view targetName) {
+    PROFILE_SCOPE("CachedINode::search");
     for (const auto& entry : Directory(this)) {
-        if (entry.name == targetName)
+        if (entry.name == targetName) // compared in place within the directory's data block
             return entry.inodeNum;
     }
     return 0; // target not found, return 0 for inode number
 }
 
-// convert a logical block number for this file into an actual block number on its device
+// is this file's data mapped by an extent tree rather than by indirect blocks? (ext4 files usually are)
+bool CachedINode::has_extents() {
+    return inode.i_flags & EXT4_EXTENTS_FL;
+}
+
+// convert a logical block number for this file into an actual block number on its device (0 for a hole)
 int CachedINode::logical2physical(int logicalBlockNum) {
+    int length;
+    return map_run(logicalBlockNum, &length);
+}
+
+// convert a logical block number for this file into an actual block number on its device, and count the blocks that
+// follow it contiguously on the device, so they can all be read at once; for a hole, returns 0 and the hole's length
+int CachedINode::map_run(int logicalBlockNum, int* length) {
+    BlockUseScope scope(INDEX_USE);
+    if (has_extents())
+        return map_extent(logicalBlockNum, length);
+
     DataBlock indirectBlock(device);
     DataBlock doubleBlock(device);
+    const __u32* blockNums; // the table of block numbers which maps this logical block
+    int index; // this logical block's index into that table
+    int size; // the number of block numbers in that table
+    *length = 1;
 
-    if (logicalBlockNum < EXT2_NDIR_BLOCKS)
+    if (logicalBlockNum < EXT2_NDIR_BLOCKS) {
         // direct block numbers
-        return inode.i_block[logicalBlockNum];
-    else if (logicalBlockNum < EXT2_NDIR_BLOCKS + BLOCKNUMS_PER_BLOCK) {
+        blockNums = inode.i_block;
+        index = logicalBlockNum;
+        size = EXT2_NDIR_BLOCKS;
+    } else if (logicalBlockNum < EXT2_NDIR_BLOCKS + BLOCKNUMS_PER_BLOCK) {
         //  indirect block numbers
         if (!inode.i_block[EXT2_IND_BLOCK])
             return 0; // this file has no indirect blocks
         indirectBlock.get(inode.i_block[EXT2_IND_BLOCK]);
-        return indirectBlock.nums[logicalBlockNum - EXT2_NDIR_BLOCKS];
+        blockNums = (__u32*)indirectBlock.nums;
+        index = logicalBlockNum - EXT2_NDIR_BLOCKS;
+        size = BLOCKNUMS_PER_BLOCK;
     } else {
         //  double-indirect block numbers
         if (!inode.i_block[EXT2_DIND_BLOCK])
             return 0; // this file has no double-indirect blocks
         doubleBlock.get(inode.i_block[EXT2_DIND_BLOCK]);
         int i = (logicalBlockNum - EXT2_NDIR_BLOCKS - BLOCKNUMS_PER_BLOCK) / BLOCKNUMS_PER_BLOCK;
+        if (i >= BLOCKNUMS_PER_BLOCK || !doubleBlock.nums[i])
+            return 0; // beyond what double-indirect blocks can map, or a hole
         indirectBlock.get(doubleBlock.nums[i]);
-        int j = (logicalBlockNum - EXT2_NDIR_BLOCKS - BLOCKNUMS_PER_BLOCK) % BLOCKNUMS_PER_BLOCK;
-        return indirectBlock.nums[j];
+        blockNums = (__u32*)indirectBlock.nums;
+        index = (logicalBlockNum - EXT2_NDIR_BLOCKS - BLOCKNUMS_PER_BLOCK) % BLOCKNUMS_PER_BLOCK;
+        size = BLOCKNUMS_PER_BLOCK;
     }
+
+    // the run ends where the block numbers stop being consecutive, or at the end of the table
+    __u32 blockNum = blockNums[index];
+    while (index + *length < size && blockNums[index + *length] == (blockNum ? blockNum + *length : 0))
+        (*length)++;
+    return blockNum;
 }
 
-// get a new data block number and update the inode i_block[] structure
-int CachedINode::allocate_block() {
-    DataBlock doubleBlock(device);
-    int blockNum;
+// map a logical block through this file's extent tree, returning the rest of its extent as the run's length;
+// uninitialized extents are allocated but read as zeros, so they're treated like holes
+int CachedINode::map_extent(int logicalBlockNum, int* length) {
+    BlockUseScope scope(INDEX_USE);
+    DataBlock block(device);
+    ExtentHeader* header = (ExtentHeader*)inode.i_block;
+    long end = 1L << 32; // the first logical block beyond this part of the tree
+
+    // descend through the index nodes, following the last index which starts at or before the logical block
+    while (header->eh_magic == EXT3_EXT_MAGIC && header->eh_depth > 0) {
+        ExtentIndex* indexes = (ExtentIndex*)(header + 1);
+        int i = header->eh_entries - 1;
+        while (i >= 0 && indexes[i].ei_block > (__u32)logicalBlockNum)
+            i--;
+        if (i < 0) { // a hole before the first index
+            *length = (header->eh_entries ? indexes[0].ei_block : end) - logicalBlockNum;
+            return 0;
+        }
+        if (i + 1 < header->eh_entries)
+            end = indexes[i + 1].ei_block;
+        block.get(indexes[i].ei_leaf);
+        header = (ExtentHeader*)block.buffer;
+    }
+    if (header->eh_magic != EXT3_EXT_MAGIC) {
+        std::cerr << "inode " << inodeNum << " has a corrupt extent tree\n";
+        *length = 1;
+        return 0;
+    }
+
+    Extent* extents = (Extent*)(header + 1);
+    int i = header->eh_entries - 1;
+    while (i >= 0 && extents[i].ee_block > (__u32)logicalBlockNum)
+        i--;
+    if (i >= 0) {
+        bool uninitialized = extents[i].ee_len > EXT_INIT_MAX_LEN;
+        long extentLength = uninitialized ? extents[i].ee_len - EXT_INIT_MAX_LEN : extents[i].ee_len;
+        long offset = logicalBlockNum - extents[i].ee_block;
+        if (offset < extentLength) {
+            *length = extentLength - offset;
+            return uninitialized ? 0 : extents[i].ee_start + offset;
+        }
+    }
+    // a hole, up to the next extent
+    if (i + 1 < header->eh_entries)
+        end = extents[i + 1].ee_block;
+    *length = std::min(end - logicalBlockNum, (long)INT32_MAX);
+    return 0;
+}
+
+// get a new data block for a logical block of this file and update the inode i_block[] structure; i_blocks counts it
+// along with any indirect block that had to be allocated to map it; a writer's reservation window keeps its blocks
+// together
+int CachedINode::allocate_block(int logicalBlockNum, Reservation* window) {
+    int freeBefore = device->nbfree;
+    int blockNum = map_block(logicalBlockNum, 0, window);
+    inode.i_blocks += (freeBefore - device->nbfree) * (BLOCK_SIZE / 512);
+    return blockNum;
+}
+
+// the block this file's next block should be: the one after the last block it was given, or after its last data
+// block if it hasn't been given one since it was cached
+int CachedINode::goal() {
+    if (!nextGoal && inode.i_size > 0 && inode.i_blocks > 0) {
+        int last = logical2physical((inode.i_size - 1) / BLOCK_SIZE);
+        if (last)
+            nextGoal = last + 1;
+    }
+    return nextGoal ? nextGoal : 1;
+}
+
+// allocate a block for this file, as close to the goal as possible; returns 0 if the device is full
+int CachedINode::new_block(Reservation* window) {
+    int blockNum = device->allocate(BLOCK, goal(), window);
+    if (blockNum)
+        nextGoal = blockNum + 1;
+    return blockNum;
+}
 
+// map a logical block of this file to a device block, which is allocated here if blockNum is 0, along with any
+// indirect block needed to map it; returns the block number, or 0 if the file can't map that logical block
+int CachedINode::map_block(int logicalBlockNum, int blockNum, Reservation* window) {
+    BlockUseScope scope(INDEX_USE);
     inode.i_ctime = time(0L); // update inode change time
     isDirty = true;
+    if (has_extents())
+        return allocate_extent(logicalBlockNum, blockNum, window);
 
-    // look for an available direct block entry; if so, return allocated block number
-    for (int i = 0; i < EXT2_NDIR_BLOCKS; i++) {
-        if (inode.i_block[i] == 0) {
-            // found an empty direct block entry
-            inode.i_block[i] = device->allocate(BLOCK);
-            return inode.i_block[i];
-        }
+    // direct block numbers
+    if (logicalBlockNum < EXT2_NDIR_BLOCKS) {
+        if (inode.i_block[logicalBlockNum] == 0)
+            inode.i_block[logicalBlockNum] = blockNum ? blockNum : new_block(window);
+        return inode.i_block[logicalBlockNum];
     }
 
-    // look for an available indirect block entry; if so, return allocated block number
-    blockNum = allocate_indirect(device, (int*)&inode.i_block[EXT2_IND_BLOCK]);
-    if (blockNum != 0)
-        return blockNum;
+    // indirect block numbers
+    int index = logicalBlockNum - EXT2_NDIR_BLOCKS;
+    if (index < BLOCKNUMS_PER_BLOCK)
+        return map_indirect((int*)&inode.i_block[EXT2_IND_BLOCK], index, blockNum, window);
 
-    // look for an available double-indirect block entry (we will not use triple-indirect blocks)
-    // if the double-indirect block doesn't exist, create it
-    if (inode.i_block[EXT2_DIND_BLOCK] == 0) {
-        inode.i_block[EXT2_DIND_BLOCK] = device->allocate(BLOCK);
-        blockNum = allocate_indirect(device, &doubleBlock.nums[0]); // use the first double-indirect block entry
+    // double-indirect block numbers (we will not use triple-indirect blocks); if the double-indirect block doesn't
+    // exist, create it
+    index -= BLOCKNUMS_PER_BLOCK;
+    if (index >= BLOCKNUMS_PER_BLOCK * BLOCKNUMS_PER_BLOCK)
+        return 0; // if the file is too big to fit inside of double-indirect blocks, fail
+    DataBlock doubleBlock(device);
+    bool created = inode.i_block[EXT2_DIND_BLOCK] == 0;
+    if (created) {
+        if (!(inode.i_block[EXT2_DIND_BLOCK] = new_block(window)))
+            return 0;
+    } else
+        doubleBlock.get(inode.i_block[EXT2_DIND_BLOCK]);
+    int indirectBlockNum = doubleBlock.nums[index / BLOCKNUMS_PER_BLOCK];
+    blockNum = map_indirect(&doubleBlock.nums[index / BLOCKNUMS_PER_BLOCK], index % BLOCKNUMS_PER_BLOCK, blockNum, window);
+    if (created || doubleBlock.nums[index / BLOCKNUMS_PER_BLOCK] != indirectBlockNum) // it's new, or a new indirect block was added to it
         doubleBlock.put(inode.i_block[EXT2_DIND_BLOCK]);
-        return blockNum;
+    return blockNum;
+}
+
+// visit every block allocated to this file: its data blocks in logical order, along with the indirect blocks
+// (or extent tree nodes) that map them
+void CachedINode::for_each_block(const std::function<void(int blockNum, bool isData)>& visit) {
+    if (S_ISLNK(inode.i_mode) && inode.i_size < sizeof(inode.i_block))
+        return; // symbolic links keep their target in the i_block array itself, so they have no blocks
+    if (has_extents()) {
+        for_each_extent((ExtentHeader*)inode.i_block, visit);
+        return;
+    }
+    for (int i = 0; i < EXT2_NDIR_BLOCKS; i++) {
+        if (inode.i_block[i]) visit(inode.i_block[i], true);
     }
+    for_each_indirect(inode.i_block[EXT2_IND_BLOCK], 1, visit);
+    for_each_indirect(inode.i_block[EXT2_DIND_BLOCK], 2, visit);
+    for_each_indirect(inode.i_block[EXT2_TIND_BLOCK], 3, visit);
+}
 
-    // get the existing double-indirect block
-    doubleBlock.get(inode.i_block[EXT2_DIND_BLOCK]);
-    // look for an available double-indirect block entry
-    for (int i = 0; i < BLOCKNUMS_PER_BLOCK; i++) {
-        blockNum = allocate_indirect(device, &doubleBlock.nums[i]);
-        // since we may have added a new indirect block number to the double-indirect data block, write it back
-        doubleBlock.put();
-        if (blockNum != 0)
-            return blockNum;
+// visit the blocks mapped by an extent tree node: each child node before the blocks it maps
+void CachedINode::for_each_extent(ExtentHeader* header, const std::function<void(int blockNum, bool isData)>& visit) {
+    BlockUseScope scope(INDEX_USE);
+    if (header->eh_magic != EXT3_EXT_MAGIC)
+        return;
+    if (header->eh_depth == 0) {
+        Extent* extents = (Extent*)(header + 1);
+        for (int i = 0; i < header->eh_entries; i++) {
+            int extentLength = extents[i].ee_len > EXT_INIT_MAX_LEN ? extents[i].ee_len - EXT_INIT_MAX_LEN : extents[i].ee_len;
+            for (int j = 0; j < extentLength; j++)
+                visit(extents[i].ee_start + j, true);
+        }
+        return;
+    }
+    DataBlock block(device);
+    ExtentIndex* indexes = (ExtentIndex*)(header + 1);
+    for (int i = 0; i < header->eh_entries; i++) {
+        visit(indexes[i].ei_leaf, false);
+        block.get(indexes[i].ei_leaf);
+        for_each_extent((ExtentHeader*)block.buffer, visit);
+    }
+}
+
+// map a logical block of an extent-mapped file to a device block, which is allocated here if blockNum is 0: an
+// extent that it's adjacent to, both logically and on the device, grows to take it, and otherwise it gets an extent
+// of its own; only the extents held in the inode itself can be added to, so a file needing a deeper tree can't grow
+int CachedINode::allocate_extent(int logicalBlockNum, int blockNum, Reservation* window) {
+    BlockUseScope scope(INDEX_USE);
+    ExtentHeader* header = (ExtentHeader*)inode.i_block;
+    if (header->eh_magic != EXT3_EXT_MAGIC || header->eh_depth != 0) {
+        TRACE(1, "cannot extend inode %d, only extents held in the inode can be added to\n", inodeNum);
+        return 0;
+    }
+    Extent* extents = (Extent*)(header + 1);
+    int i = header->eh_entries - 1; // the last extent starting before the logical block, if any
+    while (i >= 0 && extents[i].ee_block > (__u32)logicalBlockNum)
+        i--;
+    Extent* prev = i >= 0 ? &extents[i] : nullptr;
+    Extent* next = i + 1 < header->eh_entries ? &extents[i + 1] : nullptr;
+    if (prev && prev->ee_block + (prev->ee_len > EXT_INIT_MAX_LEN ? prev->ee_len - EXT_INIT_MAX_LEN : prev->ee_len) > (__u32)logicalBlockNum) {
+        TRACE(1, "cannot map block %d of inode %d, it's already in an extent\n", logicalBlockNum, inodeNum);
+        return 0;
     }
 
-    return 0; // if the file is too big to fit inside of double-indirect blocks, fail
+    bool allocated = !blockNum;
+    if (allocated && !(blockNum = new_block(window)))
+        return 0;
+    if (prev && prev->ee_len < EXT_INIT_MAX_LEN && prev->ee_block + prev->ee_len == (__u32)logicalBlockNum
+        && prev->ee_start + prev->ee_len == (__u32)blockNum) {
+        prev->ee_len++;
+        if (next && next->ee_len < EXT_INIT_MAX_LEN - prev->ee_len && next->ee_block == (__u32)logicalBlockNum + 1
+            && next->ee_start == (__u32)blockNum + 1) { // it filled the gap between two extents, so they join
+            prev->ee_len += next->ee_len;
+            memmove(next, next + 1, (header->eh_entries - i - 2) * sizeof(Extent));
+            header->eh_entries--;
+        }
+        return blockNum;
+    }
+    if (next && next->ee_len < EXT_INIT_MAX_LEN - 1 && next->ee_block == (__u32)logicalBlockNum + 1
+        && next->ee_start == (__u32)blockNum + 1) {
+        next->ee_block--;
+        next->ee_start--;
+        next->ee_len++;
+        return blockNum;
+    }
+    if (header->eh_entries == header->eh_max) {
+        if (allocated)
+            device->deallocate(BLOCK, blockNum);
+        TRACE(1, "cannot extend inode %d, its extents are full\n", inodeNum);
+        return 0;
+    }
+    Extent* extent = &extents[i + 1]; // keep the extents in logical order
+    memmove(extent + 1, extent, (header->eh_entries - i - 1) * sizeof(Extent));
+    header->eh_entries++;
+    extent->ee_block = logicalBlockNum;
+    extent->ee_len = 1;
+    extent->ee_start_hi = 0;
+    extent->ee_start = blockNum;
+    return blockNum;
 }
 
 // checks if this directory contains no file entries
 bool CachedINode::is_dir_empty() {
+    BlockUseScope scope(DIRECTORY_USE);
     if (!S_ISDIR(inode.i_mode))
         return false; // if non-directory, default to false
 
@@ -157,7 +387,7 @@ bool CachedINode::is_dir_empty() {
         return false; // not empty if there are more links than just . and ..
 
     DataBlock block(device);
-    block.get(inode.i_block[0]);
+    block.get(logical2physical(0));
     DirectoryEntry* dirEntry = (DirectoryEntry*)&block.buffer[PARENT_DIR_ENTRY_OFFSET]; // look at entry for parent directory
 
     // is empty if the record length for .. is the rest of the block
@@ -166,29 +396,36 @@ bool CachedINode::is_dir_empty() {
 
 // list the contents of this directory
 void CachedINode::ls_dir() {
-    CachedINode* file; // cached inode used for the entries in this directory
+    std::vector<CachedINode> files; // private copies of the inodes for the entries in this directory
+    std::vector<std::string_view> names; // the entries' names, copied out of the directory's data blocks
     for (const auto& entry : Directory(this)) {
-        file = fs.inodeTable.get(device, entry.inodeNum);
-        file->ls_file(entry.name);
-        file->put();
+        if (entry.inodeNum == 0)
+            continue; // unused entry
+        char* name = fs->arena.allocate(entry.name.size());
+        memcpy(name, entry.name.data(), entry.name.size());
+        names.emplace_back(name, entry.name.size());
+        files.emplace_back();
+        files.back().inodeNum = entry.inodeNum;
     }
+
+    fs->inodeTable.read_inodes(device, files); // fetch all the inodes at once
+    for (size_t i = 0; i < files.size(); i++)
+        files[i].ls_file(names[i]);
 }
 
 // list the attributes of this file
-void CachedINode::ls_file(const std::string& name) {
-    std::stringstream stream;
-    stream << mode();
-    stream << std::setw(5) << inode.i_links_count; // link count
-    stream << std::setw(5) << inode.i_gid; // gid
-    stream << std::setw(5) << inode.i_uid; // uid
-    stream << std::setw(8) << inode.i_size; // file size
+void CachedINode::ls_file(std::string_view name) {
+    std::cout << mode();
+    std::cout << std::setw(5) << inode.i_links_count; // link count
+    std::cout << std::setw(5) << inode.i_gid; // gid
+    std::cout << std::setw(5) << inode.i_uid; // uid
+    std::cout << std::setw(8) << inode.i_size; // file size
     time_t timer = inode.i_ctime;
-    std::string fileTime(ctime(&timer)); // convert time value into a string
-    stream << " " << fileTime.substr(0, fileTime.size() - 1); // remove the newline character
-    stream << " " << name;
-    if (linkname() != "")
-        stream << " -> " << linkname();
-    std::cout << stream.str() << "\n";
+    std::cout << " " << std::string_view(ctime(&timer), 24); // leave off the newline character
+    std::cout << " " << name;
+    if (S_ISLNK(inode.i_mode))
+        std::cout << " -> " << (char*)inode.i_block;
+    std::cout << "\n";
 }
 
 // print basic info about this file
@@ -207,8 +444,8 @@ void CachedINode::stat() {
 void CachedINode::create_file_inode() {
     bzero(&inode, sizeof(INode));
     inode.i_mode = REG_FILE_MODE;
-    inode.i_uid = fs.running->uid; // owner user ID
-    inode.i_gid = fs.running->gid; // group ID
+    inode.i_uid = fs->running->uid; // owner user ID
+    inode.i_gid = fs->running->gid; // group ID
     inode.i_size = 0; // empty file, no data blocks
     inode.i_links_count = 1; // links count=1 because of parent directory
     inode.i_atime = time(0L); // set access to current time
@@ -232,8 +469,8 @@ void CachedINode::create_symlink_inode(const std::string& srcName) {
 void CachedINode::make_dir_inode(int blockNum) {
     bzero(&inode, sizeof(INode));
     inode.i_mode = DIR_FILE_MODE;
-    inode.i_uid = fs.running->uid; // owner user ID
-    inode.i_gid = fs.running->gid; // group ID
+    inode.i_uid = fs->running->uid; // owner user ID
+    inode.i_gid = fs->running->gid; // group ID
     inode.i_size = BLOCK_SIZE; // directories start with 1 data block to store the . and .. entries
     inode.i_links_count = 2; // Links count=2 because of . and ..
     inode.i_atime = time(0L); // set access to current time
@@ -244,121 +481,347 @@ void CachedINode::make_dir_inode(int blockNum) {
     isDirty = true;
 }
 
-// add an entry to this directory for a new file/sub-directory
-void CachedINode::make_dir_entry(const std::string& name, int inodeNum) {
+// scan this directory to find the free space in each of its blocks: the slack after each entry, and the unused entries
+void CachedINode::index_slack() {
+    slack.clear();
+    auto dir = Directory(this);
+    for (const auto& entry : dir) {
+        if ((int)slack.size() <= dir.index)
+            slack.resize(dir.index + 1);
+        int gap = entry.inodeNum ? entry.length - entry.idealLength : entry.length;
+        slack[dir.index].largest = std::max(slack[dir.index].largest, gap);
+        slack[dir.index].total += gap;
+    }
+}
+
+// add an entry to this directory for a new file/sub-directory, in the first block with room for it; returns false if
+// a new block was needed and the device is full
+bool CachedINode::make_dir_entry(std::string_view name, int inodeNum) {
     int idealLength = 4 * ((8 + name.length() + 3) / 4); // the new entry's ideal length
-    int remaining; // the actual length for the new entry will be all the remaining space in the block
 
+    if (slack.empty())
+        index_slack(); // the index is kept up to date from now on, while this inode stays cached
     auto dir = Directory(this);
-    for (const auto& entry : dir) {
-        if (entry.isLast) {
-            remaining = entry.length - entry.idealLength;
-            if (idealLength <= remaining) {
-                dir.appendEntry(name, inodeNum, remaining);
-                return;
-            }
+    for (int i = 0; i < (int)slack.size(); i++) {
+        if (slack[i].largest >= idealLength) {
+            dir.seek(i);
+            if (dir.insertEntry(name, inodeNum))
+                return true;
         }
     }
 
     // no space in existing data blocks, so create a new one
-    int blockNum = device->allocate(BLOCK);
+    int blockNum = allocate_block(inode.i_size / BLOCK_SIZE);
+    if (blockNum == 0)
+        return false;
     dir.createEntry(name, inodeNum, blockNum);
     isDirty = true;
+    return true;
 }
 
 // delete an entry from this directory
-void CachedINode::remove_dir_entry(const std::string& name) {
+void CachedINode::remove_dir_entry(std::string_view name) {
     auto dir = Directory(this);
     for (const auto& entry : dir) {
         if (entry.name == name) {
             dir.removeEntry();
             inode.i_ctime = time(0L); // update inode change time
             isDirty = true; // we modified this cached inode, so mark it as dirty
-            return;
+            break;
         }
     }
+
+    // once a large directory is mostly empty space, repack it so later scans don't have to wade through it
+    if (inode.i_size < COMPACT_MIN_BLOCKS * BLOCK_SIZE || has_extents())
+        return;
+    if (slack.empty())
+        index_slack();
+    long freeBytes = 0; // all the slack, not just the gaps big enough for a new entry
+    for (const BlockSlack& free : slack)
+        freeBytes += free.total;
+    if ((inode.i_size - freeBytes) * 100 < (long)inode.i_size * COMPACT_FILL_PERCENT) {
+        int released = compact_dir();
+        TRACE(1, "compacted directory inode %d, releasing %d blocks\n", inodeNum, released);
+    }
 }
 
-// erases a file; deallocates all its blocks, clears i_block[], and sets size to 0
-void CachedINode::truncate() {
-    if (S_ISLNK(inode.i_mode))
-        return; // symbolic links have no data blocks to deallocate
+// repack this directory's entries into as few blocks as possible, releasing the emptied blocks;
+// returns the number of blocks released
+int CachedINode::compact_dir() {
+    BlockUseScope scope(DIRECTORY_USE);
+    if (has_extents())
+        return 0; // its blocks can't be released from the middle of an extent, so it's left as it is
+    slack.clear(); // every block changes, so the index is rebuilt when it's next needed
+    std::string records; // copies of all the entries, each trimmed to its ideal length
+    for (const auto& entry : Directory(this)) {
+        if (entry.inodeNum == 0)
+            continue; // unused entry
+        size_t offset = records.size();
+        records.resize(offset + entry.idealLength, '\0');
+        memcpy(&records[offset], entry.dirEntry, 8 + entry.name.length());
+        ((DirectoryEntry*)&records[offset])->rec_len = entry.idealLength;
+    }
+
     DataBlock block(device);
-    for (int i = 0; i < EXT2_NDIR_BLOCKS; i++) {
-        if (inode.i_block[i] == 0)
-            break;
-        device->deallocate(BLOCK, inode.i_block[i]);
+    int index = 0; // logical block number of the block being filled
+    int used = 0; // bytes used so far in the block being filled
+    DirectoryEntry* last = nullptr; // the last entry in the block being filled
+    for (size_t offset = 0; offset < records.size();) {
+        DirectoryEntry* record = (DirectoryEntry*)&records[offset];
+        if (used + record->rec_len > BLOCK_SIZE) {
+            last->rec_len += BLOCK_SIZE - used; // the last entry in a block takes up the rest of the block
+            block.put(logical2physical(index++));
+            bzero(block.buffer, BLOCK_SIZE);
+            used = 0;
+        }
+        last = (DirectoryEntry*)&block.buffer[used];
+        memcpy(last, record, record->rec_len);
+        used += record->rec_len;
+        offset += record->rec_len;
     }
-    if (inode.i_block[EXT2_IND_BLOCK] != 0)
-        truncate_indirect(device, inode.i_block[EXT2_IND_BLOCK]);
-    if (inode.i_block[EXT2_DIND_BLOCK]) {
-        block.get(inode.i_block[EXT2_DIND_BLOCK]);
+    last->rec_len += BLOCK_SIZE - used;
+    block.put(logical2physical(index));
+
+    int released = inode.i_size / BLOCK_SIZE - (index + 1);
+    if (released > 0) {
+        release_blocks(index + 1);
+        inode.i_size = (index + 1) * BLOCK_SIZE;
+        inode.i_ctime = time(0L); // update inode change time
+        isDirty = true;
+    }
+    return std::max(released, 0);
+}
+
+// deallocate this file's blocks in a range of logical blocks, from a logical block onward by default, along with the
+// indirect blocks no longer needed; returns FAILURE if an extent-mapped file would need more extents than it can hold
+int CachedINode::release_blocks(int firstBlock, int endBlock) {
+    BlockUseScope scope(INDEX_USE);
+    if (has_extents())
+        return release_extents(firstBlock, endBlock);
+    int freeBefore = device->nbfree;
+    nextGoal = 0; // found again from the file's new last block
+    for (int i = firstBlock; i < std::min(endBlock, EXT2_NDIR_BLOCKS); i++) {
+        if (inode.i_block[i])
+            device->deallocate(BLOCK, inode.i_block[i]);
+        inode.i_block[i] = 0;
+    }
+
+    // release the block numbers from index first up to end in an indirect block, and the indirect block itself if
+    // that leaves it empty
+    auto releaseIndirect = [this](__u32& indirectBlockNum, long first, long end) {
+        if (!indirectBlockNum || end <= 0 || first >= BLOCKNUMS_PER_BLOCK)
+            return;
+        DataBlock block(device);
+        block.get(indirectBlockNum);
+        bool empty = true;
         for (int i = 0; i < BLOCKNUMS_PER_BLOCK; i++) {
-            if (!block.nums[i])
+            if (i >= first && i < end && block.nums[i]) {
+                device->deallocate(BLOCK, block.nums[i]);
+                block.nums[i] = 0;
+            }
+            empty = empty && !block.nums[i];
+        }
+        if (empty) {
+            device->deallocate(BLOCK, indirectBlockNum);
+            indirectBlockNum = 0;
+        } else
+            block.put();
+    };
+
+    long first = firstBlock - EXT2_NDIR_BLOCKS, end = (long)endBlock - EXT2_NDIR_BLOCKS;
+    releaseIndirect(inode.i_block[EXT2_IND_BLOCK], first, end);
+    first -= BLOCKNUMS_PER_BLOCK;
+    end -= BLOCKNUMS_PER_BLOCK;
+    if (inode.i_block[EXT2_DIND_BLOCK] && end > 0) {
+        DataBlock doubleBlock(device);
+        doubleBlock.get(inode.i_block[EXT2_DIND_BLOCK]);
+        bool empty = true;
+        for (int i = 0; i < BLOCKNUMS_PER_BLOCK; i++, first -= BLOCKNUMS_PER_BLOCK, end -= BLOCKNUMS_PER_BLOCK) {
+            releaseIndirect(*(__u32*)&doubleBlock.nums[i], first, end);
+            empty = empty && !doubleBlock.nums[i];
+        }
+        if (empty) {
+            device->deallocate(BLOCK, inode.i_block[EXT2_DIND_BLOCK]);
+            inode.i_block[EXT2_DIND_BLOCK] = 0;
+        } else
+            doubleBlock.put();
+    }
+    inode.i_blocks -= std::min(inode.i_blocks, (__u32)((device->nbfree - freeBefore) * (BLOCK_SIZE / 512)));
+    isDirty = true;
+    return SUCCESS;
+}
+
+// deallocate the blocks in a range of an extent-mapped file: each extent keeps whatever lies outside the range, so
+// one that spans the whole range is split in two; only the extents held in the inode itself can be changed
+int CachedINode::release_extents(int firstBlock, int endBlock) {
+    BlockUseScope scope(INDEX_USE);
+    ExtentHeader* header = (ExtentHeader*)inode.i_block;
+    if (header->eh_magic != EXT3_EXT_MAGIC || header->eh_depth != 0) {
+        std::cerr << "cannot release blocks of inode " << inodeNum << ", only extents held in the inode can be changed\n";
+        return FAILURE;
+    }
+    Extent* extents = (Extent*)(header + 1);
+    std::vector<Extent> kept;
+    std::vector<std::pair<int, int>> released; // the runs of blocks to deallocate, as (first block, length)
+    for (int i = 0; i < header->eh_entries; i++) {
+        Extent extent = extents[i];
+        int flag = extent.ee_len > EXT_INIT_MAX_LEN ? EXT_INIT_MAX_LEN : 0; // uninitialized extents stay uninitialized
+        long start = extent.ee_block, end = start + extent.ee_len - flag;
+        long from = std::max(start, (long)firstBlock), to = std::min(end, (long)endBlock);
+        if (from >= to) {
+            kept.push_back(extent);
+            continue;
+        }
+        released.push_back({ extent.ee_start + (from - start), to - from });
+        if (start < from) {
+            Extent before = extent;
+            before.ee_len = from - start + flag;
+            kept.push_back(before);
+        }
+        if (to < end) {
+            Extent after = extent;
+            after.ee_block = to;
+            after.ee_start = extent.ee_start + (to - start);
+            after.ee_len = end - to + flag;
+            kept.push_back(after);
+        }
+    }
+    if ((int)kept.size() > header->eh_max) {
+        std::cerr << "cannot release blocks of inode " << inodeNum << ", it would need more extents than it can hold\n";
+        return FAILURE;
+    }
+
+    int freeBefore = device->nbfree;
+    nextGoal = 0;
+    for (auto [start, length] : released)
+        for (int blockNum = start; blockNum < start + length; blockNum++)
+            device->deallocate(BLOCK, blockNum);
+    std::copy(kept.begin(), kept.end(), extents);
+    header->eh_entries = kept.size();
+    inode.i_blocks -= std::min(inode.i_blocks, (__u32)((device->nbfree - freeBefore) * (BLOCK_SIZE / 512)));
+    isDirty = true;
+    return SUCCESS;
+}
+
+// allocate the blocks of a range of logical blocks that aren't allocated yet: each hole gets the best-fitting run of
+// free blocks, which is zeroed with a single write and mapped in one pass, since this file system has no unwritten
+// blocks to read back as zeros; returns the number of blocks allocated, or -1 if the device filled up or the file
+// can't map any more blocks, and sets *reached to the logical block after the last one it covered either way
+int CachedINode::preallocate(int firstBlock, int endBlock, int* reached) {
+    std::vector<char> zeros;
+    int freeBefore = device->nbfree;
+    int allocated = 0, result = 0, logical = firstBlock;
+    while (logical < endBlock && result == 0) {
+        int length;
+        if (map_run(logical, &length)) {
+            logical += length; // already allocated
+            continue;
+        }
+        long holeEnd = std::min((long)logical + length, (long)endBlock);
+        int more;
+        while (holeEnd < endBlock && !map_run(holeEnd, &more)) // a missing indirect block counts as a one-block hole
+            holeEnd = std::min(holeEnd + more, (long)endBlock);
+        int got, start = device->allocate_run(holeEnd - logical, &got);
+        if (got == 0) {
+            result = -1; // the device is full
+            break;
+        }
+        zeros.resize((size_t)got * BLOCK_SIZE);
+        device->write_blocks(start, got, zeros.data());
+        for (int i = 0; i < got; i++, logical++) {
+            nextGoal = start + i; // any indirect block goes right after the run
+            if (map_block(logical, start + i, nullptr) != start + i) {
+                for (int j = i; j < got; j++)
+                    device->deallocate(BLOCK, start + j); // the rest of the run couldn't be mapped
+                result = -1;
                 break;
-            truncate_indirect(device, block.nums[i]);
+            }
+            allocated++;
         }
+        nextGoal = start + got;
     }
+    inode.i_blocks += (freeBefore - device->nbfree) * (BLOCK_SIZE / 512);
+    *reached = logical;
+    return result ? result : allocated;
+}
+
+// erases a file; deallocates all its blocks, including the indirect blocks (or extent tree nodes) and the blocks
+// after any hole, clears i_block[], and sets size to 0
+void CachedINode::truncate() {
+    BlockUseScope scope(INDEX_USE);
+    if (S_ISLNK(inode.i_mode))
+        return; // symbolic links have no data blocks to deallocate
+    slack.clear();
+    nextGoal = 0;
+    bool extents = has_extents();
+    for_each_block([&](int blockNum, bool) { device->deallocate(BLOCK, blockNum); });
     bzero(inode.i_block, EXT2_N_BLOCKS * sizeof(int)); // erase all the block numbers
+    if (extents) {
+        ExtentHeader* header = (ExtentHeader*)inode.i_block;
+        header->eh_magic = EXT3_EXT_MAGIC; // an empty tree, held in the inode
+        header->eh_max = (sizeof(inode.i_block) - sizeof(ExtentHeader)) / sizeof(Extent);
+    }
     inode.i_atime = time(0L); // update file accessed time
     inode.i_ctime = time(0L); // update inode change time
     inode.i_mtime = time(0L); // update file modified time
     inode.i_size = 0;
+    inode.i_blocks = 0;
     isDirty = true;
 }
 
-// decrement reference count; if no longer in use and it was modified, write back cached inode data to its device
+// decrement reference count; a modified inode stays in the table once it's no longer in use, and is written back
+// along with the other inodes in its inode table block when the table needs room or is synced
 void CachedINode::put() {
     refCount--;
     TRACE(3, "reference count for cached inode [%d, %d] at address %p is now %d\n", device->fd, inodeNum, this, refCount);
+    fs->inodeTable.release(this); // its entry can be reused once it's unused and written back
+}
 
-    if (refCount > 0)
-        return;
-    if (!isDirty)
-        return;
+// write back cached inode data to its device
+void CachedINode::write() {
     isDirty = false; // clear isDirty flag
+    timesDirty = false;
 
     TRACE(1, "writing back dev=%d, ino=%d\n", device->fd, inodeNum);
-    int blockNum = ((inodeNum - 1) / INODES_PER_BLOCK) + device->inodeStart;
-    int entry = (inodeNum - 1) % INODES_PER_BLOCK;
     DataBlock block(device);
-    block.get(blockNum);
-    block.inodes[entry] = inode; // replace device data with the data from memory
+    block.get(device->inode_block(inodeNum));
+    memcpy(&block.buffer[device->inode_offset(inodeNum)], &inode, sizeof(INode)); // any larger inode's extra fields are kept
     block.put();
 }
 
-// attempt to allocate a new data block and save its block number in an indirect block
-int CachedINode::allocate_indirect(MountedDevice* device, int* indirectBlockNum) {
+// map an entry of an indirect block to a device block, which is allocated here if blockNum is 0; the indirect block
+// itself is created if it doesn't already exist (its block number is 0), and its number is stored for the caller
+int CachedINode::map_indirect(int* indirectBlockNum, int index, int blockNum, Reservation* window) {
+    BlockUseScope scope(INDEX_USE);
     DataBlock block(device);
-
-    // if the indirect block doesn't already exist (its block number is 0), create a new one
-    // and populate the indrector block number so it is modified in the calling function
-    if (*indirectBlockNum == 0) {
-        *indirectBlockNum = device->allocate(BLOCK);
-        block.nums[0] = device->allocate(BLOCK); // assign the first indirect block entry
-        block.put(*indirectBlockNum);
-        return block.nums[0];
-    }
-
-    block.get(*indirectBlockNum); // get the existing indirect block
-    for (int i = 0; i < BLOCKNUMS_PER_BLOCK; i++) {
-        if (block.nums[i] == 0) {
-            block.nums[i] = device->allocate(BLOCK); // assign the next available block entry
-            block.put();
-            return block.nums[i];
-        }
+    bool created = *indirectBlockNum == 0;
+    if (created) {
+        if (!(*indirectBlockNum = new_block(window))) // a new indirect block starts out empty
+            return 0;
+    } else
+        block.get(*indirectBlockNum); // get the existing indirect block
+    if (block.nums[index] == 0) {
+        block.nums[index] = blockNum ? blockNum : new_block(window);
+        if (created || block.nums[index]) // a new indirect block is written even if the device had no block to map
+            block.put(*indirectBlockNum);
     }
-
-    return 0; // could not allocate an entry in this indirect block
+    return block.nums[index];
 }
 
-// deallocate all the data blocks listed in an indirect block
-void CachedINode::truncate_indirect(MountedDevice* device, int indirectBlockNum) {
+// visit an indirect block and the blocks it maps; level 1 maps data blocks, level 2 maps indirect blocks, and so on
+void CachedINode::for_each_indirect(int indirectBlockNum, int level, const std::function<void(int blockNum, bool isData)>& visit) {
+    BlockUseScope scope(INDEX_USE);
+    if (!indirectBlockNum)
+        return;
+    visit(indirectBlockNum, false);
     DataBlock block(device);
     block.get(indirectBlockNum);
     for (int i = 0; i < BLOCKNUMS_PER_BLOCK; i++) {
         if (!block.nums[i])
-            break;
-        device->deallocate(BLOCK, block.nums[i]);
+            continue; // keep going, there may be more blocks after a hole in the file
+        if (level == 1)
+            visit(block.nums[i], true);
+        else
+            for_each_indirect(block.nums[i], level - 1, visit);
     }
 }
@@ -1,37 +1,69 @@
 #pragma once
 #include "main.hpp"
+#include "RangeLocks.hpp"
 class MountedDevice;
+struct Reservation;
+class OpenFile;
+
+// the free space in one directory block
+struct BlockSlack {
+    int largest = 0; // the largest free gap, so the longest entry the block can take
+    int total = 0; // the free bytes in all its gaps
+};
 
 // a file's inode cached in memory
 class CachedINode {
 public:
     INode inode; // EXT2 inode structure
-    MountedDevice* device; // device on which the inode is located
+    MountedDevice* device = nullptr; // device on which the inode is located
     int inodeNum; // inode number
     int refCount = 0; // number of times this inode is currently being used by the simulation program
     bool isDirty = false; // does this cached data need to be written to the disk?
+    bool timesDirty = false; // with lazytime, was only its access time changed? it's written when evicted or synced
     CachedINode* deviceRoot = nullptr; // root inode of the device mounted at this point
+    std::vector<BlockSlack> slack; // for directories, the free space in each block, by logical block; empty until first needed
+    OpenFile* openFiles = nullptr; // the open file table entries for this file, linked through OpenFile::nextLink
+    RangeLocks locks; // the byte-range locks the processes hold on this file
+    bool listedFree = false; // is this table entry on the inode table's list of free entries?
+    int nextGoal = 0; // where this file's next block should go, right after the last one it was given; 0 until first needed
 
+    bool is_held(); // does this table entry still hold an inode, because it's in use or not yet written back?
+    void accessed(); // update the access time, as the device's mount options allow
     std::string fullpath(); // find the full absolute path of this diretory
     std::string linkname(); // for symbolic link files, returns the absolute pathname that it links to
     std::string mode(); // returns this file's mode as a string, e.g., 0644 is -rw-r--r--
     std::string search(int targetINodeNum); // search this directory for a given inode number and return its name
-    int search(const std::string& targetName); // search this directory for a given name and return its inode number
+    int search(std::string_view targetName); // search this directory for a given name and return its inode number
+    bool has_extents(); // is this file's data mapped by an extent tree rather than by indirect blocks?
     int logical2physical(int logicalBlockNum); // convert a logical block number for this file into an actual block number
-    int allocate_block(); // get a new data block number and update the inode i_block[] structure
+    int map_run(int logicalBlockNum, int* length); // map a logical block and count the blocks that follow it contiguously
+    int allocate_block(int logicalBlockNum, Reservation* window = nullptr); // get a new data block for a logical block, map it and count it in i_blocks
+    int preallocate(int firstBlock, int endBlock, int* reached); // allocate and zero the unallocated blocks of a range, a run at a time
+    void for_each_block(const std::function<void(int blockNum, bool isData)>& visit); // visit every block allocated to this file
     bool is_dir_empty(); // checks if this directory contains no file entries
     void ls_dir(); // list the contents of this directory
-    void ls_file(const std::string& filename); // list the attributes of this file
+    void ls_file(std::string_view filename); // list the attributes of this file
     void stat(); // print basic info about this file
     void create_file_inode(); // initialize the inode structure for this new file
     void create_symlink_inode(const std::string& srcName); // modify a regular file inode to make it a symbolic link
     void make_dir_inode(int blockNum); // initialize the inode structure for this new directory
-    void make_dir_entry(const std::string& name, int inodeNum); // add an entry to this directory for a new file/sub-directory
-    void remove_dir_entry(const std::string& name); // delete an entry from this directory
+    void index_slack(); // scan this directory to find the free space in each of its blocks
+    bool make_dir_entry(std::string_view name, int inodeNum); // add an entry to this directory for a new file/sub-directory; false if the device is full
+    void remove_dir_entry(std::string_view name); // delete an entry from this directory
+    int compact_dir(); // repack this directory's entries into as few blocks as possible; returns the number of blocks released
+    int release_blocks(int firstBlock, int endBlock = INT32_MAX); // deallocate this file's blocks in a range of logical blocks
     void truncate(); // erases a file; deallocates all its blocks, clears i_block[], and sets size to 0
-    void put(); // decrement reference count; if no longer in use and it was modified, write back cached inode data to its device
+    void put(); // decrement reference count; a modified inode is written back later, with others in its inode table block
+    void write(); // write back cached inode data to its device
 
 private:
-    int allocate_indirect(MountedDevice* device, int* indirectBlockNum); // attempt to allocate a new data block in an indirect block
-    void truncate_indirect(MountedDevice* device, int indirectBlockNum); // deallocate all the data blocks listed in an indirect block
+    int map_indirect(int* indirectBlockNum, int index, int blockNum, Reservation* window); // map an entry of an indirect block, creating it if needed
+    int map_block(int logicalBlockNum, int blockNum, Reservation* window); // map a logical block to a device block, allocating it if blockNum is 0
+    int allocate_extent(int logicalBlockNum, int blockNum, Reservation* window); // map a logical block of an extent-mapped file
+    int release_extents(int firstBlock, int endBlock); // deallocate the blocks in a range of an extent-mapped file
+    int goal(); // the block this file's next block should be, to keep it contiguous
+    int new_block(Reservation* window); // allocate a block for this file, as close to the goal as possible
+    int map_extent(int logicalBlockNum, int* length); // map a logical block through this file's extent tree
+    void for_each_extent(ExtentHeader* header, const std::function<void(int blockNum, bool isData)>& visit); // visit the blocks mapped by an extent tree node
+    void for_each_indirect(int indirectBlockNum, int level, const std::function<void(int blockNum, bool isData)>& visit); // visit the blocks mapped by an indirect block
 };
@@ -1,4 +1,5 @@
 #include "DataBlock.hpp"
+#include "Profiler.hpp"
 #include "MountedDevice.hpp"
 
 // construct a blank data block
@@ -34,6 +35,7 @@ void DataBlock::get(int blockNum) { // use when dev has already been set
 
 // load this block's data
 void DataBlock::get() { // use when dev & blockNum have been set
+    PROFILE_SCOPE("DataBlock::get");
     if (!device) {
         std::cerr << "DataBlock::get() failed, device not specified\n";
         return;
@@ -43,8 +45,7 @@ void DataBlock::get() { // use when dev & blockNum have been set
         return;
     }
     TRACE(3, "reading block %d from disk image file %d\n", blockNum, device->fd);
-    lseek(device->fd, (long)blockNum * BLOCK_SIZE, 0);
-    read(device->fd, buffer, BLOCK_SIZE);
+    device->read_block(blockNum, buffer);
 }
 
 // save a data block to a given device
@@ -62,6 +63,7 @@ void DataBlock::put(int blockNum) { // use when dev has already been set
 
 // save this block's data
 void DataBlock::put() { // use when dev & blockNum have been set
+    PROFILE_SCOPE("DataBlock::put");
     if (!device) {
         std::cerr << "DataBlock::put() failed, device not specified\n";
         return;
@@ -71,8 +73,7 @@ void DataBlock::put() { // use when dev & blockNum have been set
         return;
     }
     TRACE(3, "writing block %d to disk image file %d\n", blockNum, device->fd);
-    lseek(device->fd, (long)blockNum * BLOCK_SIZE, 0);
-    write(device->fd, buffer, BLOCK_SIZE);
+    device->write_block(blockNum, buffer);
 }
 
 // determine whether or not a bit is set in a bitmap buffer
@@ -89,3 +90,17 @@ void DataBlock::set_bit(int bit) {
 void DataBlock::clear_bit(int bit) {
     buffer[bit / 8] &= (char)~(1 << (bit % 8));
 }
+
+// count the bits that are set among the first numBits of a bitmap buffer, a whole word at a time
+int DataBlock::count_bits(int numBits) {
+    int count = 0;
+    int numWords = numBits / 64;
+    unsigned long long word;
+    for (int i = 0; i < numWords; i++) {
+        memcpy(&word, &buffer[i * 8], 8);
+        count += __builtin_popcountll(word);
+    }
+    for (int bit = numWords * 64; bit < numBits; bit++)
+        count += test_bit(bit);
+    return count;
+}
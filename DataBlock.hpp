@@ -27,4 +27,5 @@ public:
     bool test_bit(int bit); // determine whether or not a bit is set in a bitmap buffer
     void set_bit(int bit); // set a bit in a bitmap buffer
     void clear_bit(int bit); // clear a bit in a bitmap buffer
+    int count_bits(int numBits); // count the bits that are set among the first numBits of a bitmap buffer
 };
\ No newline at end of file
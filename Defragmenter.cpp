@@ -0,0 +1,252 @@
+#include "Defragmenter.hpp"
+#include "MountedDevice.hpp"
+
+// read the device's layout from its superblock
+Defragmenter::Defragmenter(MountedDevice* device)
+    : device(device)
+    , bitmap(device) {
+    DataBlock block(device);
+    block.get(SUPER_BLOCK);
+    super = *(SuperBlock*)block.buffer;
+    tableBlocks = (super.s_inodes_per_group * sizeof(INode) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    dataStart = device->inodeStart + tableBlocks;
+}
+
+// defragment the device and optionally shrink its disk image to the blocks in use
+int Defragmenter::run(bool shrink) {
+    if (super.s_blocks_count - super.s_first_data_block > super.s_blocks_per_group) {
+        std::cerr << "defrag: cannot defragment, only devices with a single block group are supported\n";
+        return FAILURE;
+    }
+    if (super.s_rev_level != EXT2_GOOD_OLD_REV && super.s_inode_size != sizeof(INode)) {
+        std::cerr << "defrag: cannot defragment, only " << sizeof(INode) << "-byte inodes are supported\n";
+        return FAILURE;
+    }
+
+    load_files();
+    for (CachedINode& file : files) {
+        if (file.has_extents()) {
+            std::cerr << "defrag: cannot defragment, only files mapped by indirect blocks can be moved\n";
+            return FAILURE;
+        }
+    }
+    int released = compact_directories();
+    bitmap.get(device->bmap); // compacting the directories may have released some blocks
+    int fragmented = plan();
+    if (fragmented < 0) {
+        std::cerr << "defrag: cannot defragment, an inode refers to a block out of range (run fsck)\n";
+        return FAILURE;
+    }
+    int moved = move_blocks();
+    for (CachedINode& file : files)
+        remap(file);
+    rewrite_bitmap();
+
+    printf("defrag: %d of %d files were fragmented, %d blocks moved, %d directory blocks released\n",
+        fragmented, (int)files.size(), moved, released);
+    if (shrink) {
+        int oldCount = super.s_blocks_count;
+        int newCount = shrink_image();
+        printf("defrag: disk image shrunk from %d to %d blocks\n", oldCount, newCount);
+    }
+    return SUCCESS;
+}
+
+// read every inode in use, except the reserved ones, from the inode table
+void Defragmenter::load_files() {
+    int firstINode = (super.s_rev_level == EXT2_GOOD_OLD_REV) ? EXT2_GOOD_OLD_FIRST_INO : super.s_first_ino;
+    std::vector<char> table(tableBlocks * BLOCK_SIZE);
+    device->read_blocks(device->inodeStart, tableBlocks, table.data());
+    INode* inodes = (INode*)table.data();
+
+    CachedINode file; // a private copy of each inode; it is not part of the inode table
+    file.device = device;
+    for (int i = 0; i < (int)super.s_inodes_per_group; i++) {
+        file.inodeNum = i + 1;
+        file.inode = inodes[i];
+        if (file.inodeNum < firstINode && file.inodeNum != ROOT_DIR_INODE_NUM)
+            continue; // the blocks of reserved inodes stay where they are
+        if (file.inode.i_links_count == 0)
+            continue; // not in use
+        if (S_ISLNK(file.inode.i_mode) && file.inode.i_size < sizeof(file.inode.i_block))
+            continue; // symbolic links keep their target in the inode itself
+        files.push_back(file);
+    }
+}
+
+// repack every directory's entries into as few blocks as possible; returns the number of blocks released
+int Defragmenter::compact_directories() {
+    int released = 0;
+    int lostAndFound = 0; // its empty blocks are kept so that fsck never needs to allocate any to use it
+    for (CachedINode& file : files) {
+        if (file.inodeNum == ROOT_DIR_INODE_NUM)
+            lostAndFound = file.search("lost+found");
+    }
+    for (CachedINode& file : files) {
+        if (!S_ISDIR(file.inode.i_mode) || file.inodeNum == lostAndFound)
+            continue;
+        released += file.compact_dir();
+        if (file.isDirty)
+            file.write();
+    }
+    return released;
+}
+
+// lay out each file's blocks one after the other, in the order they are read, skipping over the blocks that
+// can't be moved; returns the number of fragmented files, or -1 if an inode refers to a block that doesn't exist
+int Defragmenter::plan() {
+    std::vector<bool> movable(super.s_blocks_count, false);
+    std::vector<std::vector<int>> layouts(files.size()); // each file's blocks: data blocks in order, interleaved with indirect blocks
+    bool valid = true;
+    for (size_t i = 0; i < files.size(); i++) {
+        files[i].for_each_block([&](int blockNum, bool) {
+            if (blockNum < (int)super.s_first_data_block || blockNum >= (int)super.s_blocks_count) {
+                valid = false;
+                return;
+            }
+            layouts[i].push_back(blockNum);
+            movable[blockNum] = true;
+        });
+    }
+    if (!valid)
+        return -1;
+
+    int fragmented = 0;
+    int next = dataStart; // the next location to be filled
+    newLocation.assign(super.s_blocks_count, 0);
+    for (const std::vector<int>& layout : layouts) {
+        for (size_t j = 1; j < layout.size(); j++) {
+            if (layout[j] != layout[j - 1] + 1) {
+                fragmented++;
+                break;
+            }
+        }
+        for (int blockNum : layout) {
+            while (bitmap.test_bit(next - super.s_first_data_block) && !movable[next])
+                next++; // skip over blocks used by the reserved inodes or metadata
+            newLocation[blockNum] = next++;
+        }
+    }
+    return fragmented;
+}
+
+// copy every block to its new location; returns the number of blocks moved
+// each chain of moves is followed until it reaches a free block (or its own start), keeping just one displaced
+// block in memory, so every block is read and written exactly once
+// on a journaled device the moved blocks, data included, are written as metadata, so they go into the command's
+// transaction along with the remapped inodes and indirect blocks and the new bitmap; none of them reaches its home
+// location until the whole transaction is in the journal, so a crash leaves either the old layout or the new one
+int Defragmenter::move_blocks() {
+    BlockUseScope scope(INDEX_USE);
+    std::vector<bool> done(super.s_blocks_count, true);
+    for (int b = 0; b < (int)super.s_blocks_count; b++) {
+        if (newLocation[b] && newLocation[b] != b)
+            done[b] = false;
+    }
+
+    DataBlock moving(device); // the data being moved
+    DataBlock displaced(device); // the data currently at the destination, which moves next
+    int moved = 0;
+    for (int start = 0; start < (int)super.s_blocks_count; start++) {
+        if (done[start])
+            continue;
+        moving.get(start);
+        for (int from = start;;) {
+            int to = newLocation[from];
+            done[from] = true;
+            moved++;
+            if (done[to]) { // the destination is free (or its data has already been moved)
+                moving.put(to);
+                break;
+            }
+            displaced.get(to);
+            moving.put(to);
+            std::swap(moving, displaced);
+            from = to;
+        }
+    }
+    TRACE(1, "moved %d blocks on device %d\n", moved, device->fd);
+    return moved;
+}
+
+// update a file's block numbers, in its inode and its indirect blocks, to refer to the new locations
+void Defragmenter::remap(CachedINode& file) {
+    for (int i = 0; i < EXT2_NDIR_BLOCKS; i++)
+        file.inode.i_block[i] = location(file.inode.i_block[i]);
+    for (int level = 1; level <= 3; level++) {
+        __u32& indirectBlockNum = file.inode.i_block[EXT2_IND_BLOCK + level - 1];
+        if (!indirectBlockNum)
+            continue;
+        indirectBlockNum = location(indirectBlockNum);
+        remap_indirect(indirectBlockNum, level);
+    }
+    file.write();
+}
+
+// update the block numbers in an indirect block, which has already been moved to its new location
+void Defragmenter::remap_indirect(int indirectBlockNum, int level) {
+    BlockUseScope scope(INDEX_USE);
+    DataBlock block(device);
+    block.get(indirectBlockNum);
+    for (int i = 0; i < BLOCKNUMS_PER_BLOCK; i++) {
+        if (!block.nums[i])
+            continue;
+        block.nums[i] = location(block.nums[i]);
+        if (level > 1)
+            remap_indirect(block.nums[i], level - 1);
+    }
+    block.put();
+}
+
+// the new location of a block
+int Defragmenter::location(int blockNum) {
+    return (blockNum && newLocation[blockNum]) ? newLocation[blockNum] : blockNum;
+}
+
+// mark the new locations in use and the vacated blocks free; the number of blocks in use doesn't change
+void Defragmenter::rewrite_bitmap() {
+    for (int b = 0; b < (int)super.s_blocks_count; b++) {
+        if (newLocation[b])
+            bitmap.clear_bit(b - super.s_first_data_block);
+    }
+    for (int b = 0; b < (int)super.s_blocks_count; b++) {
+        if (newLocation[b])
+            bitmap.set_bit(newLocation[b] - super.s_first_data_block);
+    }
+    bitmap.put();
+}
+
+// cut off the unused blocks at the end of the disk image; returns the new number of blocks
+int Defragmenter::shrink_image() {
+    int newCount = dataStart;
+    for (int b = dataStart; b < (int)super.s_blocks_count; b++) {
+        if (bitmap.test_bit(b - super.s_first_data_block))
+            newCount = b + 1;
+    }
+    int removed = super.s_blocks_count - newCount;
+    if (removed == 0)
+        return newCount;
+
+    // the bits past the end of the last group are always set, so they can never be allocated
+    for (int bit = newCount - super.s_first_data_block; bit < BLOCK_SIZE * 8; bit++)
+        bitmap.set_bit(bit);
+    bitmap.put();
+
+    DataBlock block(device);
+    block.get(SUPER_BLOCK);
+    SuperBlock* sp = (SuperBlock*)block.buffer;
+    sp->s_r_blocks_count = (long)sp->s_r_blocks_count * newCount / sp->s_blocks_count;
+    sp->s_blocks_count = newCount;
+    sp->s_free_blocks_count -= removed;
+    block.put();
+    block.get(GROUP_DESCRIPTOR_0);
+    ((GroupDescriptor*)block.buffer)->bg_free_blocks_count -= removed;
+    block.put();
+
+    if (device->journal)
+        device->journal->sync(); // nothing may be written past the new end of the disk image after it's cut off
+    ftruncate(device->fd, (long)newCount * BLOCK_SIZE);
+    device->nblocks = newCount;
+    device->nbfree -= removed;
+    return newCount;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "CachedINode.hpp"
+#include "DataBlock.hpp"
+
+// relocates each file's blocks into one contiguous run, packing all the files toward the front of the device;
+// it works on the inode tables directly, so the device must not have any open files while it runs
+class Defragmenter {
+public:
+    Defragmenter(MountedDevice* device); // read the device's layout from its superblock
+    int run(bool shrink); // defragment the device and optionally shrink its disk image to the blocks in use
+
+private:
+    MountedDevice* device;
+    SuperBlock super; // copy of the device's superblock
+    int tableBlocks; // number of blocks in the inode table
+    int dataStart; // the first block after the file system's metadata
+    DataBlock bitmap; // the device's block bitmap
+    std::vector<CachedINode> files; // private copies of the inodes whose blocks can be moved
+    std::vector<int> newLocation; // where each block is being moved to, or 0 if it stays put
+
+    void load_files(); // read every inode in use, except the reserved ones, from the inode table
+    int compact_directories(); // repack every directory's entries; returns the number of blocks released
+    int plan(); // lay out each file's blocks one after the other; returns the number of fragmented files
+    int move_blocks(); // copy every block to its new location; returns the number of blocks moved
+    void remap(CachedINode& file); // update a file's block numbers to refer to the new locations
+    void remap_indirect(int indirectBlockNum, int level); // update the block numbers in a (moved) indirect block
+    int location(int blockNum); // the new location of a block
+    void rewrite_bitmap(); // mark the new locations in use and the vacated blocks free
+    int shrink_image(); // cut off the unused blocks at the end of the disk image; returns the new number of blocks
+};
@@ -0,0 +1,283 @@
+#include "DeviceCheck.hpp"
+#include "CachedINode.hpp"
+#include "DataBlock.hpp"
+#include "MountedDevice.hpp"
+#include <cstdarg>
+#include <thread>
+
+#define MAX_REPORTED 10 // report at most this many bitmap differences of each kind per group
+#define STREAM_BLOCKS 64 // number of inode table blocks read at a time
+
+// read the file system's layout from the device's superblock and group descriptors
+DeviceCheck::DeviceCheck(MountedDevice* device)
+    : device(device) {
+    DataBlock block(device);
+    block.get(SUPER_BLOCK);
+    super = *(SuperBlock*)block.buffer;
+
+    numGroups = (super.s_blocks_count - super.s_first_data_block + super.s_blocks_per_group - 1) / super.s_blocks_per_group;
+    gdtBlocks = (numGroups * (int)sizeof(GroupDescriptor) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    inodeSize = (super.s_rev_level == EXT2_GOOD_OLD_REV) ? EXT2_GOOD_OLD_INODE_SIZE : super.s_inode_size;
+    firstINode = (super.s_rev_level == EXT2_GOOD_OLD_REV) ? EXT2_GOOD_OLD_FIRST_INO : super.s_first_ino;
+
+    std::vector<char> table(gdtBlocks * BLOCK_SIZE);
+    device->read_blocks(super.s_first_data_block + 1, gdtBlocks, table.data());
+    groups.assign((GroupDescriptor*)table.data(), (GroupDescriptor*)table.data() + numGroups);
+
+    usedBlocks = std::vector<std::atomic<unsigned char>>((super.s_blocks_count + 7) / 8);
+    references = std::vector<std::atomic<int>>(super.s_inodes_count + 1);
+    linkCounts.assign(super.s_inodes_count + 1, 0);
+    problems.resize(numGroups);
+    freeBlocks.assign(numGroups, 0);
+    freeINodes.assign(numGroups, 0);
+}
+
+// check the file system and optionally repair its free counts; return SUCCESS if it's consistent
+int DeviceCheck::run(bool repair) {
+    // the file system's own metadata is in use before any inode claims a block
+    for (int g = 0; g < numGroups; g++) {
+        int start = super.s_first_data_block + g * super.s_blocks_per_group;
+        if (has_super(g)) {
+            for (int b = 0; b < 1 + gdtBlocks + super.s_reserved_gdt_blocks; b++)
+                mark_used(g, start + b, 0);
+        }
+        mark_used(g, groups[g].bg_block_bitmap, 0);
+        mark_used(g, groups[g].bg_inode_bitmap, 0);
+        int tableBlocks = (super.s_inodes_per_group * inodeSize + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        for (int b = 0; b < tableBlocks; b++)
+            mark_used(g, groups[g].bg_inode_table + b, 0);
+    }
+
+    // every group's inodes must be checked before the bitmaps and link counts can be compared
+    for_each_group([this](int g) { check_inodes(g); });
+    for_each_group([this](int g) {
+        check_bitmaps(g);
+        check_links(g);
+    });
+
+    int numProblems = 0;
+    long totalFreeBlocks = 0, totalFreeINodes = 0;
+    for (int g = 0; g < numGroups; g++) {
+        for (const std::string& p : problems[g])
+            std::cout << "group " << g << ": " << p << "\n";
+        numProblems += problems[g].size();
+        totalFreeBlocks += freeBlocks[g];
+        totalFreeINodes += freeINodes[g];
+    }
+    bool countsWrong = false;
+    if (totalFreeBlocks != super.s_free_blocks_count) {
+        printf("superblock: free blocks count is %d, bitmaps say %ld\n", super.s_free_blocks_count, totalFreeBlocks);
+        countsWrong = true;
+        numProblems++;
+    }
+    if (totalFreeINodes != super.s_free_inodes_count) {
+        printf("superblock: free inodes count is %d, bitmaps say %ld\n", super.s_free_inodes_count, totalFreeINodes);
+        countsWrong = true;
+        numProblems++;
+    }
+    for (int g = 0; g < numGroups && !countsWrong; g++)
+        countsWrong = groups[g].bg_free_blocks_count != freeBlocks[g] || groups[g].bg_free_inodes_count != freeINodes[g];
+
+    if (repair && countsWrong) {
+        repair_counts();
+        std::cout << "fsck: free block and inode counts repaired\n";
+    }
+    printf("%s: %ld/%d files, %ld/%d blocks, %d problem%s found\n", device->diskImage.c_str(),
+        super.s_inodes_count - totalFreeINodes, super.s_inodes_count,
+        super.s_blocks_count - totalFreeBlocks, super.s_blocks_count, numProblems, numProblems == 1 ? "" : "s");
+    return numProblems ? FAILURE : SUCCESS;
+}
+
+// run a check on every group, in parallel; the workers take the next unchecked group until there are none left
+void DeviceCheck::for_each_group(const std::function<void(int group)>& check) {
+    std::atomic<int> nextGroup(0);
+    auto work = [&]() {
+        for (int g = nextGroup++; g < numGroups; g = nextGroup++)
+            check(g);
+    };
+    int numWorkers = std::min(numGroups, std::max(1, (int)std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (int i = 1; i < numWorkers; i++)
+        threads.emplace_back(work);
+    work(); // the calling thread is one of the workers
+    for (std::thread& t : threads)
+        t.join();
+}
+
+// record a problem found in a group; each group is only checked by one thread at a time, so no locking is needed
+void DeviceCheck::problem(int group, const char* format, ...) {
+    char message[STRING_SIZE];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, STRING_SIZE, format, args);
+    va_end(args);
+    problems[group].push_back(message);
+}
+
+// does this group start with a copy of the superblock and group descriptors?
+bool DeviceCheck::has_super(int group) {
+    if (group <= 1 || !(super.s_feature_ro_compat & EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER))
+        return true;
+    for (int base : { 3, 5, 7 }) { // with sparse superblocks, only groups that are powers of 3, 5, and 7 have copies
+        int n = group;
+        while (n % base == 0)
+            n /= base;
+        if (n == 1)
+            return true;
+    }
+    return false;
+}
+
+// record that a block is in use by the file system's metadata (inode 0) or by an inode, checking for duplicates
+void DeviceCheck::mark_used(int group, int blockNum, int inodeNum) {
+    if (blockNum < (int)super.s_first_data_block || blockNum >= (int)super.s_blocks_count) {
+        problem(group, "inode %d refers to block %d, which is out of range", inodeNum, blockNum);
+        return;
+    }
+    unsigned char bit = 1 << (blockNum % 8);
+    if (usedBlocks[blockNum / 8].fetch_or(bit) & bit)
+        problem(group, "block %d is claimed more than once (again by %s %d)", blockNum, inodeNum ? "inode" : "group", inodeNum ? inodeNum : group);
+}
+
+// stream the group's inode table, marking the blocks of each inode in use and counting the entries of each directory
+void DeviceCheck::check_inodes(int group) {
+    DataBlock bitmap(device);
+    bitmap.get(groups[group].bg_inode_bitmap);
+    int tableBlocks = (super.s_inodes_per_group * inodeSize + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    std::vector<char> table(STREAM_BLOCKS * BLOCK_SIZE);
+    CachedINode file; // a private copy of each inode; it is not part of the inode table
+    file.device = device;
+
+    for (int first = 0; first < tableBlocks; first += STREAM_BLOCKS) {
+        int count = std::min(STREAM_BLOCKS, tableBlocks - first);
+        device->read_blocks(groups[group].bg_inode_table + first, count, table.data());
+        int firstIndex = first * BLOCK_SIZE / inodeSize;
+        int lastIndex = std::min((int)super.s_inodes_per_group, (first + count) * BLOCK_SIZE / inodeSize);
+        for (int i = firstIndex; i < lastIndex; i++) {
+            file.inodeNum = group * super.s_inodes_per_group + i + 1;
+            memcpy(&file.inode, &table[(i - firstIndex) * inodeSize], sizeof(INode));
+            bool marked = bitmap.test_bit(i);
+            bool reserved = file.inodeNum < firstINode && file.inodeNum != ROOT_DIR_INODE_NUM;
+
+            if (reserved) {
+                if (!marked)
+                    problem(group, "reserved inode %d is marked free in the inode bitmap", file.inodeNum);
+                if (file.inodeNum == EXT2_RESIZE_INO) {
+                    // the resize inode's double-indirect block maps the reserved group descriptor blocks,
+                    // which have already been counted as metadata
+                    if (file.inode.i_block[EXT2_DIND_BLOCK])
+                        mark_used(group, file.inode.i_block[EXT2_DIND_BLOCK], file.inodeNum);
+                    continue;
+                }
+                if (file.inode.i_links_count == 0 && file.inode.i_mode == 0)
+                    continue; // unused reserved inode
+            } else if (file.inode.i_links_count == 0) {
+                if (marked)
+                    problem(group, "inode %d is marked in use in the inode bitmap, but has no links", file.inodeNum);
+                continue;
+            } else if (!marked) {
+                problem(group, "inode %d is in use, but marked free in the inode bitmap", file.inodeNum);
+            }
+
+            linkCounts[file.inodeNum] = file.inode.i_links_count;
+            file.for_each_block([&](int blockNum, bool) { mark_used(group, blockNum, file.inodeNum); });
+            if (S_ISDIR(file.inode.i_mode))
+                check_directory(group, file.inodeNum, file);
+        }
+    }
+}
+
+// check that a directory's records stay within their blocks, and count the references to each inode
+void DeviceCheck::check_directory(int group, int inodeNum, CachedINode& dir) {
+    DataBlock block(device);
+    dir.for_each_block([&](int blockNum, bool isData) {
+        if (!isData || blockNum >= (int)super.s_blocks_count)
+            return;
+        block.get(blockNum);
+        for (int offset = 0; offset < BLOCK_SIZE;) {
+            DirectoryEntry* entry = (DirectoryEntry*)&block.buffer[offset];
+            int minLength = 8 + entry->name_len;
+            if (entry->rec_len < minLength || entry->rec_len % 4 != 0 || offset + entry->rec_len > BLOCK_SIZE) {
+                problem(group, "directory inode %d, block %d: bad record length %d at offset %d",
+                    inodeNum, blockNum, entry->rec_len, offset);
+                return; // the rest of the block can't be trusted
+            }
+            if (entry->inode > super.s_inodes_count)
+                problem(group, "directory inode %d refers to inode %d, which is out of range", inodeNum, entry->inode);
+            else if (entry->inode != 0)
+                references[entry->inode]++;
+            offset += entry->rec_len;
+        }
+    });
+}
+
+// compare the group's bitmaps with what was found in use, and recount its free totals from the bitmaps
+void DeviceCheck::check_bitmaps(int group) {
+    DataBlock bitmap(device);
+    int firstBlock = super.s_first_data_block + group * super.s_blocks_per_group;
+    int numBlocks = std::min((int)super.s_blocks_per_group, (int)super.s_blocks_count - firstBlock);
+    int reported[2] = { 0, 0 }; // differences reported: [0] in use but marked free, [1] marked in use but free
+    int unreported[2] = { 0, 0 };
+
+    bitmap.get(groups[group].bg_block_bitmap);
+    for (int i = 0; i < numBlocks; i++) {
+        int blockNum = firstBlock + i;
+        bool used = usedBlocks[blockNum / 8] & (1 << (blockNum % 8));
+        if (used == bitmap.test_bit(i))
+            continue;
+        int kind = used ? 0 : 1;
+        if (reported[kind]++ < MAX_REPORTED)
+            problem(group, used ? "block %d is in use, but marked free in the block bitmap"
+                                : "block %d is marked in use in the block bitmap, but isn't used",
+                blockNum);
+        else
+            unreported[kind]++;
+    }
+    if (unreported[0] || unreported[1])
+        problem(group, "... and %d more block bitmap differences", unreported[0] + unreported[1]);
+    freeBlocks[group] = numBlocks - bitmap.count_bits(numBlocks);
+
+    bitmap.get(groups[group].bg_inode_bitmap);
+    freeINodes[group] = super.s_inodes_per_group - bitmap.count_bits(super.s_inodes_per_group);
+
+    if (groups[group].bg_free_blocks_count != freeBlocks[group])
+        problem(group, "free blocks count is %d, bitmap says %d", groups[group].bg_free_blocks_count, freeBlocks[group]);
+    if (groups[group].bg_free_inodes_count != freeINodes[group])
+        problem(group, "free inodes count is %d, bitmap says %d", groups[group].bg_free_inodes_count, freeINodes[group]);
+}
+
+// compare the link count of each of the group's inodes with the number of directory entries referring to it
+void DeviceCheck::check_links(int group) {
+    for (int i = 0; i < (int)super.s_inodes_per_group; i++) {
+        int inodeNum = group * super.s_inodes_per_group + i + 1;
+        if (inodeNum < firstINode && inodeNum != ROOT_DIR_INODE_NUM)
+            continue; // reserved inodes aren't linked into the directory tree
+        int refs = references[inodeNum];
+        if (linkCounts[inodeNum] == 0 && refs != 0)
+            problem(group, "inode %d is not in use, but %d directory entries refer to it", inodeNum, refs);
+        else if (linkCounts[inodeNum] != refs)
+            problem(group, "inode %d has a link count of %d, but %d directory entries refer to it", inodeNum, linkCounts[inodeNum], refs);
+    }
+}
+
+// write the free totals recounted from the bitmaps to the superblock and group descriptors
+void DeviceCheck::repair_counts() {
+    DataBlock block(device);
+    std::vector<char> table(gdtBlocks * BLOCK_SIZE);
+    device->read_blocks(super.s_first_data_block + 1, gdtBlocks, table.data());
+    GroupDescriptor* gp = (GroupDescriptor*)table.data();
+    int totalFreeBlocks = 0, totalFreeINodes = 0;
+    for (int g = 0; g < numGroups; g++) {
+        gp[g].bg_free_blocks_count = freeBlocks[g];
+        gp[g].bg_free_inodes_count = freeINodes[g];
+        totalFreeBlocks += freeBlocks[g];
+        totalFreeINodes += freeINodes[g];
+    }
+    device->write_blocks(super.s_first_data_block + 1, gdtBlocks, table.data());
+
+    block.get(SUPER_BLOCK);
+    SuperBlock* sp = (SuperBlock*)block.buffer;
+    sp->s_free_blocks_count = device->nbfree = totalFreeBlocks;
+    sp->s_free_inodes_count = device->nifree = totalFreeINodes;
+    block.put();
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "main.hpp"
+#include <atomic>
+class MountedDevice;
+class CachedINode;
+
+// a consistency check of a device's file system, like a simplified e2fsck; each block group is checked by its own thread
+class DeviceCheck {
+public:
+    DeviceCheck(MountedDevice* device); // read the file system's layout from the device's superblock and group descriptors
+    int run(bool repair); // check the file system and optionally repair its free counts; return SUCCESS if it's consistent
+
+private:
+    MountedDevice* device;
+    SuperBlock super; // copy of the device's superblock
+    std::vector<GroupDescriptor> groups; // copies of all the group descriptors
+    int numGroups;
+    int gdtBlocks; // number of blocks holding the group descriptors
+    int inodeSize; // bytes per inode in the inode tables
+    int firstINode; // the first inode number that isn't reserved by the file system
+    std::vector<std::atomic<unsigned char>> usedBlocks; // bitmap of the blocks found in use while checking
+    std::vector<std::atomic<int>> references; // number of directory entries referring to each inode
+    std::vector<int> linkCounts; // each inode's link count, or 0 if it's not in use
+    std::vector<std::vector<std::string>> problems; // the problems found in each block group
+    std::vector<int> freeBlocks; // free blocks in each group according to its block bitmap
+    std::vector<int> freeINodes; // free inodes in each group according to its inode bitmap
+
+    void for_each_group(const std::function<void(int group)>& check); // run a check on every group, in parallel
+    void problem(int group, const char* format, ...); // record a problem found in a group
+    bool has_super(int group); // does this group start with a copy of the superblock and group descriptors?
+    void mark_used(int group, int blockNum, int inodeNum); // record that a block is in use, checking for duplicates
+    void check_inodes(int group); // stream the group's inode table, marking blocks in use and counting directory entries
+    void check_directory(int group, int inodeNum, CachedINode& dir); // check a directory's record lengths and count its entries
+    void check_bitmaps(int group); // compare the group's bitmaps with what was found in use and recount its free totals
+    void check_links(int group); // compare the link count of each of the group's inodes with the directory entries for it
+    void repair_counts(); // write the recounted free totals to the superblock and group descriptors
+};
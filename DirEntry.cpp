@@ -1,12 +1,11 @@
 #include "DirEntry.hpp"
 #include "DataBlock.hpp"
 
-// initialize DirEntry object
+// initialize DirEntry object; its fields are populated once its data block has been loaded
 DirEntry::DirEntry(DataBlock* block)
     : block(block)
     , entry(block->buffer)
     , prevEntry(nullptr) {
-    update();
 }
 
 // advance to the first entry in a newly loaded data block
@@ -27,11 +26,11 @@ void DirEntry::nextEntry() {
 void DirEntry::update() {
     dirEntry = (DirectoryEntry*)entry; // get the current directory entry
     inodeNum = dirEntry->inode;
-    name = std::string(dirEntry->name, dirEntry->name_len);
+    name = std::string_view(dirEntry->name, dirEntry->name_len);
     length = dirEntry->rec_len;
     idealLength = 4 * ((8 + (int)name.length() + 3) / 4);
     isLast = (entry + length == block->buffer + BLOCK_SIZE);
-    TRACE(3, "directory entry: %s (inode %d, rec_len %d)\n", name.c_str(), inodeNum, length);
+    TRACE(3, "directory entry: %.*s (inode %d, rec_len %d)\n", (int)name.length(), name.data(), inodeNum, length);
 }
 
 // remove entry from the middle of the current data block
@@ -10,7 +10,7 @@ public:
     char* entry; // pointer into the directory data block buffer
     DirectoryEntry* prevEntry; // the previous entry
     DirectoryEntry* dirEntry; // used to map the Directory Entry structure onto the raw data in the data block
-    std::string name; // current directory entry's filename
+    std::string_view name; // current directory entry's filename, viewed in place in the data block buffer
     int inodeNum = 0; // current directory entry's inode number
     int length; // the actual length of this entry
     int idealLength; // the "correct" length for this entry; the last entry in a block has a different actual length
@@ -1,29 +1,31 @@
 #include "Directory.hpp"
+#include "Profiler.hpp"
 #include "CachedINode.hpp"
 #include "MountedDevice.hpp"
+#include "BlockTrace.hpp"
 
 // initialize Directory object; load the first block and populate the first entry's info
 Directory::Directory(CachedINode* cachedINode)
-    : dirINode(&cachedINode->inode)
+    : cachedINode(cachedINode)
+    , dirINode(&cachedINode->inode)
     , block(DataBlock(cachedINode->device))
-    , index(0) {
+    , index(0)
+    , entry(&block) {
+    BlockUseScope scope(DIRECTORY_USE);
 
     // if non-directory, set current entry to null
     if (S_ISDIR(dirINode->i_mode)) {
-        block.get(dirINode->i_block[index]);
-        current = new DirEntry(&block);
+        block.get(cachedINode->logical2physical(index));
+        entry.nextBlock();
+        current = &entry;
     } else {
         current = nullptr;
     }
 }
 
-// free the memory for the current entry object
-Directory::~Directory() {
-    if (current) delete current;
-}
-
 // initialize a new directory with the default directory entries
 void Directory::init(int inodeNum, int blockNum, int parentINodeNum) {
+    BlockUseScope scope(DIRECTORY_USE);
     DirectoryEntry* dirEntry = (DirectoryEntry*)block.buffer;
     dirEntry->inode = inodeNum; // this directory's own inode number
     dirEntry->rec_len = 12;
@@ -40,72 +42,142 @@ void Directory::init(int inodeNum, int blockNum, int parentINodeNum) {
 
 // get a directory entry, either from the current block or after loading the next block
 DirEntry* Directory::next() {
+    PROFILE_SCOPE("Directory::next");
+    BlockUseScope scope(DIRECTORY_USE);
     if (!current)
         return nullptr;
     if (!current->isLast) {
         current->nextEntry();
     } else {
         ++index;
-        if (index == EXT2_NDIR_BLOCKS || !dirINode->i_block[index]) {
-            // stop after direct blocks or when a block number of 0 is found
+        int blockNum = ((long)index * BLOCK_SIZE < dirINode->i_size) ? cachedINode->logical2physical(index) : 0;
+        if (!blockNum) {
+            // stop at the end of the directory or when a block number of 0 is found
             return nullptr;
         }
-        block.get(dirINode->i_block[index]);
+        block.get(blockNum);
         current->nextBlock();
     }
     return current;
 }
 
-// create a new directory entry in a new data block
-void Directory::createEntry(const std::string& name, int inodeNum, int blockNum) {
+// move to the first entry of one of the directory's blocks
+void Directory::seek(int logicalBlockNum) {
+    BlockUseScope scope(DIRECTORY_USE);
+    index = logicalBlockNum;
+    block.get(cachedINode->logical2physical(index));
+    entry.nextBlock();
+    current = &entry;
+}
+
+// create a new directory entry in a new data block, at the end of the directory
+void Directory::createEntry(std::string_view name, int inodeNum, int blockNum) {
+    BlockUseScope scope(DIRECTORY_USE);
     bzero(block.buffer, BLOCK_SIZE); // fill the buffer with zeros
     DirectoryEntry* dirEntry = (DirectoryEntry*)block.buffer;
     dirEntry->inode = inodeNum;
     dirEntry->rec_len = BLOCK_SIZE;
     dirEntry->name_len = name.length();
-    strcpy(dirEntry->name, name.c_str());
-    block.put(blockNum); // save the new block
+    memcpy(dirEntry->name, name.data(), name.length());
+    block.put(blockNum); // save the new block, which the caller has already mapped into the directory
 
+    index = dirINode->i_size / BLOCK_SIZE;
     dirINode->i_size += BLOCK_SIZE;
-    dirINode->i_block[index] = blockNum;
+    updateSlack();
 }
 
-// insert a new directory entry at the end of an existing data block
-void Directory::appendEntry(const std::string& name, int inodeNum, int rec_len) {
-    current->dirEntry->rec_len = current->idealLength; // fix the size of the last dir entry's record length
-    current->entry += current->dirEntry->rec_len; // advance to the next entry
+// insert a new entry into the first gap in the current block that's large enough; returns false if there's none
+bool Directory::insertEntry(std::string_view name, int inodeNum) {
+    int idealLength = 4 * ((8 + name.length() + 3) / 4); // the new entry's ideal length
+    for (current->nextBlock();; current->nextEntry()) {
+        int gap = current->inodeNum ? current->length - current->idealLength : current->length;
+        if (gap >= idealLength) {
+            appendEntry(name, inodeNum, gap);
+            return true;
+        }
+        if (current->isLast)
+            return false;
+    }
+}
+
+// add a new directory entry in the slack after the current entry, or in place of it if the current entry is unused
+void Directory::appendEntry(std::string_view name, int inodeNum, int rec_len) {
+    BlockUseScope scope(DIRECTORY_USE);
+    if (current->inodeNum != 0) {
+        current->dirEntry->rec_len = current->idealLength; // fix the size of the current entry's record length
+        current->entry += current->dirEntry->rec_len; // advance to the next entry
+    }
 
     DirectoryEntry* dirEntry = (DirectoryEntry*)current->entry;
     dirEntry->inode = inodeNum;
     dirEntry->rec_len = rec_len;
     dirEntry->name_len = name.length();
-    strcpy(dirEntry->name, name.c_str());
+    memcpy(dirEntry->name, name.data(), name.length());
     block.put(); // save the updated block
+    updateSlack();
 }
 
 // remove an entry from somewhere within a directory data block
 void Directory::removeEntry() {
-    if (current->dirEntry->rec_len == BLOCK_SIZE) {
+    BlockUseScope scope(DIRECTORY_USE);
+    if (current->dirEntry->rec_len == BLOCK_SIZE && (cachedINode->has_extents() || dirINode->i_block[EXT2_IND_BLOCK])) {
+        // FIRST and ONLY entry, but the blocks can't simply be scooted up; leave an empty block
+        current->dirEntry->inode = 0;
+        block.put();
+        updateSlack();
+    } else if (current->dirEntry->rec_len == BLOCK_SIZE) {
         // FIRST and ONLY entry; throw away entire data block
         block.device->deallocate(BLOCK, dirINode->i_block[index]);
         dirINode->i_size -= BLOCK_SIZE;
+        dirINode->i_blocks -= BLOCK_SIZE / 512;
         // if there are any non-zero data blocks after this one, scoot them up;
         // and because we're assuming no indirect blocks, we can "cheat" and
         // assume there is a zero after all the direct block numbers
-        for (int j = index; j < EXT2_NDIR_BLOCKS; j++)
+        for (int j = index; j < EXT2_NDIR_BLOCKS - 1; j++)
             dirINode->i_block[j] = dirINode->i_block[j + 1];
+        dirINode->i_block[EXT2_NDIR_BLOCKS - 1] = 0;
+        std::vector<BlockSlack>& slack = cachedINode->slack;
+        if (index < (int)slack.size())
+            slack.erase(slack.begin() + index); // the later blocks moved up too
     } else if (current->isLast) {
         // LAST entry (preceded by other entries, but not followed by any)
         // simply adjust the length of the next-to-last record, indicating it's now the last
         current->prevEntry->rec_len += current->dirEntry->rec_len;
         block.put();
+        updateSlack();
     } else {
         // MIDDLE entry (followed by other entries)
         current->remove();
         block.put();
+        updateSlack();
     }
 }
 
+// the free space in the current block: the slack after each entry, and the unused entries
+BlockSlack Directory::blockSlack() {
+    BlockSlack free;
+    for (int offset = 0; offset < BLOCK_SIZE;) {
+        DirectoryEntry* dirEntry = (DirectoryEntry*)&block.buffer[offset];
+        if (dirEntry->rec_len == 0)
+            break; // corrupt
+        int gap = dirEntry->inode ? dirEntry->rec_len - 4 * ((8 + dirEntry->name_len + 3) / 4) : dirEntry->rec_len;
+        free.largest = std::max(free.largest, gap);
+        free.total += gap;
+        offset += dirEntry->rec_len;
+    }
+    return free;
+}
+
+// record the current block's free space in the directory's slack index, if it has been built
+void Directory::updateSlack() {
+    std::vector<BlockSlack>& slack = cachedINode->slack;
+    if (slack.empty())
+        return;
+    if (index >= (int)slack.size())
+        slack.resize(index + 1);
+    slack[index] = blockSlack();
+}
+
 // create an iterator representing the beginning of the Directory entries
 Directory::Iter Directory::begin() { return Iter(this, current); }
 
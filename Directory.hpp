@@ -2,21 +2,26 @@
 #include "DataBlock.hpp"
 #include "DirEntry.hpp"
 class CachedINode;
+struct BlockSlack;
 
 // an iterable container of directory entries
 class Directory {
 public:
+    CachedINode* cachedINode; // the directory's cached inode, which maps its blocks
     INode* dirINode; // the directory's inode
     DataBlock block; // a block of directory data
-    int index; // index into the inode.i_block[] array
-    DirEntry* current; // the current entry
+    int index; // logical block number of the current block
+    DirEntry entry; // the entry object reused for every entry in the directory
+    DirEntry* current; // the current entry; null if this is not a directory
 
     Directory(CachedINode* cachedInode); // initialize Directory object
-    ~Directory(); // free the memory for the current entry object
+    Directory(const Directory&) = delete; // the current entry refers into this object's own data block
     void init(int inodeNum, int blockNum, int parentINodeNum); // initialize a new directory with the default directory entries
     DirEntry* next(); // advance to the next entry
-    void createEntry(const std::string& name, int inodeNum, int blockNum); // create a new directory entry in a new data block
-    void appendEntry(const std::string& name, int inodeNum, int actualLength); // append a new directory entry at the end of an existing data block
+    void seek(int logicalBlockNum); // move to the first entry of one of the directory's blocks
+    void createEntry(std::string_view name, int inodeNum, int blockNum); // create a new directory entry in a new data block
+    bool insertEntry(std::string_view name, int inodeNum); // insert a new entry into the first gap in the current block that's large enough
+    void appendEntry(std::string_view name, int inodeNum, int actualLength); // add a new directory entry in the slack after the current entry
     void removeEntry(); // remove an entry from somewhere within a directory data block
 
     class Iter { // iterator for the entries in this directory
@@ -32,4 +37,8 @@ public:
     };
     Iter begin(); // create an iterator representing the beginning of the Directory entries
     Iter end(); // create an interator representing the end of the Directory entries
+
+private:
+    BlockSlack blockSlack(); // the free space in the current block
+    void updateSlack(); // record the current block's free space in the directory's slack index, if it has one
 };
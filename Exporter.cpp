@@ -0,0 +1,372 @@
+#include "Exporter.hpp"
+#include "FileSystem.hpp"
+#include "PathComponents.hpp"
+#include "TreeWalker.hpp"
+
+// export an image file or directory to a host directory, a .tar file, or - for a tar stream on standard output
+Exporter::Exporter(const std::string& imagePath, const std::string& target)
+    : imagePath(imagePath)
+    , target(target)
+    , nextToRead(0)
+    , bytes(0)
+    , numFiles(0)
+    , numFailed(0) {
+}
+
+// export the whole tree; returns SUCCESS if everything was exported
+int Exporter::run() {
+    if (collect() != SUCCESS)
+        return FAILURE;
+    bool isTar = target == "-" || (target.size() > 4 && target.compare(target.size() - 4, 4, ".tar") == 0);
+    int result = isTar ? export_tar() : export_tree();
+
+    FILE* out = (target == "-") ? stderr : stdout; // keep the summary out of a tar stream
+    fprintf(out, "export: %d files (%ld bytes), %d directories and %d symbolic links exported to %s",
+        (int)numFiles, (long)bytes, numDirs, numLinks, target.c_str());
+    if (numFailed)
+        fprintf(out, ", %d could not be exported", (int)numFailed);
+    fprintf(out, "\n");
+    return (result == SUCCESS && !numFailed) ? SUCCESS : FAILURE;
+}
+
+// walk the tree, listing everything to be exported in name order, which puts each directory before its contents
+int Exporter::collect() {
+    CachedINode* start = fs->inodeTable.get(imagePath);
+    if (!start) {
+        std::cerr << "export: cannot export, " << imagePath << " not found\n";
+        return FAILURE;
+    }
+    TreeWalker walker;
+    std::vector<std::vector<ExportFile>> found(walker.numWorkers); // each worker collects its own files
+    walker.walk(start, imagePath, [&](int worker, const TreeEntry& entry) {
+        ExportFile file;
+        file.name = entry.path.substr(imagePath.size());
+        if (!file.name.empty() && file.name[0] == '/')
+            file.name.erase(0, 1);
+        file.file = entry.file;
+        found[worker].push_back(std::move(file));
+    });
+    start->put();
+    fs->mountTable.sync(); // the journaled blocks reach their home locations, so files can be copied straight from the disk images
+
+    for (std::vector<ExportFile>& f : found)
+        std::move(f.begin(), f.end(), std::back_inserter(files));
+    std::sort(files.begin(), files.end(), [](const ExportFile& a, const ExportFile& b) { return a.name < b.name; });
+    return SUCCESS;
+}
+
+// copy everything into a host directory: the directories and symbolic links first, then the files with a pool of
+// threads, and finally the directories' own attributes, since creating their contents changed them
+int Exporter::export_tree() {
+    if (S_ISDIR(files[0].file.inode.i_mode)) {
+        struct stat status;
+        if (::mkdir(target.c_str(), 0755) < 0 && (stat(target.c_str(), &status) < 0 || !S_ISDIR(status.st_mode))) {
+            std::cerr << "export: cannot export, cannot create host directory " << target << "\n";
+            return FAILURE;
+        }
+    }
+
+    for (ExportFile& entry : files) {
+        const INode& inode = entry.file.inode;
+        std::string path = host_path(entry);
+        if (S_ISDIR(inode.i_mode) && !entry.name.empty()) {
+            if (::mkdir(path.c_str(), 0700) < 0 && errno != EEXIST) { // writable until its own mode is set
+                std::cerr << "export: cannot create host directory " << path << "\n";
+                entry.failed = true;
+                numFailed++;
+            } else
+                numDirs++;
+        } else if (S_ISLNK(inode.i_mode)) {
+            ::unlink(path.c_str()); // replace whatever was there before
+            if (::symlink(link_target(entry.file).c_str(), path.c_str()) < 0) {
+                std::cerr << "export: cannot create host symbolic link " << path << "\n";
+                numFailed++;
+                continue;
+            }
+            struct timespec times[2] = { { (time_t)inode.i_atime, 0 }, { (time_t)inode.i_mtime, 0 } };
+            utimensat(AT_FDCWD, path.c_str(), times, AT_SYMLINK_NOFOLLOW);
+            numLinks++;
+        }
+    }
+
+    std::vector<std::thread> workers;
+    int numWorkers = std::max(1, (int)std::thread::hardware_concurrency());
+    for (int i = 1; i < numWorkers; i++)
+        workers.emplace_back(&Exporter::copy_files, this);
+    copy_files(); // the calling thread copies files too
+    for (std::thread& t : workers)
+        t.join();
+
+    for (auto entry = files.rbegin(); entry != files.rend(); entry++) {
+        const INode& inode = entry->file.inode;
+        if (!S_ISDIR(inode.i_mode) || entry->failed)
+            continue;
+        std::string path = host_path(*entry);
+        struct timespec times[2] = { { (time_t)inode.i_atime, 0 }, { (time_t)inode.i_mtime, 0 } };
+        ::chmod(path.c_str(), inode.i_mode & 07777);
+        utimensat(AT_FDCWD, path.c_str(), times, 0);
+    }
+    return SUCCESS;
+}
+
+// a worker's loop: take the next regular file and copy it into the host directory, with its mode and times
+void Exporter::copy_files() {
+    for (size_t i = nextToRead++; i < files.size(); i = nextToRead++) {
+        ExportFile& entry = files[i];
+        const INode& inode = entry.file.inode;
+        if (!S_ISREG(inode.i_mode))
+            continue;
+        std::string path = host_path(entry);
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) {
+            std::cerr << "export: cannot create host file " << path << "\n";
+            numFailed++;
+            continue;
+        }
+        if (copy_data(entry.file, fd) == SUCCESS && ftruncate(fd, inode.i_size) == 0) { // the size covers a trailing hole
+            struct timespec times[2] = { { (time_t)inode.i_atime, 0 }, { (time_t)inode.i_mtime, 0 } };
+            fchmod(fd, inode.i_mode & 07777);
+            futimens(fd, times);
+            numFiles++;
+            bytes += inode.i_size;
+        } else {
+            std::cerr << "export: cannot write host file " << path << "\n";
+            numFailed++;
+        }
+        close(fd);
+    }
+}
+
+// copy a file's data into a host file, one run of contiguous blocks at a time, leaving its holes as holes; the kernel
+// copies each run straight from the disk image, unless it can't copy between these files or the image has an overlay,
+// and then it goes through a buffer
+int Exporter::copy_data(CachedINode& file, int fd) {
+    long size = file.inode.i_size;
+    int numBlocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    bool copyRange = !file.device->overlay; // an overlay's blocks aren't in the disk image
+    std::vector<char> buffer;
+    for (int logical = 0, length; logical < numBlocks; logical += length) {
+        int blockNum = file.map_run(logical, &length);
+        length = std::max(1, std::min(length, numBlocks - logical));
+        if (!blockNum)
+            continue;
+        loff_t in = (loff_t)blockNum * BLOCK_SIZE;
+        loff_t out = (loff_t)logical * BLOCK_SIZE;
+        size_t remaining = std::min((long)length * BLOCK_SIZE, size - out);
+        while (remaining > 0 && copyRange) {
+            ssize_t copied = copy_file_range(file.device->fd, &in, fd, &out, remaining, 0);
+            if (copied <= 0)
+                copyRange = false;
+            else
+                remaining -= copied;
+        }
+        while (remaining > 0) {
+            int count = std::min((int)((remaining + BLOCK_SIZE - 1) / BLOCK_SIZE), EXPORT_CHUNK_BLOCKS);
+            size_t chunk = std::min(remaining, (size_t)count * BLOCK_SIZE);
+            buffer.resize((size_t)count * BLOCK_SIZE);
+            file.device->read_blocks(in / BLOCK_SIZE, count, buffer.data());
+            if (pwrite(fd, buffer.data(), chunk, out) != (ssize_t)chunk)
+                return FAILURE;
+            in += chunk;
+            out += chunk;
+            remaining -= chunk;
+        }
+    }
+    return SUCCESS;
+}
+
+// write everything as a ustar stream, in name order; the readers read each file's data up to a window ahead
+int Exporter::export_tar() {
+    if (target == "-") {
+        std::cout.flush(); // anything already printed goes before the stream
+        outFd = STDOUT_FILENO;
+    } else if ((outFd = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        std::cerr << "export: cannot export, cannot create " << target << "\n";
+        return FAILURE;
+    }
+
+    std::vector<std::thread> readers;
+    int numReaders = std::max(1, (int)std::thread::hardware_concurrency());
+    for (int i = 0; i < numReaders; i++)
+        readers.emplace_back(&Exporter::read_files, this);
+
+    int result = SUCCESS;
+    for (size_t i = 0; i < files.size() && result == SUCCESS; i++) {
+        ExportFile& entry = files[i];
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            fileRead.wait(guard, [&] { return entry.ready; });
+        }
+        const INode& inode = entry.file.inode;
+        TarHeader header;
+        if (S_ISDIR(inode.i_mode) && entry.name.empty()) {
+            // the starting directory itself isn't in the stream, only its contents
+        } else if (!make_header(entry, header)) {
+            std::cerr << "export: cannot export " << entry.name << ", its name or link target is too long for a tar header\n";
+            numFailed++;
+        } else if (write_out((char*)&header, sizeof(header)) != SUCCESS) {
+            result = FAILURE;
+        } else if (S_ISREG(inode.i_mode) && entry.data.empty()) {
+            result = stream_data(entry.file);
+            numFiles++;
+            bytes += inode.i_size;
+        } else if (S_ISREG(inode.i_mode)) {
+            size_t padded = ((size_t)inode.i_size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+            if (padded > inode.i_size) // zeros, rather than the rest of the last block
+                memset(entry.data.data() + inode.i_size, 0, padded - inode.i_size);
+            result = write_out(entry.data.data(), padded);
+            numFiles++;
+            bytes += inode.i_size;
+        } else if (S_ISDIR(inode.i_mode)) {
+            numDirs++;
+        } else if (S_ISLNK(inode.i_mode)) {
+            numLinks++;
+        }
+        std::vector<char>().swap(entry.data); // release the file's contents
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            nextToWrite = (result == SUCCESS) ? i + 1 : files.size();
+        }
+        windowMoved.notify_all();
+    }
+    if (result != SUCCESS) {
+        std::cerr << "export: cannot write to " << target << "\n";
+        nextToRead = files.size(); // the readers stop taking files
+    }
+    for (std::thread& t : readers)
+        t.join();
+
+    if (result == SUCCESS) { // two empty blocks end the archive, which is padded to a whole record
+        size_t end = 2 * TAR_BLOCK_SIZE;
+        end += (TAR_RECORD_SIZE - (written + end) % TAR_RECORD_SIZE) % TAR_RECORD_SIZE;
+        result = write_out(std::vector<char>(end, 0).data(), end);
+    }
+    if (outFd != STDOUT_FILENO)
+        close(outFd);
+    return result;
+}
+
+// a reader thread's loop: take the next file, wait until it's within the window, and read its data or link target
+void Exporter::read_files() {
+    for (size_t i = nextToRead++; i < files.size(); i = nextToRead++) {
+        ExportFile& entry = files[i];
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            windowMoved.wait(guard, [&] { return i < nextToWrite + EXPORT_WINDOW; });
+        }
+        long numBlocks = ((long)entry.file.inode.i_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (S_ISREG(entry.file.inode.i_mode) && numBlocks <= EXPORT_CHUNK_BLOCKS) { // larger files are streamed
+            read_data(entry.file, entry.data);
+        } else if (S_ISLNK(entry.file.inode.i_mode)) {
+            std::string linkTarget = link_target(entry.file);
+            entry.data.assign(linkTarget.begin(), linkTarget.end());
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            entry.ready = true;
+        }
+        fileRead.notify_all();
+    }
+}
+
+// read a file's data into a buffer of whole blocks, with one read for each run of contiguous blocks; holes read as zeros
+void Exporter::read_data(CachedINode& file, std::vector<char>& data) {
+    int numBlocks = ((long)file.inode.i_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    data.assign((size_t)numBlocks * BLOCK_SIZE, 0);
+    for (int logical = 0, length; logical < numBlocks; logical += length) {
+        int blockNum = file.map_run(logical, &length);
+        length = std::max(1, std::min(length, numBlocks - logical));
+        if (blockNum)
+            file.device->read_blocks(blockNum, length, &data[(size_t)logical * BLOCK_SIZE]);
+    }
+}
+
+// append a file's data to the tar stream, padded to a whole tar block, reading at most EXPORT_CHUNK_BLOCKS blocks at
+// a time, one run of contiguous blocks after another; holes are written as zeros
+int Exporter::stream_data(CachedINode& file) {
+    long size = file.inode.i_size;
+    int numBlocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    std::vector<char> buffer;
+    for (int logical = 0, length; logical < numBlocks; logical += length) {
+        int blockNum = file.map_run(logical, &length);
+        length = std::max(1, std::min({ length, numBlocks - logical, EXPORT_CHUNK_BLOCKS }));
+        buffer.assign((size_t)length * BLOCK_SIZE, 0);
+        if (blockNum)
+            file.device->read_blocks(blockNum, length, buffer.data());
+        size_t chunk = std::min((long)length * BLOCK_SIZE, size - (long)logical * BLOCK_SIZE);
+        if (write_out(buffer.data(), chunk) != SUCCESS)
+            return FAILURE;
+    }
+    size_t padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+    return write_out(std::vector<char>(padding, 0).data(), padding);
+}
+
+// the target of a symbolic link; short targets are kept in the inode's i_block array, longer ones in a data block
+std::string Exporter::link_target(CachedINode& link) {
+    if (link.inode.i_size < sizeof(link.inode.i_block))
+        return std::string((char*)link.inode.i_block, strnlen((char*)link.inode.i_block, link.inode.i_size));
+    std::vector<char> data;
+    read_data(link, data);
+    return std::string(data.data(), link.inode.i_size);
+}
+
+// fill in a file's ustar header; fails if its name or link target won't fit
+bool Exporter::make_header(const ExportFile& entry, TarHeader& header) {
+    const INode& inode = entry.file.inode;
+    memset(&header, 0, sizeof(header));
+    std::string name = entry.name.empty() ? std::string(PathComponents(imagePath).child) : entry.name;
+    if (S_ISDIR(inode.i_mode))
+        name += '/';
+    if (name.size() > sizeof(header.name)) { // split a long name into a prefix and a name at one of its slashes
+        size_t split = name.rfind('/', std::min(sizeof(header.prefix), name.size() - 2));
+        if (split == std::string::npos || split == 0 || name.size() - split - 1 > sizeof(header.name))
+            return false;
+        memcpy(header.prefix, name.data(), split);
+        name.erase(0, split + 1);
+    }
+    memcpy(header.name, name.data(), name.size());
+
+    snprintf(header.mode, sizeof(header.mode), "%07o", inode.i_mode & 07777);
+    snprintf(header.uid, sizeof(header.uid), "%07o", inode.i_uid);
+    snprintf(header.gid, sizeof(header.gid), "%07o", inode.i_gid);
+    snprintf(header.size, sizeof(header.size), "%011lo", S_ISREG(inode.i_mode) ? (unsigned long)inode.i_size : 0ul);
+    snprintf(header.mtime, sizeof(header.mtime), "%011lo", (unsigned long)inode.i_mtime);
+    if (S_ISDIR(inode.i_mode)) {
+        header.type = '5';
+    } else if (S_ISLNK(inode.i_mode)) {
+        if (entry.data.size() > sizeof(header.linkname))
+            return false;
+        header.type = '2';
+        memcpy(header.linkname, entry.data.data(), entry.data.size());
+    } else
+        header.type = '0';
+    memcpy(header.magic, "ustar", 6);
+    memcpy(header.version, "00", 2);
+
+    // the checksum is the sum of the header's bytes, counting the checksum field itself as spaces
+    memset(header.checksum, ' ', sizeof(header.checksum));
+    unsigned int sum = 0;
+    for (size_t i = 0; i < sizeof(header); i++)
+        sum += ((unsigned char*)&header)[i];
+    snprintf(header.checksum, sizeof(header.checksum), "%06o", sum);
+    header.checksum[7] = ' ';
+    return true;
+}
+
+// append to the tar stream, however many writes it takes
+int Exporter::write_out(const char* buffer, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(outFd, buffer, size);
+        if (n <= 0)
+            return FAILURE;
+        buffer += n;
+        size -= n;
+        written += n;
+    }
+    return SUCCESS;
+}
+
+// where a file goes in the host directory; the starting file or directory is the target itself
+std::string Exporter::host_path(const ExportFile& entry) {
+    return entry.name.empty() ? target : target + "/" + entry.name;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "CachedINode.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define EXPORT_WINDOW 32 // how many files the readers may get ahead of the file being written to a tar stream
+#define EXPORT_CHUNK_BLOCKS 1024 // the most blocks read at once into a buffer; larger files are streamed in chunks this size
+#define TAR_BLOCK_SIZE 512 // tar headers and file contents take up whole tar blocks
+#define TAR_RECORD_SIZE 10240 // a tar stream is padded to a whole number of records
+
+// a ustar header, which precedes each file in a tar stream; the numbers are octal strings
+struct TarHeader {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char type; // '0' for regular files, '2' for symbolic links, '5' for directories
+    char linkname[100];
+    char magic[6]; // "ustar"
+    char version[2]; // "00"
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155]; // the start of a name too long for the name field
+    char pad[12];
+};
+
+// copies a tree of files, directories and symbolic links out of the simulated file system, to a host directory or
+// as a tar stream; the tree is walked in parallel and each file is read in runs of contiguous blocks
+// a host directory's files are copied by a pool of threads, straight from the disk image when possible, while a tar
+// stream is written in order by the calling thread with the readers up to a window ahead of it, reading the small
+// files; the calling thread streams each larger file itself, a chunk at a time, so no file is held in memory whole
+class Exporter {
+public:
+    Exporter(const std::string& imagePath, const std::string& target); // export an image file or directory to a host target
+    int run(); // export the whole tree; returns SUCCESS if everything was exported
+
+private:
+    class ExportFile { // a file, directory or symbolic link to be exported
+    public:
+        std::string name; // its pathname relative to the start of the export; empty for the start itself
+        CachedINode file; // a private copy of its inode
+        std::vector<char> data; // for a tar stream, a small file's contents or link's target, once it has been read
+        bool ready = false; // has it been read?
+        bool failed = false; // couldn't it be read?
+    };
+
+    std::string imagePath;
+    std::string target; // a host directory, a .tar file, or - for standard output
+    std::vector<ExportFile> files; // everything to be exported, each directory before its contents
+    std::mutex lock;
+    std::condition_variable fileRead; // signaled when a reader finishes a file
+    std::condition_variable windowMoved; // signaled when the tar writer finishes a file
+    std::atomic<size_t> nextToRead; // the next file for a worker to take
+    size_t nextToWrite = 0; // the file being written to the tar stream, which bounds the readers' window
+    std::atomic<long> bytes; // number of bytes exported
+    std::atomic<int> numFiles; // number of files exported
+    std::atomic<int> numFailed; // number of files that couldn't be exported
+    int numDirs = 0; // number of directories exported
+    int numLinks = 0; // number of symbolic links exported
+    int outFd = -1; // the tar stream's file descriptor
+    long written = 0; // number of bytes written to the tar stream
+
+    int collect(); // walk the tree, listing everything to be exported in name order
+    int export_tree(); // copy everything into a host directory
+    void copy_files(); // a worker's loop: copy regular files into the host directory until there are none left
+    int copy_data(CachedINode& file, int fd); // copy a file's data, leaving its holes as holes
+    int export_tar(); // write everything as a tar stream
+    void read_files(); // a reader thread's loop: read files for the tar stream until there are none left
+    void read_data(CachedINode& file, std::vector<char>& data); // read a file's data, zero-filling its holes
+    int stream_data(CachedINode& file); // append a larger file's data to the tar stream, a chunk at a time
+    std::string link_target(CachedINode& link); // the target of a symbolic link
+    bool make_header(const ExportFile& entry, TarHeader& header); // fill in a file's tar header
+    int write_out(const char* buffer, size_t size); // append to the tar stream
+    std::string host_path(const ExportFile& entry); // where a file goes in the host directory
+};
@@ -0,0 +1,206 @@
+#include "Ext2Sim.hpp"
+#include "Directory.hpp"
+
+// points fs at an Ext2Sim's engine for the length of a call, and then back at whichever engine was running before
+class UseEngine {
+public:
+    UseEngine(FileSystem* engine)
+        : previous(fs) {
+        fs = engine;
+    }
+    ~UseEngine() { fs = previous; }
+
+private:
+    FileSystem* previous;
+};
+
+// close the file system if it's still open
+Ext2Sim::~Ext2Sim() {
+    close();
+}
+
+// start a new engine: mount a disk image as the root device and start the superuser's process, whose cwd is the
+// root; the options are the mount command's, e.g., "ram,noatime"; returns IN_USE if this handle is already open
+Status Ext2Sim::open(const std::string& diskImage, const std::string& options) {
+    if (engine)
+        return Status::IN_USE;
+    engine = std::make_unique<FileSystem>();
+    UseEngine use(engine.get());
+    if (fs->init(diskImage, options) == FAILURE) {
+        engine.reset();
+        return Status::NOT_MOUNTED;
+    }
+    return Status::OK;
+}
+
+// write everything back to the devices, including any RAM disks that persist, close them and end the engine
+Status Ext2Sim::close() {
+    if (!engine)
+        return Status::NOT_MOUNTED;
+    {
+        UseEngine use(engine.get());
+        fs->shutdown();
+    }
+    engine.reset();
+    return Status::OK;
+}
+
+// get a file's attributes
+Status Ext2Sim::stat(const std::string& pathname, FileStat* result) {
+    if (!engine)
+        return Status::NOT_MOUNTED;
+    UseEngine use(engine.get());
+    CachedINode* cachedINode = fs->inodeTable.get(pathname);
+    if (!cachedINode)
+        return Status::NOT_FOUND;
+    const INode& inode = cachedINode->inode;
+    *result = { cachedINode->device->fd, cachedINode->inodeNum, inode.i_mode, inode.i_links_count, inode.i_uid,
+        inode.i_gid, inode.i_size, inode.i_blocks, inode.i_atime, inode.i_mtime, inode.i_ctime };
+    cachedINode->put();
+    return Status::OK;
+}
+
+// get the entries of a directory, including . and ..
+Status Ext2Sim::list(const std::string& pathname, std::vector<DirEntryInfo>* entries) {
+    if (!engine)
+        return Status::NOT_MOUNTED;
+    UseEngine use(engine.get());
+    CachedINode* cachedINode = fs->inodeTable.get(pathname);
+    if (!cachedINode)
+        return Status::NOT_FOUND;
+    Status status = Status::NOT_DIRECTORY;
+    if (S_ISDIR(cachedINode->inode.i_mode)) {
+        entries->clear();
+        for (const auto& entry : Directory(cachedINode))
+            if (entry.inodeNum != 0) // skip unused entries
+                entries->push_back({ std::string(entry.name), entry.inodeNum, entry.dirEntry->file_type });
+        status = Status::OK;
+    }
+    cachedINode->put();
+    return status;
+}
+
+// create a directory
+Status Ext2Sim::mkdir(const std::string& pathname) {
+    if (!engine)
+        return Status::NOT_MOUNTED;
+    UseEngine use(engine.get());
+    int inodeNum;
+    Status status = fs->inodeTable.create(pathname, true, &inodeNum);
+    fs->mountTable.commit();
+    return status;
+}
+
+// create an empty regular file
+Status Ext2Sim::creat(const std::string& pathname) {
+    if (!engine)
+        return Status::NOT_MOUNTED;
+    UseEngine use(engine.get());
+    int inodeNum;
+    Status status = fs->inodeTable.create(pathname, false, &inodeNum);
+    fs->mountTable.commit();
+    return status;
+}
+
+// remove an empty directory
+Status Ext2Sim::rmdir(const std::string& pathname) {
+    if (!engine)
+        return Status::NOT_MOUNTED;
+    UseEngine use(engine.get());
+    Status status = fs->inodeTable.remove(pathname, true);
+    fs->mountTable.commit();
+    return status;
+}
+
+// remove a link to a file, and the file itself with its last link
+Status Ext2Sim::unlink(const std::string& pathname) {
+    if (!engine)
+        return Status::NOT_MOUNTED;
+    UseEngine use(engine.get());
+    Status status = fs->inodeTable.remove(pathname, false);
+    fs->mountTable.commit();
+    return status;
+}
+
+// read up to length bytes of a regular file, starting at offset; the data is shorter if the file ends first, and
+// holes read as zeros
+Status Ext2Sim::read(const std::string& pathname, long offset, long length, std::string* data) {
+    if (!engine)
+        return Status::NOT_MOUNTED;
+    UseEngine use(engine.get());
+    if (offset < 0 || length < 0 || offset > INT32_MAX || length > INT32_MAX)
+        return Status::INVALID;
+    Status status;
+    OpenFile* openFile = open_file(pathname, READ, offset, length, &status);
+    if (!openFile)
+        return status;
+    length = std::min(length, std::max((long)openFile->cachedINode->inode.i_size - offset, 0L)); // before any memory is set aside
+    data->resize(length);
+    data->resize(openFile->read(data->data(), length));
+    fs->openFileTable.close(openFile);
+    return Status::OK;
+}
+
+// write bytes to a regular file at offset, growing it if they go past its end; sets how many were written, which
+// is fewer than asked for, with NO_SPACE, if the device fills up or the file can't map any more blocks
+Status Ext2Sim::write(const std::string& pathname, long offset, const std::string& data, long* written) {
+    *written = 0;
+    if (!engine)
+        return Status::NOT_MOUNTED;
+    UseEngine use(engine.get());
+    if (offset < 0 || offset + (long)data.size() > INT32_MAX)
+        return Status::INVALID;
+    Status status;
+    OpenFile* openFile = open_file(pathname, READWRITE, offset, data.size(), &status); // READWRITE, since WRITE would truncate the file
+    if (!openFile)
+        return status;
+    *written = openFile->write(data.data(), data.size());
+    fs->openFileTable.close(openFile);
+    fs->mountTable.commit();
+    return *written < (long)data.size() ? Status::NO_SPACE : Status::OK;
+}
+
+// write all cached changes back to the devices, including access times held back by lazytime
+Status Ext2Sim::sync() {
+    if (!engine)
+        return Status::NOT_MOUNTED;
+    UseEngine use(engine.get());
+    fs->inodeTable.sync();
+    fs->mountTable.sync();
+    return Status::OK;
+}
+
+// open a regular file in the open file table for one read or write of a range of bytes, as the running process, so
+// the call honours the other opens' modes and the byte-range locks like the read and write commands do; returns the
+// entry, positioned at offset, which the caller closes, or null with the reason set
+OpenFile* Ext2Sim::open_file(const std::string& pathname, OpenMode mode, long offset, long length, Status* status) {
+    CachedINode* cachedINode = fs->inodeTable.get(pathname);
+    if (!cachedINode) {
+        *status = Status::NOT_FOUND;
+        return nullptr;
+    }
+    if (!S_ISREG(cachedINode->inode.i_mode)) {
+        *status = S_ISDIR(cachedINode->inode.i_mode) ? Status::IS_DIRECTORY : Status::INVALID;
+        cachedINode->put();
+        return nullptr;
+    }
+    if (mode != READ && cachedINode->device->readOnly) {
+        *status = Status::READ_ONLY;
+        cachedINode->put();
+        return nullptr;
+    }
+    int end = std::min(offset + length, (long)INT32_MAX);
+    if (length > 0 && cachedINode->locks.conflict(fs->running->pid, mode == READ ? READ_LOCK : WRITE_LOCK, offset, end) >= 0) {
+        *status = Status::LOCKED;
+        cachedINode->put();
+        return nullptr;
+    }
+    OpenFile* openFile = fs->openFileTable.open(cachedINode, mode); // it holds the inode from here on
+    if (!openFile) {
+        *status = Status::IN_USE;
+        cachedINode->put();
+        return nullptr;
+    }
+    openFile->offset = offset;
+    return openFile;
+}
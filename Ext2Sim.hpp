@@ -0,0 +1,53 @@
+#pragma once
+#include "FileSystem.hpp"
+
+// a file's attributes, as returned by Ext2Sim::stat
+struct FileStat {
+    int device; // the descriptor of the device holding the file
+    int inodeNum; // inode number
+    int mode; // the file type and permissions, e.g., S_IFREG | 0644
+    int links; // the number of hard links to the file
+    int uid; // owner's user id
+    int gid; // owner's group id
+    long size; // in bytes
+    long blocks; // in 512-byte units, as counted in the inode
+    time_t atime; // last access time
+    time_t mtime; // last modification time
+    time_t ctime; // last inode change time
+};
+
+// an entry in a directory, as returned by Ext2Sim::list
+struct DirEntryInfo {
+    std::string name; // the entry's filename
+    int inodeNum; // the entry's inode number
+    int type; // the entry's file type, e.g., EXT2_FT_DIR, or EXT2_FT_UNKNOWN if the directory doesn't record types
+};
+
+// the file system simulator as a library: each call runs the same code as the command line, reports what went
+// wrong as a Status rather than printing it, and hands back its results through its parameters
+// each Ext2Sim owns an engine of its own from open to close, so several can be open at once, on different disk
+// images, and one can be opened again once it's closed; a call points fs at its engine while it runs, so calls on
+// different Ext2Sims take turns rather than running at the same time
+class Ext2Sim {
+public:
+    Ext2Sim() = default;
+    Ext2Sim(const Ext2Sim&) = delete; // the engine belongs to one handle
+    Ext2Sim& operator=(const Ext2Sim&) = delete;
+    ~Ext2Sim(); // close the file system if it's still open
+    Status open(const std::string& diskImage, const std::string& options = ""); // mount a disk image as the root device
+    Status close(); // write everything back to the devices
+    Status stat(const std::string& pathname, FileStat* result); // get a file's attributes
+    Status list(const std::string& pathname, std::vector<DirEntryInfo>* entries); // get the entries of a directory
+    Status mkdir(const std::string& pathname); // create a directory
+    Status creat(const std::string& pathname); // create an empty regular file
+    Status rmdir(const std::string& pathname); // remove an empty directory
+    Status unlink(const std::string& pathname); // remove a link to a file
+    Status read(const std::string& pathname, long offset, long length, std::string* data); // read up to length bytes at offset
+    Status write(const std::string& pathname, long offset, const std::string& data, long* written); // write bytes at offset
+    Status sync(); // write all cached changes back to the devices
+
+private:
+    std::unique_ptr<FileSystem> engine; // the file system this handle has open, or null
+
+    OpenFile* open_file(const std::string& pathname, OpenMode mode, long offset, long length, Status* status); // open a regular file for one read or write, or set the reason it can't be
+};
@@ -3,21 +3,24 @@
 #include "OpenFileTable.hpp"
 #include "MountTable.hpp"
 #include "INodeTable.hpp"
+#include "Arena.hpp"
+#include "BlockTrace.hpp"
 
-// the global variables and utility functions of the file system simulation
+// the state and utility functions of one file system simulation, its engine; the command line (Shell) and each
+// library handle (Ext2Sim) own one, and point fs at it while they run
 class FileSystem {
 public:
     ProcessTable processTable; // all processes using the file system
-    Process* running; // the currently running process
+    Process* running = nullptr; // the currently running process
     OpenFileTable openFileTable; // all files opened across the file system
     MountTable mountTable; // all devices mounted by the file system
     INodeTable inodeTable; // all inodes being used by the file system
-    CachedINode* root; // the root of the file system
+    CachedINode* root = nullptr; // the root of the file system
+    Arena arena; // scratch memory for the command currently being run
+    BlockTrace blockTrace; // the latest block reads and writes, while tracing is on
 
-    void start(const std::string& diskImage); // the main user input loop for the simulation
-    void menu(); // display the available commands for the file system
-    void execute(const std::vector<std::string>& input); // run a file system command
-    void quit(); // terminate the file system simulation
+    int init(const std::string& diskImage, const std::string& options); // mount the root device and start the superuser's process
+    void shutdown(); // write everything back to the devices and close them
 };
 
-extern FileSystem fs; // globally defined in main.cpp
+extern FileSystem* fs; // the engine being run, which every part of the simulation works on; defined in FileSystem.cpp
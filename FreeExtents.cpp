@@ -0,0 +1,87 @@
+#include "FreeExtents.hpp"
+
+// forget every extent
+void FreeExtents::clear() {
+    byStart.clear();
+    byLength.clear();
+}
+
+// add a run of free blocks, merging it with the extents that end just before it and start just after it
+void FreeExtents::give(int start, int length) {
+    auto next = byStart.lower_bound(start);
+    if (next != byStart.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == start) {
+            start = prev->first;
+            length += prev->second;
+            erase(prev);
+        }
+    }
+    if (next != byStart.end() && next->first == start + length) {
+        length += next->second;
+        erase(next);
+    }
+    insert(start, length);
+}
+
+// remove a run of allocated blocks from the extent holding them, keeping whatever's left on either side
+void FreeExtents::take(int start, int length) {
+    auto extent = byStart.upper_bound(start);
+    if (extent == byStart.begin())
+        return;
+    extent--;
+    int first = extent->first, end = extent->first + extent->second;
+    if (start + length > end)
+        return; // not all free, so the caller's bitmap and this index disagree; leave it
+    erase(extent);
+    if (first < start)
+        insert(first, start - first);
+    if (start + length < end)
+        insert(start + length, end - start - length);
+}
+
+// the first free block at or after goal, or 0 if there isn't one
+int FreeExtents::next_free(int goal) {
+    auto extent = byStart.upper_bound(goal);
+    if (extent != byStart.begin()) {
+        auto prev = std::prev(extent);
+        if (prev->first + prev->second > goal)
+            return goal; // the goal itself is free
+    }
+    return extent == byStart.end() ? 0 : extent->first;
+}
+
+// the smallest extent of at least wanted blocks, so large runs are left for large requests, or else the largest one;
+// returns its first block and sets the number of blocks to use, or returns 0 if there's no free space at all
+int FreeExtents::best_fit(int wanted, int* length) {
+    *length = 0;
+    if (byLength.empty())
+        return 0;
+    auto fit = byLength.lower_bound({ wanted, 0 });
+    if (fit == byLength.end())
+        fit = std::prev(fit);
+    *length = std::min(fit->first, wanted);
+    return fit->second;
+}
+
+// the number of extents
+int FreeExtents::count() {
+    return byStart.size();
+}
+
+// the length of the largest extent
+int FreeExtents::largest() {
+    return byLength.empty() ? 0 : byLength.rbegin()->first;
+}
+
+// add an extent to both trees
+void FreeExtents::insert(int start, int length) {
+    byStart[start] = length;
+    byLength.insert({ length, start });
+}
+
+// remove an extent from both trees
+void FreeExtents::erase(std::map<int, int>::iterator extent) {
+    byLength.erase({ extent->second, extent->first });
+    byStart.erase(extent);
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "main.hpp"
+#include <map>
+#include <set>
+
+// a device's free blocks as extents, kept in two balanced trees: one by first block, to find the free space at or
+// after a goal and to merge neighbouring extents as blocks are freed, and one by length, to find the best fit for a run
+class FreeExtents {
+public:
+    void clear(); // forget every extent
+    void give(int start, int length); // add a run of free blocks, merging it with the extents on either side
+    void take(int start, int length); // remove a run of blocks that have been allocated, splitting its extent
+    int next_free(int goal); // the first free block at or after goal, or 0 if there isn't one
+    int best_fit(int wanted, int* length); // the smallest extent of at least wanted blocks, or else the largest one
+    int count(); // the number of extents
+    int largest(); // the length of the largest extent
+
+private:
+    std::map<int, int> byStart; // each extent's length, by its first block
+    std::set<std::pair<int, int>> byLength; // each extent as (length, first block)
+
+    void insert(int start, int length); // add an extent to both trees
+    void erase(std::map<int, int>::iterator extent); // remove an extent from both trees
+};
@@ -1,64 +1,148 @@
 #include "FileSystem.hpp"
+#include "Profiler.hpp"
 #include "DataBlock.hpp"
 #include "Directory.hpp"
+#include "Exporter.hpp"
+#include "Importer.hpp"
 #include "PathComponents.hpp"
+#include "TreeWalker.hpp"
+#include <fnmatch.h>
+#include <set>
+
+// list every entry as free, the first one last so it's taken first
+INodeTable::INodeTable() {
+    for (auto c = inodes.rbegin(); c != inodes.rend(); c++)
+        release(&*c);
+}
 
 // return a cached inode from the inode table for a given device and inode number
 CachedINode* INodeTable::get(MountedDevice* device, int inodeNum) {
-    for (CachedINode& c : inodes) {
-        if (c.refCount && c.device == device && c.inodeNum == inodeNum) {
-            c.refCount++;
-            TRACE(3, "reference count for cached inode [%d, %d] at address %p is now %d\n", c.device->fd, c.inodeNum, &c, c.refCount);
-            return &c;
+    PROFILE_SCOPE("INodeTable::get(inode)");
+    auto found = index.find({ device, inodeNum });
+    if (found != index.end() && found->second->is_held()) { // a modified inode is still cached, even if it's not in use
+        CachedINode& c = *found->second;
+        c.refCount++;
+        TRACE(3, "reference count for cached inode [%d, %d] at address %p is now %d\n", c.device->fd, c.inodeNum, &c, c.refCount);
+        return &c;
+    }
+
+    CachedINode* free = found != index.end() ? found->second : take_free(); // the inode's last entry, if it's still free
+    if (free->device) {
+        auto previous = index.find({ free->device, free->inodeNum });
+        if (previous != index.end() && previous->second == free)
+            index.erase(previous);
+    }
+    index[{ device, inodeNum }] = free;
+
+    TRACE(3, "allocating cached inode [%d, %d] at address %p\n", device->fd, inodeNum, free);
+    free->refCount = 1;
+    free->device = device;
+    free->inodeNum = inodeNum;
+    free->isDirty = false;
+    free->deviceRoot = nullptr;
+    free->slack.clear();
+    free->locks.clear();
+    free->nextGoal = 0;
+
+    // find the desired entry in the device's inode table
+    int blockNum = device->inode_block(inodeNum);
+    int offset = device->inode_offset(inodeNum);
+    TRACE(2, "device number=%d, inode number=%d is stored at block number=%d, offset=%d\n", device->fd, inodeNum, blockNum, offset);
+
+    DataBlock block(device);
+    block.get(blockNum);
+    memcpy(&free->inode, &block.buffer[offset], sizeof(INode));
+    return free;
+}
+
+// take an entry that holds no inode off the free list; if there's none, every modified inode that's no longer in use
+// is written back, which frees its entry, and if that frees none either, the table doubles in size
+CachedINode* INodeTable::take_free() {
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) { // no room left, so write back every modified inode that's no longer in use
+            std::vector<CachedINode*> unused;
+            for (CachedINode& c : inodes)
+                if (c.refCount == 0 && c.is_held()) unused.push_back(&c);
+            write_back(unused);
+        }
+        while (!freeEntries.empty()) {
+            CachedINode* c = freeEntries.back();
+            freeEntries.pop_back();
+            c->listedFree = false;
+            if (!c->is_held())
+                return c;
         }
     }
+    size_t size = inodes.size();
+    inodes.resize(2 * size);
+    for (size_t i = inodes.size() - 1; i > size; i--)
+        release(&inodes[i]);
+    TRACE(1, "grew the cached inodes table to %d entries\n", (int)inodes.size());
+    return &inodes[size];
+}
 
-    for (CachedINode& c : inodes) {
-        if (c.refCount == 0) {
-            TRACE(3, "allocating cached inode [%d, %d] at address %p\n", device->fd, inodeNum, &c);
-            c.refCount = 1;
-            c.device = device;
-            c.inodeNum = inodeNum;
-            c.isDirty = false;
-            c.deviceRoot = nullptr;
-
-            // find the desired entry in the device's inode table
-            int blockNum = (inodeNum - 1) / INODES_PER_BLOCK + device->inodeStart;
-            int entry = (inodeNum - 1) % INODES_PER_BLOCK;
-            TRACE(2, "device number=%d, inode number=%d is stored at block number=%d, inode entry=%d\n", device->fd, inodeNum, blockNum, entry);
-
-            DataBlock block(device);
-            block.get(blockNum);
-            c.inode = block.inodes[entry];
-            return &c;
+// list an entry as free once it no longer holds an inode: it's no longer in use and its changes are written back
+void INodeTable::release(CachedINode* c) {
+    if (c->listedFree || c->is_held())
+        return;
+    c->listedFree = true;
+    freeEntries.push_back(c);
+}
+
+// fill in private copies of many inodes on one device, given their inode numbers; the copies aren't part of the table
+// inodes already in the table are copied from it, since they may have been modified; the rest are sorted by their
+// location in the inode table, so that each inode table block is read once and adjacent blocks in a single read
+void INodeTable::read_inodes(MountedDevice* device, std::vector<CachedINode>& files) {
+    std::vector<CachedINode*> uncached;
+    for (CachedINode& file : files) {
+        file.device = device;
+        auto cached = index.find({ device, file.inodeNum });
+        if (cached != index.end() && cached->second->is_held())
+            file.inode = cached->second->inode;
+        else
+            uncached.push_back(&file);
+    }
+    std::sort(uncached.begin(), uncached.end(), [](CachedINode* a, CachedINode* b) { return a->inodeNum < b->inodeNum; });
+
+    auto tableBlock = [device](CachedINode* file) { return device->inode_block(file->inodeNum); };
+    std::vector<char> buffer;
+    for (size_t i = 0, j; i < uncached.size(); i = j) {
+        int first = tableBlock(uncached[i]), last = first;
+        for (j = i; j < uncached.size() && tableBlock(uncached[j]) <= last + 1; j++)
+            last = tableBlock(uncached[j]); // extend the run over adjacent inode table blocks
+        buffer.resize((last - first + 1) * BLOCK_SIZE);
+        TRACE(2, "reading inode table blocks %d to %d for %d inodes\n", first, last, (int)(j - i));
+        device->read_blocks(first, last - first + 1, buffer.data());
+        for (size_t k = i; k < j; k++) {
+            int inodeNum = uncached[k]->inodeNum;
+            memcpy(&uncached[k]->inode, &buffer[(tableBlock(uncached[k]) - first) * BLOCK_SIZE + device->inode_offset(inodeNum)], sizeof(INode));
         }
     }
-    std::cerr << "PANIC: no more free entries in the cached inodes table\n";
-    exit(FAILURE);
 }
 
 // return a cached inode from the inode table for a given file or directory
-CachedINode* INodeTable::get(const std::string& pathname) {
+CachedINode* INodeTable::get(std::string_view pathname) {
+    PROFILE_SCOPE("INodeTable::get(path)");
     CachedINode* file; // the inode of the file or directory for we're looking for
     MountedDevice* device; // the device on which the file is located
     int inodeNum; // the inode number of the file
 
     if (pathname == "/") {
-        fs.root->refCount++;
-        return fs.root;
+        fs->root->refCount++;
+        return fs->root;
     }
 
-    if (pathname[0] == '/') { // given an absolute pathname, start in the file system's root
-        device = fs.root->device;
-        inodeNum = fs.root->inodeNum;
+    if (pathname != "" && pathname[0] == '/') { // given an absolute pathname, start in the file system's root
+        device = fs->root->device;
+        inodeNum = fs->root->inodeNum;
     } else { // otherwise, start in the cwd of the file system's running process
-        device = fs.running->cwd->device;
-        inodeNum = fs.running->cwd->inodeNum;
+        device = fs->running->cwd->device;
+        inodeNum = fs->running->cwd->inodeNum;
     }
 
     file = get(device, inodeNum);
     PathComponents path(pathname);
-    for (const std::string& name : path.names) {
+    for (std::string_view name : path.names) {
         // check to see if we are traversing up through a mount point and need to change devices
         if (name == ".." && file == device->root) {
             file->put();
@@ -67,7 +151,7 @@ CachedINode* INodeTable::get(const std::string& pathname) {
         inodeNum = file->search(name);
         if (inodeNum == 0) {
             file->put();
-            TRACE(1, "name '%s' does not exist\n", name.c_str());
+            TRACE(1, "name '%.*s' does not exist\n", (int)name.size(), name.data());
             return nullptr;
         }
         file->put();
@@ -78,7 +162,7 @@ CachedINode* INodeTable::get(const std::string& pathname) {
             file = get(file->deviceRoot->device, file->deviceRoot->inodeNum);
         }
     }
-    TRACE(1, "pathname = '%s' is on device %d, inode number %d\n", pathname.c_str(), device->fd, inodeNum);
+    TRACE(1, "pathname = '%.*s' is on device %d, inode number %d\n", (int)pathname.size(), pathname.data(), device->fd, inodeNum);
     return file;
 }
 
@@ -97,14 +181,62 @@ void INodeTable::display() {
         if (c.refCount)
             printf("reference count for cached inode [%d, %d] at address %p is %d\n", c.device->fd, c.inodeNum, &c, c.refCount);
     }
-    std::cout << "root points to address " << fs.root << "\n";
-    std::cout << "cwd  points to address " << fs.running->cwd << "\n";
+    std::cout << "root points to address " << fs->root << "\n";
+    std::cout << "cwd  points to address " << fs->running->cwd << "\n";
 }
 
 // clear the cached inode table, writing back any modified entries
 void INodeTable::flush() {
+    sync(); // write even if still referenced, e.g., the root and cwd
+}
+
+// write back all modified entries, keeping them cached; used before reading inodes directly from a device
+// access times held back by lazytime are written too, unless lazy is false
+void INodeTable::sync(MountedDevice* device, bool lazy) {
+    std::vector<CachedINode*> dirty;
     for (CachedINode& c : inodes)
-        if (c.refCount > 0 && c.isDirty) c.put();
+        if ((c.isDirty || (lazy && c.timesDirty)) && (!device || c.device == device)) dirty.push_back(&c);
+    write_back(dirty);
+}
+
+// write back modified inodes, grouped by the inode table block that holds them: each block is read once, updated
+// with all of its inodes, and written once, in block order
+void INodeTable::write_back(std::vector<CachedINode*>& dirty) {
+    std::sort(dirty.begin(), dirty.end(), [](CachedINode* a, CachedINode* b) {
+        if (a->device != b->device) return a->device < b->device;
+        return a->inodeNum < b->inodeNum; // inode numbers run through the inode table in block order
+    });
+    int numBlocks = 0;
+    for (size_t i = 0; i < dirty.size();) {
+        MountedDevice* device = dirty[i]->device;
+        DataBlock block(device);
+        block.get(device->inode_block(dirty[i]->inodeNum));
+        for (; i < dirty.size() && dirty[i]->device == device && device->inode_block(dirty[i]->inodeNum) == block.blockNum; i++) {
+            CachedINode* c = dirty[i];
+            memcpy(&block.buffer[device->inode_offset(c->inodeNum)], &c->inode, sizeof(INode)); // any larger inode's extra fields are kept
+            c->isDirty = false;
+            c->timesDirty = false;
+            release(c); // if it's no longer in use
+        }
+        block.put();
+        numBlocks++;
+    }
+    if (!dirty.empty())
+        TRACE(1, "wrote back %d inodes in %d inode table blocks\n", (int)dirty.size(), numBlocks);
+}
+
+// re-read the cached inodes of a device whose inode table was changed directly, e.g., by defrag
+void INodeTable::reload(MountedDevice* device) {
+    DataBlock block(device);
+    for (CachedINode& c : inodes) {
+        if (c.refCount == 0 || c.device != device)
+            continue;
+        block.get(device->inode_block(c.inodeNum));
+        memcpy(&c.inode, &block.buffer[device->inode_offset(c.inodeNum)], sizeof(INode));
+        c.isDirty = false;
+        c.slack.clear();
+        c.nextGoal = 0;
+    }
 }
 
 // list the contents of a directory or display a file's attributes
@@ -125,146 +257,150 @@ int INodeTable::ls(const std::string& pathname) {
 
 // create a new file and return its inode number, or 0 if error
 int INodeTable::creat(const std::string& pathname) {
-    if (pathname == "") {
-        std::cerr << "creat: cannot create file, no name given\n";
-        return 0;
-    }
-
-    PathComponents path(pathname);
-    CachedINode* parent = get(path.parent);
-    if (!parent) {
-        std::cerr << "creat: cannot make directory, " << path.parent << " does not exist\n";
-        return 0;
-    }
-
-    if (!S_ISDIR(parent->inode.i_mode)) {
-        std::cerr << "creat: cannot create file, " << path.parent << " is not a directory\n";
-        parent->put();
-        return 0;
-    }
-    if (parent->search(path.child)) {
-        std::cerr << "creat: cannot create file, " << path.child << " already exists in " << path.parent << "\n";
-        parent->put();
-        return 0;
-    }
-
-    int inodeNum = create_file_inode(parent);
-    if (inodeNum) {
-        parent->make_dir_entry(path.child, inodeNum);
-        parent->inode.i_atime = time(0L); // set to current time
-        parent->inode.i_ctime = time(0L); // update inode change time
-        parent->isDirty = true;
-    } else {
-        std::cerr << "creat: cannot create file, unable to allocate inode\n";
-    }
-
-    parent->put();
+    int inodeNum;
+    Status status = create(pathname, false, &inodeNum);
+    if (status != Status::OK)
+        std::cerr << "creat: cannot create file " << pathname << ", " << status_message(status) << "\n";
     return inodeNum;
 }
 
 // make a directory and return its inode number, 0 if error
 int INodeTable::mkdir(const std::string& pathname) {
-    if (pathname == "") {
-        std::cerr << "mkdir: cannot make directory, no name given\n";
-        return 0;
-    }
+    int inodeNum;
+    Status status = create(pathname, true, &inodeNum);
+    if (status != Status::OK)
+        std::cerr << "mkdir: cannot make directory " << pathname << ", " << status_message(status) << "\n";
+    return inodeNum;
+}
+
+// create a new file or directory, setting its inode number; this is what the creat and mkdir commands and the
+// library interface do, without any messages
+Status INodeTable::create(const std::string& pathname, bool isDir, int* inodeNum) {
+    PROFILE_SCOPE("INodeTable::create");
+    *inodeNum = 0;
+    if (pathname == "")
+        return Status::INVALID;
 
     PathComponents path(pathname);
     CachedINode* parent = get(path.parent);
-    if (!parent) {
-        std::cerr << "mkdir: cannot make directory, " << path.parent << " does not exist\n";
-        return 0;
-    }
-    if (!S_ISDIR(parent->inode.i_mode)) {
-        std::cerr << "mkdir: cannot make directory, " << path.parent << " is not a directory\n";
+    if (!parent)
+        return Status::NOT_FOUND;
+    Status status = Status::OK;
+    if (!S_ISDIR(parent->inode.i_mode))
+        status = Status::NOT_DIRECTORY;
+    else if (parent->search(path.child))
+        status = Status::EXISTS;
+    else if (parent->device->readOnly)
+        status = Status::READ_ONLY;
+    else if (parent->device->nifree == 0 || (isDir && parent->device->nbfree == 0))
+        status = Status::NO_SPACE;
+    else if (!(*inodeNum = isDir ? make_dir_inode(parent) : create_file_inode(parent)))
+        status = Status::NO_SPACE;
+    if (status != Status::OK) {
         parent->put();
-        return 0;
+        return status;
     }
-    if (parent->search(path.child)) {
-        std::cerr << "mkdir: cannot make directory, " << path.child << " already exists in " << path.parent << "\n";
+
+    if (!parent->make_dir_entry(path.child, *inodeNum)) { // the directory needed a block and there wasn't one
+        CachedINode* file = get(parent->device, *inodeNum);
+        file->for_each_block([&](int blockNum, bool) { file->device->deallocate(BLOCK, blockNum); });
+        file->device->deallocate(INODE, file->inodeNum);
+        file->inode.i_links_count = 0; // a deleted inode has no links and a deletion time
+        file->inode.i_dtime = time(0L);
+        file->isDirty = true;
+        file->put();
         parent->put();
-        return 0;
+        *inodeNum = 0;
+        return Status::NO_SPACE;
     }
-
-    int inodeNum = make_dir_inode(parent);
-    if (inodeNum) {
-        parent->make_dir_entry(path.child, inodeNum);
+    if (isDir) {
+        parent->device->update_dirs(1);
         parent->inode.i_links_count++;
-        parent->inode.i_atime = time(0L); // set to current time
-        parent->inode.i_ctime = time(0L); // update inode change time
-        parent->isDirty = true;
-    } else {
-        std::cerr << "mkdir: cannot make directory, unable to allocate inode and/or data block\n";
     }
-
+    parent->inode.i_atime = time(0L); // set to current time
+    parent->inode.i_ctime = time(0L); // update inode change time
+    parent->isDirty = true;
     parent->put();
-    return inodeNum;
+    return Status::OK;
 }
 
 // remove a directory
 int INodeTable::rmdir(const std::string& pathname) {
-    if (pathname == "") {
-        std::cerr << "rmdir: cannot remove directory, no name given\n";
-        return FAILURE;
-    }
+    Status status = remove(pathname, true);
+    if (status != Status::OK)
+        std::cerr << "rmdir: cannot remove " << pathname << ", " << status_message(status) << "\n";
+    return status == Status::OK ? SUCCESS : FAILURE;
+}
+
+// remove a reference to an inode; delete the file
+int INodeTable::unlink(const std::string& pathname, bool isMoving) {
+    Status status = remove(pathname, false, isMoving);
+    if (status != Status::OK)
+        std::cerr << "unlink: cannot remove " << pathname << ", " << status_message(status) << "\n";
+    return status == Status::OK ? SUCCESS : -1;
+}
+
+// remove a directory, which must be empty, or a link to a file, deleting the file when it was the last one; while a
+// file is being moved its old name is removed even if it's a directory, since its new name already links to it
+Status INodeTable::remove(const std::string& pathname, bool isDir, bool isMoving) {
+    PROFILE_SCOPE("INodeTable::remove");
+    if (pathname == "")
+        return Status::INVALID;
     PathComponents path(pathname);
-    if (path.child == ".") {
-        std::cerr << "rmdir: cannot remove reference to current directory\n";
-        return FAILURE;
-    }
-    if (path.child == "..") {
-        std::cerr << "rmdir: cannot remove reference to parent directory\n";
-        return FAILURE;
-    }
-    if (path.child == "/") {
-        std::cerr << "rmdir: cannot remove reference to root directory\n";
-        return FAILURE;
-    }
+    if (isDir && (path.child == "." || path.child == ".." || path.child == "/"))
+        return Status::INVALID; // the current, parent or root directory
 
-    CachedINode* child = get(pathname);
-    if (!child) {
-        std::cerr << "rmdir: cannot remove " << pathname << ", path not found\n";
-        return FAILURE;
-    }
-    if (!S_ISDIR(child->inode.i_mode)) {
-        std::cerr << "rmdir: cannot remove, " << pathname << " is not a directory\n";
-        child->put();
-        return FAILURE;
-    }
-    if (child->refCount != 1) {
-        std::cerr << "rmdir: cannot remove, " << pathname << " is in use\n";
-        child->put();
-        return FAILURE;
-    }
-    if (!child->is_dir_empty()) {
-        std::cerr << "rmdir: cannot remove, " << pathname << " is not empty\n";
-        child->put();
-        return FAILURE;
-    }
-    // Deallocate all the directory's data blocks and its inode
-    for (int i = 0; i < EXT2_NDIR_BLOCKS; i++) {
-        if (child->inode.i_block[i] == 0) continue; // unless something is corrupt, this is could be a break
-        child->device->deallocate(BLOCK, child->inode.i_block[i]);
+    CachedINode* file = get(pathname);
+    if (!file)
+        return Status::NOT_FOUND;
+    Status status = Status::OK;
+    if (isDir && !S_ISDIR(file->inode.i_mode))
+        status = Status::NOT_DIRECTORY;
+    else if (!isDir && !isMoving && S_ISDIR(file->inode.i_mode))
+        status = Status::IS_DIRECTORY;
+    else if (!isMoving && file->refCount != 1)
+        status = Status::IN_USE;
+    else if (file->device->readOnly)
+        status = Status::READ_ONLY;
+    else if (isDir && !file->is_dir_empty())
+        status = Status::NOT_EMPTY;
+    if (status != Status::OK) {
+        file->put();
+        return status;
     }
-    child->device->deallocate(INODE, child->inodeNum);
-    child->put();
 
-    // Update parent directory data and attributes
+    if (isDir) { // deallocate all the directory's data blocks and its inode
+        file->for_each_block([&](int blockNum, bool) { file->device->deallocate(BLOCK, blockNum); });
+        file->device->deallocate(INODE, file->inodeNum);
+        file->device->update_dirs(-1);
+        file->inode.i_links_count = 0; // a deleted inode has no links and a deletion time
+        file->inode.i_dtime = time(0L);
+    } else if (--file->inode.i_links_count == 0) {
+        TRACE(1, "no remaining links, deleting %s\n", pathname.c_str());
+        file->truncate(); // deallocate the file's data blocks
+        file->device->deallocate(INODE, file->inodeNum);
+        file->inode.i_dtime = time(0L); // set deletion time
+    }
+    file->isDirty = true;
+    file->put();
 
+    // update parent directory data and attributes
     CachedINode* parent = get(path.parent);
     parent->remove_dir_entry(path.child);
-    parent->inode.i_links_count--; // the child directory is no longer pointing back to the parent
-    parent->inode.i_atime = time(0L);
-    parent->inode.i_mtime = time(0L);
-    parent->inode.i_ctime = time(0L); // update inode change time
-    parent->isDirty = true;
+    if (isDir) {
+        parent->inode.i_links_count--; // the child directory is no longer pointing back to the parent
+        parent->inode.i_atime = time(0L);
+        parent->inode.i_mtime = time(0L);
+        parent->inode.i_ctime = time(0L); // update inode change time
+        parent->isDirty = true;
+    }
     parent->put();
-
-    return SUCCESS;
+    return Status::OK;
 }
 
 // link a new file name to an existing file; create a new reference to the original file's inode
 int INodeTable::link(const std::string& srcName, const std::string& dstName, bool isMoving) {
+    PROFILE_SCOPE("INodeTable::link");
 
     if (srcName == "") {
         std::cerr << "link: cannot link, no source name given\n";
@@ -310,9 +446,19 @@ int INodeTable::link(const std::string& srcName, const std::string& dstName, boo
         dst->put();
         return FAILURE;
     }
+    if (!dst->device->writable("link")) {
+        src->put();
+        dst->put();
+        return FAILURE;
+    }
 
     // create the link
-    dst->make_dir_entry(dstPath.child, src->inodeNum);
+    if (!dst->make_dir_entry(dstPath.child, src->inodeNum)) {
+        std::cerr << "link: cannot link file, " << dstPath.parent << " needs a new block and its device is full\n";
+        src->put();
+        dst->put();
+        return FAILURE;
+    }
     src->inode.i_links_count++;
     src->inode.i_ctime = static_cast<__u32>(time(0L)); // update inode change time
     src->isDirty = true;
@@ -322,44 +468,6 @@ int INodeTable::link(const std::string& srcName, const std::string& dstName, boo
     return SUCCESS;
 }
 
-// remove a reference to an inode; delete the file if the reference count becomes 0
-int INodeTable::unlink(const std::string& pathname, bool isMoving) {
-
-    if (pathname == "") {
-        std::cerr << "rm/unlink: cannot unlink, no name given\n";
-        return -1;
-    }
-
-    PathComponents path(pathname);
-    CachedINode* file = get(pathname);
-    if (!file) {
-        std::cerr << "unlink: cannot remove " << pathname << ", file not found\n";
-        return -1;
-    }
-    if (S_ISDIR(file->inode.i_mode) && !isMoving) {
-        std::cerr << "unlink: cannot remove, " << pathname << " is a directory\n";
-        file->put();
-        return -1;
-    }
-    if (!isMoving && file->refCount > 1) {
-        std::cerr << "unlink: cannot remove " << pathname << ", file in use\n";
-        return -1;
-    }
-    if (--file->inode.i_links_count == 0) {
-        TRACE(1, "no remaining links, deleting %s\n", pathname.c_str());
-        file->truncate(); // deallocate the file's data blocks
-        file->device->deallocate(INODE, file->inodeNum);
-    }
-    file->isDirty = true;
-    file->put();
-
-    CachedINode* dir = get(path.parent);
-    dir->remove_dir_entry(path.child);
-    dir->put();
-
-    return SUCCESS;
-}
-
 // create an inode that stores the path to a different file/directory
 int INodeTable::symlink(const std::string& srcName, const std::string& dstName) {
     // assume source name has <= 60 chars, inlcuding the ending nullptr byte
@@ -455,6 +563,10 @@ int INodeTable::chmod(const std::string& mode, const std::string& pathname) {
     }
 
     CachedINode* file = get(pathname);
+    if (file && !file->device->writable("chmod")) {
+        file->put();
+        return FAILURE;
+    }
     if (file) {
         file->inode.i_mode &= 0xF000; // clear low-order permission bits
         file->inode.i_mode |= modeValue; // set permission bits
@@ -479,6 +591,10 @@ int INodeTable::utime(const std::string& pathname) {
         std::cerr << "utime: cannot update time, file not found\n";
         return FAILURE;
     }
+    if (!file->device->writable("utime")) {
+        file->put();
+        return FAILURE;
+    }
     file->inode.i_atime = time(0L); // update access time
     file->inode.i_ctime = time(0L); // update inode change time
     file->isDirty = true;
@@ -488,10 +604,11 @@ int INodeTable::utime(const std::string& pathname) {
 
 // copy a file
 int INodeTable::cp(const std::string& srcName, const std::string& dstName) {
+    PROFILE_SCOPE("INodeTable::cp");
     char dataBlock[BLOCK_SIZE];
     int numBytes;
 
-    int srcFileDescriptor = fs.running->open(srcName, READ);
+    int srcFileDescriptor = fs->running->open(srcName, READ);
     if (srcFileDescriptor == -1) {
         std::cerr << "cp: cannot open the source file for read\n";
         return FAILURE;
@@ -507,18 +624,18 @@ int INodeTable::cp(const std::string& srcName, const std::string& dstName) {
         file->put(); // if it does exist, discard the cached inode
     }
 
-    int dstFileDescriptor = fs.running->open(dstName, WRITE);
+    int dstFileDescriptor = fs->running->open(dstName, WRITE);
     if (dstFileDescriptor == -1) {
         std::cerr << "cp: cannot open the destination file for write\n";
         return FAILURE;
     }
 
-    while ((numBytes = fs.running->read(srcFileDescriptor, dataBlock, BLOCK_SIZE))) {
-        fs.running->write(dstFileDescriptor, dataBlock, numBytes);
+    while ((numBytes = fs->running->read(srcFileDescriptor, dataBlock, BLOCK_SIZE))) {
+        fs->running->write(dstFileDescriptor, dataBlock, numBytes);
     }
 
-    fs.running->close(srcFileDescriptor);
-    fs.running->close(dstFileDescriptor);
+    fs->running->close(srcFileDescriptor);
+    fs->running->close(dstFileDescriptor);
 
     return SUCCESS;
 }
@@ -581,9 +698,291 @@ int INodeTable::mv(const std::string& srcName, const std::string& dstName) {
     return SUCCESS;
 }
 
+// copy a host directory tree into the file system, keeping the files' modes and times
+int INodeTable::import(const std::string& hostDir, const std::string& pathname) {
+    if (hostDir == "" || pathname == "") {
+        std::cerr << "import: cannot import, specify a host directory and a directory to import it as\n";
+        return FAILURE;
+    }
+    CachedINode* parent = get(PathComponents(pathname).parent);
+    if (parent) {
+        bool writable = parent->device->writable("import");
+        parent->put();
+        if (!writable)
+            return FAILURE;
+    }
+    return Importer(hostDir, pathname).run();
+}
+
+// copy a file or directory tree out of the file system, to a host directory, a .tar file, or - for standard output
+int INodeTable::export_tree(const std::string& pathname, const std::string& target) {
+    if (pathname == "" || target == "") {
+        std::cerr << "export: cannot export, specify a file or directory and a host directory, .tar file or - to export it to\n";
+        return FAILURE;
+    }
+    return Exporter(pathname, target).run();
+}
+
+// repack a directory's entries into as few blocks as possible, releasing the emptied blocks
+int INodeTable::compact(const std::string& pathname) {
+    if (pathname == "") {
+        std::cerr << "compact: cannot compact, no directory given\n";
+        return FAILURE;
+    }
+    CachedINode* dir = get(pathname);
+    if (!dir) {
+        std::cerr << "compact: cannot compact, " << pathname << " not found\n";
+        return FAILURE;
+    }
+    if (!S_ISDIR(dir->inode.i_mode)) {
+        std::cerr << "compact: cannot compact, " << pathname << " is not a directory\n";
+        dir->put();
+        return FAILURE;
+    }
+    if (dir->has_extents()) {
+        std::cerr << "compact: cannot compact, " << pathname << " is mapped by extents\n";
+        dir->put();
+        return FAILURE;
+    }
+    if (!dir->device->writable("compact")) {
+        dir->put();
+        return FAILURE;
+    }
+    int released = dir->compact_dir();
+    printf("compact: released %d blocks from %s\n", released, pathname.c_str());
+    dir->put();
+    return SUCCESS;
+}
+
+// allocate the blocks for a byte range of a regular file ahead of writing it, extending the file to cover the range
+int INodeTable::fallocate(const std::string& pathname, long offset, long length) {
+    if (pathname == "" || offset < 0 || length <= 0) {
+        std::cerr << "fallocate: cannot allocate, give a file, an offset and a length\n";
+        return FAILURE;
+    }
+    CachedINode* file = get(pathname);
+    if (!file) {
+        std::cerr << "fallocate: cannot allocate, " << pathname << " not found\n";
+        return FAILURE;
+    }
+    if (!S_ISREG(file->inode.i_mode)) {
+        std::cerr << "fallocate: cannot allocate, " << pathname << " is not a regular file\n";
+        file->put();
+        return FAILURE;
+    }
+    if (offset + length > UINT32_MAX) {
+        std::cerr << "fallocate: cannot allocate, " << offset + length << " bytes is too large for a file\n";
+        file->put();
+        return FAILURE;
+    }
+    if (!file->device->writable("fallocate")) {
+        file->put();
+        return FAILURE;
+    }
+    int reached;
+    int allocated = file->preallocate(offset / BLOCK_SIZE, (offset + length + BLOCK_SIZE - 1) / BLOCK_SIZE, &reached);
+    file->inode.i_ctime = file->inode.i_mtime = time(0L);
+    file->isDirty = true;
+    if (allocated < 0) {
+        // keep the blocks allocated before the device filled up, but extend the file over them so none sit past its end
+        file->inode.i_size = std::max((long)file->inode.i_size, std::min((long)reached * BLOCK_SIZE, offset + length));
+        std::cerr << "fallocate: cannot allocate all of " << pathname << ", the device is full or the file can't map any more blocks\n";
+        file->put();
+        return FAILURE;
+    }
+    file->inode.i_size = std::max((long)file->inode.i_size, offset + length);
+    printf("fallocate: allocated %d blocks for %s\n", allocated, pathname.c_str());
+    file->put();
+    return SUCCESS;
+}
+
+// release the blocks in a byte range of a regular file, leaving a hole; the file's size doesn't change, and the parts
+// of blocks at either end of the range are zeroed instead
+int INodeTable::punch(const std::string& pathname, long offset, long length) {
+    if (pathname == "" || offset < 0 || length <= 0) {
+        std::cerr << "punch: cannot punch, give a file, an offset and a length\n";
+        return FAILURE;
+    }
+    CachedINode* file = get(pathname);
+    if (!file) {
+        std::cerr << "punch: cannot punch, " << pathname << " not found\n";
+        return FAILURE;
+    }
+    if (!S_ISREG(file->inode.i_mode)) {
+        std::cerr << "punch: cannot punch, " << pathname << " is not a regular file\n";
+        file->put();
+        return FAILURE;
+    }
+    if (!file->device->writable("punch")) {
+        file->put();
+        return FAILURE;
+    }
+
+    long end = std::min(offset + length, (long)file->inode.i_size);
+    long firstFull = (offset + BLOCK_SIZE - 1) / BLOCK_SIZE; // the whole blocks in the range
+    long endFull = end / BLOCK_SIZE;
+    int freeBefore = file->device->nbfree;
+    if (firstFull < endFull && file->release_blocks(firstFull, endFull) != SUCCESS) {
+        std::cerr << "punch: cannot punch " << pathname << "\n";
+        file->put();
+        return FAILURE;
+    }
+
+    // zero part of a block, within a single block; a hole is already zeros
+    auto zero = [file](long from, long to) {
+        int blockNum = file->logical2physical(from / BLOCK_SIZE);
+        if (from >= to || !blockNum)
+            return;
+        DataBlock block(file->device);
+        block.get(blockNum);
+        memset(&block.buffer[from % BLOCK_SIZE], 0, to - from);
+        block.put();
+    };
+    if (firstFull > endFull) // the range is inside one block
+        zero(offset, end);
+    else {
+        zero(offset, firstFull * BLOCK_SIZE);
+        zero(endFull * BLOCK_SIZE, end);
+    }
+    file->inode.i_ctime = file->inode.i_mtime = time(0L);
+    file->isDirty = true;
+    printf("punch: released %d blocks from %s\n", file->device->nbfree - freeBefore, pathname.c_str());
+    file->put();
+    return SUCCESS;
+}
+
+// total the disk usage of a directory tree, counting each hard-linked file only once
+int INodeTable::du(const std::string& pathname) {
+    std::string startPath = (pathname == "") ? "." : pathname;
+    CachedINode* start = get(startPath);
+    if (!start) {
+        std::cerr << "du: cannot total usage, " << startPath << " not found\n";
+        return FAILURE;
+    }
+
+    struct alignas(64) Totals { // one per worker, on separate cache lines so the workers don't slow each other down
+        long blocks = 0;
+        long bytes = 0;
+        long files = 0;
+        long dirs = 0;
+    };
+    TreeWalker walker;
+    std::vector<Totals> totals(walker.numWorkers);
+    std::mutex linksLock;
+    std::set<std::pair<MountedDevice*, int>> linked; // hard-linked files that have already been counted
+
+    walker.walk(start, startPath, [&](int worker, const TreeEntry& entry) {
+        CachedINode file = entry.file;
+        if (!S_ISDIR(file.inode.i_mode) && file.inode.i_links_count > 1) {
+            std::lock_guard<std::mutex> guard(linksLock);
+            if (!linked.insert({ file.device, file.inodeNum }).second)
+                return;
+        }
+        Totals& t = totals[worker];
+        file.for_each_block([&](int, bool) { t.blocks++; });
+        t.bytes += file.inode.i_size;
+        if (S_ISDIR(file.inode.i_mode))
+            t.dirs++;
+        else
+            t.files++;
+    });
+    start->put();
+
+    Totals sum;
+    for (const Totals& t : totals) {
+        sum.blocks += t.blocks;
+        sum.bytes += t.bytes;
+        sum.files += t.files;
+        sum.dirs += t.dirs;
+    }
+    printf("%ld blocks, %ld bytes in %ld files and %ld directories: %s\n",
+        sum.blocks, sum.bytes, sum.files, sum.dirs, startPath.c_str());
+    return SUCCESS;
+}
+
+// list the files in a directory tree that match the given predicates, e.g., find /dir -name *.txt -type f -size +1k
+// input[1] is the starting pathname (optional), followed by any number of the -name, -type, and -size predicates
+int INodeTable::find(const std::vector<std::string>& input) {
+    std::string startPath = ".";
+    std::string namePattern; // shell-style wildcard pattern for the file's name
+    char type = 0; // f for regular files, d for directories, l for symbolic links
+    char sizeCompare = 0; // + for larger than, - for smaller than, or 0 for exactly
+    long size = -1; // size in bytes, or -1 to match any size
+
+    size_t i = 1;
+    if (i < input.size() && input[i] != "" && input[i][0] != '-')
+        startPath = input[i++];
+    for (; i < input.size(); i++) {
+        if (input[i] == "") continue; // skip the padding added to short commands
+        if (i + 1 == input.size() || input[i + 1] == "") {
+            std::cerr << "find: missing argument for " << input[i] << "\n";
+            return FAILURE;
+        }
+        const std::string& arg = input[++i];
+        if (input[i - 1] == "-name") {
+            namePattern = arg;
+        } else if (input[i - 1] == "-type" && (arg == "f" || arg == "d" || arg == "l")) {
+            type = arg[0];
+        } else if (input[i - 1] == "-size") {
+            char* suffix;
+            sizeCompare = (arg[0] == '+' || arg[0] == '-') ? arg[0] : 0;
+            size = strtol(arg.c_str() + (sizeCompare ? 1 : 0), &suffix, 10);
+            if (*suffix == 'k')
+                size *= 1024;
+            else if (*suffix == 'M')
+                size *= 1024 * 1024;
+            else if (*suffix != '\0' && *suffix != 'c') {
+                std::cerr << "find: invalid size " << arg << "\n";
+                return FAILURE;
+            }
+        } else {
+            std::cerr << "find: invalid predicate " << input[i - 1] << " " << arg << "\n";
+            return FAILURE;
+        }
+    }
+
+    CachedINode* start = get(startPath);
+    if (!start) {
+        std::cerr << "find: cannot search, " << startPath << " not found\n";
+        return FAILURE;
+    }
+
+    TreeWalker walker;
+    std::vector<std::vector<std::string>> matches(walker.numWorkers); // each worker collects its own matches
+    walker.walk(start, startPath, [&](int worker, const TreeEntry& entry) {
+        const INode& inode = entry.file.inode;
+        if (type == 'f' && !S_ISREG(inode.i_mode)) return;
+        if (type == 'd' && !S_ISDIR(inode.i_mode)) return;
+        if (type == 'l' && !S_ISLNK(inode.i_mode)) return;
+        if (size >= 0) {
+            long fileSize = inode.i_size;
+            if (sizeCompare == '+' && fileSize <= size) return;
+            if (sizeCompare == '-' && fileSize >= size) return;
+            if (sizeCompare == 0 && fileSize != size) return;
+        }
+        if (namePattern != "") {
+            std::string name(PathComponents(entry.path).child);
+            if (fnmatch(namePattern.c_str(), name.c_str(), 0) != 0) return;
+        }
+        matches[worker].push_back(entry.path);
+    });
+    start->put();
+
+    // the workers finish in no particular order, so sort the results to make the output repeatable
+    std::vector<std::string> results;
+    for (std::vector<std::string>& m : matches)
+        results.insert(results.end(), m.begin(), m.end());
+    std::sort(results.begin(), results.end());
+    for (const std::string& path : results)
+        std::cout << path << "\n";
+    return SUCCESS;
+}
+
 // allocate and initialize an inode for a new file and return its number, or 0 if error
 int INodeTable::create_file_inode(CachedINode* parent) {
     int inodeNum = parent->device->allocate(INODE);
+    if (!inodeNum)
+        return 0;
     TRACE(1, "inode #%d\n", inodeNum);
     CachedINode* file = get(parent->device, inodeNum);
     file->create_file_inode();
@@ -594,7 +993,13 @@ int INodeTable::create_file_inode(CachedINode* parent) {
 // allocate and initialize an inode for a new directory and return its number, or 0 if error
 int INodeTable::make_dir_inode(CachedINode* parent) {
     int inodeNum = parent->device->allocate(INODE);
+    if (!inodeNum)
+        return 0;
     int blockNum = parent->device->allocate(BLOCK);
+    if (!blockNum) {
+        parent->device->deallocate(INODE, inodeNum);
+        return 0;
+    }
     TRACE(1, "inode #%d, block #%d\n", inodeNum, blockNum);
 
     CachedINode* dir = get(parent->device, inodeNum);
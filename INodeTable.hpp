@@ -1,18 +1,37 @@
 #pragma once
 #include "CachedINode.hpp"
+#include "Status.hpp"
+#include <deque>
+#include <unordered_map>
 class MountedDevice;
 
-// a fixed-size table of cached inodes
+// a table of cached inodes, which grows when every entry is in use; a hash index finds the entry holding an inode,
+// and a list of the free entries finds one to reuse, so neither needs a scan of the table
 class INodeTable {
 private:
-    CachedINode inodes[INODE_TABLE_SIZE]; // table of inodes cached in memory
+    struct Key { // names a cached inode
+        MountedDevice* device;
+        int inodeNum;
+        bool operator==(const Key& other) const { return device == other.device && inodeNum == other.inodeNum; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const { return std::hash<MountedDevice*>()(key.device) * 31 + key.inodeNum; }
+    };
+    std::deque<CachedINode> inodes = std::deque<CachedINode>(INODE_TABLE_SIZE); // table of inodes cached in memory; growing a deque leaves the entries where they are
+    std::unordered_map<Key, CachedINode*, KeyHash> index; // the entry last given to each inode, which still has it if it's held
+    std::vector<CachedINode*> freeEntries; // entries that held no inode when listed; one that's been reused since is skipped
 
 public:
+    INodeTable(); // list every entry as free
     CachedINode* get(MountedDevice* device, int inodeNum); // return a cached inode from the table for a given device and inode number
-    CachedINode* get(const std::string& pathname); // return a cached inode from the table for a given file or directory
+    CachedINode* get(std::string_view pathname); // return a cached inode from the table for a given file or directory
+    void read_inodes(MountedDevice* device, std::vector<CachedINode>& files); // fill in private copies of many inodes, reading each inode table block once
     bool device_busy(MountedDevice* device); // check whether a given device is being used by any of the currently cached inodes
     void display(); // display all the currently cached inodes
     void flush(); // clear the cached inode table, writing back any modified entries
+    void sync(MountedDevice* device = nullptr, bool lazy = true); // write back all modified entries (on one device or all), keeping them cached
+    void reload(MountedDevice* device); // re-read the cached inodes of a device whose inode table was changed directly
+    void release(CachedINode* c); // list an entry as free, if it no longer holds an inode
 
     int ls(const std::string& pathname); // list the contents of a directory or display a file's attributes
     int creat(const std::string& pathname); // create a new file and return its inode number, or 0 if error
@@ -20,14 +39,25 @@ public:
     int rmdir(const std::string& pathname); // remove a directory
     int link(const std::string& srcName, const std::string& dstName, bool isMoving = false); // link a new file name to an existing file
     int unlink(const std::string& pathname, bool isMoving = false); // remove a reference to an inode; delete the file
+    Status create(const std::string& pathname, bool isDir, int* inodeNum); // create a new file or directory, without any messages
+    Status remove(const std::string& pathname, bool isDir, bool isMoving = false); // remove a directory or a link to a file, without any messages
     int symlink(const std::string& srcName, const std::string& dstName); // create an inode that stores the path to a different file/directory
     int stat(const std::string& pathname); // display basic information about a file
     int chmod(const std::string& mode, const std::string& pathname); // change a file's mode (permissions)
     int utime(const std::string& pathname); // update the file's access and inode change times
     int cp(const std::string& srcName, const std::string& dstName); // copy a file
     int mv(const std::string& srcName, const std::string& dstName); // move/rename a file
+    int import(const std::string& hostDir, const std::string& pathname); // copy a host directory tree into the file system
+    int export_tree(const std::string& pathname, const std::string& target); // copy a file system tree to a host directory or tar stream
+    int compact(const std::string& pathname); // repack a directory's entries into as few blocks as possible
+    int fallocate(const std::string& pathname, long offset, long length); // allocate a file's blocks ahead of writing them
+    int punch(const std::string& pathname, long offset, long length); // release the blocks in a byte range of a file, leaving a hole
+    int du(const std::string& pathname); // total the disk usage of a directory tree
+    int find(const std::vector<std::string>& input); // list the files in a directory tree that match the given predicates
 
 private:
+    CachedINode* take_free(); // take a free entry, writing back unused ones or growing the table if there's none
+    void write_back(std::vector<CachedINode*>& dirty); // write back modified inodes, one inode table block at a time
     int create_file_inode(CachedINode* parent); // allocate and initialize an inode for a new file
     int make_dir_inode(CachedINode* parent); // allocate and initialize an inode for a new directory
 };
@@ -0,0 +1,282 @@
+#include "Importer.hpp"
+#include "FileSystem.hpp"
+#include <dirent.h>
+
+// import a host directory as an image directory; the image directory is created if it doesn't exist
+Importer::Importer(const std::string& hostDir, const std::string& imagePath)
+    : hostDir(hostDir)
+    , imagePath(imagePath)
+    , nextToRead(0) {
+}
+
+// import the whole tree; returns SUCCESS if everything was imported
+int Importer::run() {
+    HostFile root;
+    root.hostPath = hostDir;
+    root.imagePath = imagePath;
+    if (lstat(hostDir.c_str(), &root.status) < 0 || !S_ISDIR(root.status.st_mode)) {
+        std::cerr << "import: cannot import, " << hostDir << " is not a host directory\n";
+        return FAILURE;
+    }
+    files.push_back(root);
+    scan(hostDir, imagePath);
+
+    fs->mountTable.batch(true); // the bitmaps and free counts are written once, at the end
+    std::vector<std::thread> readers;
+    int numReaders = std::max(1, (int)std::thread::hardware_concurrency());
+    for (int i = 0; i < numReaders; i++)
+        readers.emplace_back(&Importer::read_files, this);
+
+    for (size_t i = 0; i < files.size(); i++) {
+        HostFile& file = files[i];
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            fileRead.wait(guard, [&] { return file.ready; });
+        }
+        import_file(file);
+        std::vector<char>().swap(file.data); // release the file's contents
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            nextToWrite = i + 1;
+        }
+        windowMoved.notify_all();
+    }
+    for (std::thread& t : readers)
+        t.join();
+
+    // the directories' own attributes come last, since creating their contents changed their times
+    for (auto file = files.rbegin(); file != files.rend(); file++) {
+        if (!S_ISDIR(file->status.st_mode) || file->failed)
+            continue;
+        CachedINode* dir = fs->inodeTable.get(file->imagePath);
+        if (!dir)
+            continue;
+        dir->inode.i_mode = (dir->inode.i_mode & S_IFMT) | (file->status.st_mode & 07777);
+        dir->inode.i_atime = file->status.st_atime;
+        dir->inode.i_mtime = file->status.st_mtime;
+        dir->isDirty = true;
+        dir->put();
+    }
+    fs->mountTable.batch(false);
+
+    printf("import: %d files (%ld bytes) and %d directories imported into %s", numFiles, bytes, numDirs, imagePath.c_str());
+    if (numFailed)
+        printf(", %d could not be imported", numFailed);
+    printf("\n");
+    return numFailed ? FAILURE : SUCCESS;
+}
+
+// list a host directory's contents, recursively, in name order; only regular files and directories are imported
+void Importer::scan(const std::string& hostPath, const std::string& imagePath) {
+    DIR* dir = opendir(hostPath.c_str());
+    if (!dir) {
+        std::cerr << "import: cannot read host directory " << hostPath << "\n";
+        numFailed++;
+        return;
+    }
+    std::vector<std::string> names;
+    while (struct dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..")
+            names.push_back(name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+
+    for (const std::string& name : names) {
+        HostFile file;
+        file.hostPath = hostPath + "/" + name;
+        file.imagePath = (imagePath == "/" ? "" : imagePath) + "/" + name;
+        if (lstat(file.hostPath.c_str(), &file.status) < 0)
+            continue;
+        if (name.length() > EXT2_NAME_LEN) {
+            std::cerr << "import: skipping " << file.hostPath << ", its name is too long\n";
+            numFailed++;
+        } else if (S_ISREG(file.status.st_mode)) {
+            files.push_back(file);
+        } else if (S_ISDIR(file.status.st_mode)) {
+            files.push_back(file);
+            scan(file.hostPath, file.imagePath);
+        } else {
+            std::cerr << "import: skipping " << file.hostPath << ", only regular files and directories are imported\n";
+        }
+    }
+}
+
+// a reader thread's loop: take the next host file, wait until it's within the window, and read it if it's small
+void Importer::read_files() {
+    for (size_t i = nextToRead++; i < files.size(); i = nextToRead++) {
+        HostFile& file = files[i];
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            windowMoved.wait(guard, [&] { return i < nextToWrite + IMPORT_WINDOW; });
+        }
+        size_t numBlocks = (file.status.st_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (S_ISREG(file.status.st_mode) && numBlocks > 0 && numBlocks <= IMPORT_CHUNK_BLOCKS) { // larger files are streamed
+            file.data.assign(numBlocks * BLOCK_SIZE, 0);
+            int fd = open(file.hostPath.c_str(), O_RDONLY);
+            if (fd < 0 || pread(fd, file.data.data(), file.status.st_size, 0) != file.status.st_size)
+                file.failed = true;
+            if (fd >= 0)
+                close(fd);
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            file.ready = true;
+        }
+        fileRead.notify_all();
+    }
+}
+
+// create a file or directory in the image and, for a file, write its contents and attributes
+void Importer::import_file(HostFile& file) {
+    if (S_ISDIR(file.status.st_mode)) {
+        CachedINode* existing = fs->inodeTable.get(file.imagePath);
+        if (existing) { // importing into an existing directory is fine
+            bool isDir = S_ISDIR(existing->inode.i_mode);
+            existing->put();
+            if (isDir)
+                return;
+            std::cerr << "import: cannot import directory " << file.hostPath << ", " << file.imagePath << " is not a directory\n";
+        } else if (fs->inodeTable.mkdir(file.imagePath)) {
+            numDirs++;
+            return;
+        }
+        file.failed = true;
+        numFailed++;
+        return;
+    }
+
+    if (file.failed) {
+        std::cerr << "import: cannot read host file " << file.hostPath << "\n";
+        numFailed++;
+        return;
+    }
+    if (!fs->inodeTable.creat(file.imagePath)) {
+        numFailed++;
+        return;
+    }
+    CachedINode* created = fs->inodeTable.get(file.imagePath);
+    if (write_data(created, file) != SUCCESS) {
+        numFailed++;
+        created->put();
+        return;
+    }
+    created->inode.i_size = file.status.st_size;
+    created->inode.i_mode = S_IFREG | (file.status.st_mode & 07777);
+    created->inode.i_atime = file.status.st_atime;
+    created->inode.i_mtime = file.status.st_mtime;
+    created->inode.i_ctime = time(0L);
+    created->isDirty = true;
+    created->put();
+    numFiles++;
+    bytes += file.status.st_size;
+}
+
+// allocate a file's blocks, along with the indirect blocks that map them, in as few contiguous runs as possible,
+// laid out in the order they're read; then write each run a chunk at a time, filling each chunk from the small file's
+// contents or, for a larger file, straight from the host file; the inode only maps the blocks once they're all written
+int Importer::write_data(CachedINode* file, const HostFile& host) {
+    const int numBlocks = (host.status.st_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    const int singleLimit = EXT2_NDIR_BLOCKS + BLOCKNUMS_PER_BLOCK; // blocks mappable without double-indirect blocks
+    if (numBlocks > singleLimit + BLOCKNUMS_PER_BLOCK * BLOCKNUMS_PER_BLOCK) {
+        std::cerr << "import: cannot import " << numBlocks << " blocks, the file is too large\n";
+        return FAILURE;
+    }
+    int numIndirect = 0;
+    if (numBlocks > EXT2_NDIR_BLOCKS)
+        numIndirect++;
+    if (numBlocks > singleLimit)
+        numIndirect += 1 + (numBlocks - singleLimit + BLOCKNUMS_PER_BLOCK - 1) / BLOCKNUMS_PER_BLOCK;
+    const int total = numBlocks + numIndirect;
+
+    MountedDevice* device = file->device;
+    std::vector<int> blocks; // where each of the file's blocks goes, in layout order
+    auto release = [&]() {
+        for (int blockNum : blocks)
+            device->deallocate(BLOCK, blockNum);
+    };
+    while ((int)blocks.size() < total) {
+        int got;
+        int start = device->allocate_run(total - blocks.size(), &got);
+        if (!start) {
+            std::cerr << "import: cannot import, device is full\n";
+            release();
+            return FAILURE;
+        }
+        for (int i = 0; i < got; i++)
+            blocks.push_back(start + i);
+    }
+
+    std::vector<int> source(total); // what goes at each position in the layout: a logical block, or -1 - n for index block n
+    std::vector<char> index((size_t)numIndirect * BLOCK_SIZE, 0); // the contents of the index blocks
+    int next = 0; // the next position in the layout
+    int numIndex = 0; // the next index block
+    auto place = [&](int logicalBlockNum) {
+        source[next] = logicalBlockNum;
+        return blocks[next++];
+    };
+    auto placeIndex = [&]() { // an index block; returns its block numbers to fill in
+        source[next++] = -1 - numIndex;
+        return (int*)&index[(size_t)numIndex++ * BLOCK_SIZE];
+    };
+    auto placeIndirect = [&](int first, int last) { // an indirect block, followed by the data blocks it maps
+        int position = next;
+        int* nums = placeIndex();
+        for (int i = first; i < last; i++)
+            nums[i - first] = place(i);
+        return blocks[position];
+    };
+
+    __u32 iBlock[EXT2_N_BLOCKS] = {}; // the inode's block map, filled in once the blocks are written
+    for (int i = 0; i < std::min(numBlocks, EXT2_NDIR_BLOCKS); i++)
+        iBlock[i] = place(i);
+    if (numBlocks > EXT2_NDIR_BLOCKS)
+        iBlock[EXT2_IND_BLOCK] = placeIndirect(EXT2_NDIR_BLOCKS, std::min(numBlocks, singleLimit));
+    if (numBlocks > singleLimit) {
+        iBlock[EXT2_DIND_BLOCK] = blocks[next];
+        int* nums = placeIndex();
+        for (int first = singleLimit, i = 0; first < numBlocks; first += BLOCKNUMS_PER_BLOCK, i++)
+            nums[i] = placeIndirect(first, std::min(numBlocks, first + BLOCKNUMS_PER_BLOCK));
+    }
+
+    int fd = -1;
+    if (total && host.data.empty() && (fd = open(host.hostPath.c_str(), O_RDONLY)) < 0) {
+        std::cerr << "import: cannot read host file " << host.hostPath << "\n";
+        release();
+        return FAILURE;
+    }
+    std::vector<char> chunk;
+    for (int start = 0, end; start < total; start = end) { // write each run of consecutive blocks, a chunk at a time
+        for (end = start + 1; end < total && end - start < IMPORT_CHUNK_BLOCKS && blocks[end] == blocks[end - 1] + 1; end++)
+            ;
+        chunk.assign((size_t)(end - start) * BLOCK_SIZE, 0);
+        for (int position = start, last; position < end; position = last) {
+            char* to = &chunk[(size_t)(position - start) * BLOCK_SIZE];
+            last = position + 1;
+            if (source[position] < 0) {
+                memcpy(to, &index[(size_t)(-1 - source[position]) * BLOCK_SIZE], BLOCK_SIZE);
+                continue;
+            }
+            while (last < end && source[last] == source[last - 1] + 1)
+                last++; // data blocks that follow each other in the file are read together
+            off_t offset = (off_t)source[position] * BLOCK_SIZE;
+            size_t size = std::min((off_t)(last - position) * BLOCK_SIZE, host.status.st_size - offset);
+            if (fd < 0) {
+                memcpy(to, &host.data[offset], size);
+            } else if (pread(fd, to, size, offset) != (ssize_t)size) {
+                std::cerr << "import: cannot read host file " << host.hostPath << "\n";
+                close(fd);
+                release();
+                return FAILURE;
+            }
+        }
+        device->write_blocks(blocks[start], end - start, chunk.data());
+    }
+    if (fd >= 0)
+        close(fd);
+
+    memcpy(file->inode.i_block, iBlock, sizeof(iBlock));
+    file->inode.i_blocks = (__u32)total * (BLOCK_SIZE / 512);
+    return SUCCESS;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "main.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+class CachedINode;
+
+#define IMPORT_WINDOW 32 // how many files the readers may get ahead of the file being written into the image
+#define IMPORT_CHUNK_BLOCKS 256 // the most blocks of a file held in memory at once; larger files are read a chunk at a time
+
+// copies a tree of host files and directories into the simulated file system
+// a pool of threads reads the small host files, up to a window ahead of the file being written, while the calling
+// thread creates each file and writes all its blocks, allocated in contiguous runs, a chunk at a time; it reads a
+// larger file's chunks from the host itself as it goes, so no file is ever held in memory whole
+class Importer {
+public:
+    Importer(const std::string& hostDir, const std::string& imagePath); // import a host directory as an image directory
+    int run(); // import the whole tree; returns SUCCESS if everything was imported
+
+private:
+    class HostFile { // a host file or directory to be imported
+    public:
+        std::string hostPath;
+        std::string imagePath;
+        struct stat status; // the host file's mode, size and times
+        std::vector<char> data; // a small file's contents, padded to whole blocks, once it has been read; empty for a larger one
+        bool ready = false; // has it been read?
+        bool failed = false; // couldn't it be read?
+    };
+
+    std::string hostDir;
+    std::string imagePath;
+    std::vector<HostFile> files; // everything to be imported, each directory before its contents
+    std::mutex lock;
+    std::condition_variable fileRead; // signaled when a reader finishes a file
+    std::condition_variable windowMoved; // signaled when the writer finishes a file
+    std::atomic<size_t> nextToRead; // the next file for a reader to take
+    size_t nextToWrite = 0; // the file being written, which bounds the readers' window
+    long bytes = 0; // number of bytes imported
+    int numFiles = 0; // number of files imported
+    int numDirs = 0; // number of directories imported
+    int numFailed = 0; // number of files or directories that couldn't be imported
+
+    void scan(const std::string& hostPath, const std::string& imagePath); // list a host directory's contents, recursively
+    void read_files(); // a reader thread's loop: read host files until there are none left
+    void import_file(HostFile& file); // create a file in the image and write its contents
+    int write_data(CachedINode* file, const HostFile& host); // allocate and write a file's blocks
+};
@@ -0,0 +1,296 @@
+#include "Journal.hpp"
+#include "MountedDevice.hpp"
+
+// a journal for a device; it's not used until it's opened
+Journal::Journal(MountedDevice* device)
+    : device(device) {
+}
+
+// close the journal
+Journal::~Journal() {
+    close();
+}
+
+// the name of a disk image's (or overlay's) journal file
+std::string Journal::filename(const std::string& diskImage) {
+    return diskImage + ".journal";
+}
+
+// open (or create) the journal file, replaying any transactions left in it, and start the background thread
+int Journal::open(bool create) {
+    path = device->journal_path();
+    if ((fd = ::open(path.c_str(), O_RDWR | (create ? O_CREAT : 0), 0644)) < 0) {
+        std::cerr << "journal: cannot open " << path << "\n";
+        return FAILURE;
+    }
+
+    struct stat status;
+    fstat(fd, &status);
+    if (status.st_size != 0) {
+        JournalHeader header;
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != JOURNAL_MAGIC) {
+            std::cerr << "journal: " << path << " is not a journal file\n";
+            ::close(fd);
+            fd = -1;
+            return FAILURE;
+        }
+        nextSeq = header.startSeq;
+        int replayed = replay();
+        if (replayed)
+            printf("journal: replayed %d transactions from %s\n", replayed, path.c_str());
+    }
+
+    // start over with an empty journal
+    write_header(nextSeq, 1);
+    ftruncate(fd, BLOCK_SIZE);
+    tail = 1;
+    journaledSeq = nextSeq - 1;
+    stopping = false;
+    background = std::thread(&Journal::run_background, this);
+    return SUCCESS;
+}
+
+// write everything to its home location and stop the background thread
+void Journal::close() {
+    if (fd == -1)
+        return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wakeup.notify_one();
+    background.join();
+    sync();
+    ::close(fd);
+    fd = -1;
+}
+
+// copy a block's latest contents into a buffer if they haven't reached the block's home location yet
+bool Journal::read(int blockNum, char* buffer) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto written = running.find(blockNum);
+    if (written != running.end()) {
+        memcpy(buffer, written->second.data(), BLOCK_SIZE);
+        return true;
+    }
+    auto cached = cache.find(blockNum);
+    if (cached != cache.end()) {
+        memcpy(buffer, cached->second.data.data(), BLOCK_SIZE);
+        return true;
+    }
+    return false;
+}
+
+// add a run of blocks to the running transaction; writing the same block again just replaces its contents
+// data goes straight to the device instead, unless a block is still in the journal from when it held metadata, in
+// which case it's journaled too, or else a checkpoint or replay of the older contents could overwrite it
+void Journal::write(int blockNum, int count, const char* buffer, bool metadata) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!metadata) {
+        bool pending = false;
+        for (int i = 0; i < count && !pending; i++)
+            pending = running.count(blockNum + i) || cache.count(blockNum + i);
+        if (!pending) {
+            device->write_disk(blockNum, buffer, count);
+            unflushedData = true;
+            return;
+        }
+    }
+    for (int i = 0; i < count; i++)
+        memcpy(running[blockNum + i].data(), buffer + i * BLOCK_SIZE, BLOCK_SIZE);
+}
+
+// end the running transaction; it reaches the journal with the next group write
+void Journal::commit() {
+    std::lock_guard<std::mutex> guard(lock);
+    if (running.empty())
+        return;
+    Transaction transaction;
+    transaction.seq = nextSeq++;
+    transaction.blocks.swap(running);
+    for (const auto& [blockNum, data] : transaction.blocks) {
+        CachedBlock& cached = cache[blockNum];
+        cached.data = data;
+        cached.seq = transaction.seq;
+    }
+    TRACE(2, "committed transaction %u of %d blocks on device %d\n", transaction.seq, (int)transaction.blocks.size(), device->fd);
+    committed.push_back(std::move(transaction));
+    if (committed.size() >= GROUP_COMMIT_SIZE)
+        write_committed();
+}
+
+// write every committed transaction to the journal and every journaled block to its home location
+void Journal::sync() {
+    commit();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        write_committed();
+    }
+    checkpoint();
+}
+
+// the background thread's loop: write the committed transactions every so often, and checkpoint when the journal
+// is getting large or when no new transactions arrived since the last time around
+void Journal::run_background() {
+    std::unique_lock<std::mutex> guard(lock);
+    __u32 lastSeq = nextSeq;
+    while (!stopping) {
+        wakeup.wait_for(guard, std::chrono::milliseconds(COMMIT_INTERVAL_MS));
+        if (stopping)
+            break;
+        write_committed();
+        bool idle = (nextSeq == lastSeq);
+        lastSeq = nextSeq;
+        if (!journaled.empty() && (idle || journaled.size() >= CHECKPOINT_THRESHOLD)) {
+            guard.unlock();
+            checkpoint();
+            guard.lock();
+        }
+    }
+}
+
+// write all the committed transactions to the end of the journal with a single write, then flush it once;
+// each transaction is a descriptor listing its blocks, the blocks themselves, and a commit block with a checksum;
+// the data the transactions' metadata points to is flushed to the device first
+void Journal::write_committed() {
+    if (committed.empty())
+        return;
+    if (unflushedData) {
+        device->flush();
+        unflushedData = false;
+    }
+    std::vector<char> buffer;
+    for (const Transaction& transaction : committed) {
+        int count = transaction.blocks.size();
+        int descriptorBlocks = (sizeof(JournalDescriptor) + count * sizeof(__u32) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        size_t start = buffer.size();
+        buffer.resize(start + (size_t)(descriptorBlocks + count + 1) * BLOCK_SIZE);
+        char* record = buffer.data() + start;
+
+        JournalDescriptor* descriptor = (JournalDescriptor*)record;
+        descriptor->magic = JOURNAL_DESCRIPTOR_MAGIC;
+        descriptor->seq = transaction.seq;
+        descriptor->count = count;
+        int i = 0;
+        for (const auto& [blockNum, data] : transaction.blocks) {
+            descriptor->blockNums[i] = blockNum;
+            memcpy(record + (descriptorBlocks + i) * BLOCK_SIZE, data.data(), BLOCK_SIZE);
+            i++;
+        }
+        JournalCommit* commitBlock = (JournalCommit*)(record + (descriptorBlocks + count) * BLOCK_SIZE);
+        commitBlock->magic = JOURNAL_COMMIT_MAGIC;
+        commitBlock->seq = transaction.seq;
+        commitBlock->checksum = checksum(record, (size_t)(descriptorBlocks + count) * BLOCK_SIZE);
+    }
+    pwrite(fd, buffer.data(), buffer.size(), (long)tail * BLOCK_SIZE);
+    fdatasync(fd);
+    TRACE(1, "wrote %d transactions (%d blocks) to %s\n", (int)committed.size(), (int)(buffer.size() / BLOCK_SIZE), path.c_str());
+
+    tail += buffer.size() / BLOCK_SIZE;
+    journaledSeq = committed.back().seq; // only now may these blocks be written to their home locations
+    for (const Transaction& transaction : committed) {
+        for (const auto& [blockNum, data] : transaction.blocks)
+            journaled[blockNum] = CachedBlock{ data, transaction.seq };
+    }
+    committed.clear();
+}
+
+// write the journaled blocks to their home locations, in block order, and release their space in the journal; each
+// block's latest journaled contents are written, even when a later transaction that's not journaled yet changed it
+// again, so every journaled transaction is complete at home before the header moves past it
+void Journal::checkpoint() {
+    std::lock_guard<std::mutex> onlyOne(checkpointing);
+    std::vector<std::pair<int, CachedBlock>> blocks;
+    int checkpointTail;
+    __u32 checkpointSeq;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        blocks.assign(journaled.begin(), journaled.end());
+        checkpointTail = tail;
+        checkpointSeq = journaledSeq;
+    }
+    if (blocks.empty())
+        return;
+
+    for (const auto& [blockNum, cached] : blocks) // the device is used as usual meanwhile; these copies aren't going away
+        device->write_disk(blockNum, cached.data.data());
+    device->flush();
+    TRACE(1, "checkpointed %d blocks through transaction %u on device %d\n", (int)blocks.size(), checkpointSeq, device->fd);
+
+    std::lock_guard<std::mutex> guard(lock);
+    for (const auto& [blockNum, cached] : blocks) {
+        auto current = journaled.find(blockNum);
+        if (current != journaled.end() && current->second.seq == cached.seq) // unless a later group write journaled it again
+            journaled.erase(current);
+        current = cache.find(blockNum);
+        if (current != cache.end() && current->second.seq == cached.seq) // unless a later transaction changed it again
+            cache.erase(current);
+    }
+    if (tail == checkpointTail) { // nothing was journaled meanwhile, so the journal can start over
+        write_header(checkpointSeq + 1, 1);
+        ftruncate(fd, BLOCK_SIZE);
+        tail = 1;
+    } else
+        write_header(checkpointSeq + 1, checkpointTail);
+}
+
+// rewrite the journal's header block and flush it
+void Journal::write_header(__u32 startSeq, int startBlock) {
+    Block block = {};
+    JournalHeader* header = (JournalHeader*)block.data();
+    header->magic = JOURNAL_MAGIC;
+    header->startSeq = startSeq;
+    header->startBlock = startBlock;
+    pwrite(fd, block.data(), BLOCK_SIZE, 0);
+    fdatasync(fd);
+}
+
+// write the complete transactions in the journal to the device, stopping at the first one that's incomplete
+// or out of sequence; returns the number of transactions replayed
+int Journal::replay() {
+    JournalHeader header;
+    pread(fd, &header, sizeof(header), 0);
+    struct stat status;
+    fstat(fd, &status);
+    long journalBlocks = status.st_size / BLOCK_SIZE;
+
+    int replayed = 0;
+    long position = header.startBlock;
+    for (__u32 seq = header.startSeq;; seq++) {
+        Block first;
+        if (pread(fd, first.data(), BLOCK_SIZE, position * BLOCK_SIZE) != BLOCK_SIZE)
+            break;
+        JournalDescriptor* descriptor = (JournalDescriptor*)first.data();
+        if (descriptor->magic != JOURNAL_DESCRIPTOR_MAGIC || descriptor->seq != seq)
+            break;
+        long count = descriptor->count;
+        long descriptorBlocks = (sizeof(JournalDescriptor) + count * sizeof(__u32) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (position + descriptorBlocks + count + 1 > journalBlocks)
+            break; // the transaction was cut short
+
+        std::vector<char> record((descriptorBlocks + count + 1) * BLOCK_SIZE);
+        pread(fd, record.data(), record.size(), position * BLOCK_SIZE);
+        descriptor = (JournalDescriptor*)record.data();
+        JournalCommit* commitBlock = (JournalCommit*)(record.data() + (descriptorBlocks + count) * BLOCK_SIZE);
+        if (commitBlock->magic != JOURNAL_COMMIT_MAGIC || commitBlock->seq != seq
+            || commitBlock->checksum != checksum(record.data(), (descriptorBlocks + count) * BLOCK_SIZE))
+            break;
+
+        for (long i = 0; i < count; i++)
+            device->write_disk(descriptor->blockNums[i], record.data() + (descriptorBlocks + i) * BLOCK_SIZE);
+        TRACE(1, "replayed transaction %u of %ld blocks from %s\n", seq, count, path.c_str());
+        position += descriptorBlocks + count + 1;
+        nextSeq = seq + 1;
+        replayed++;
+    }
+    if (replayed)
+        device->flush();
+    return replayed;
+}
+
+// FNV-1a hash of the given data
+__u32 Journal::checksum(const char* data, size_t size, __u32 hash) {
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+    return hash;
+}
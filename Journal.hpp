@@ -0,0 +1,93 @@
+#pragma once
+#include "main.hpp"
+#include <array>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+class MountedDevice;
+
+#define JOURNAL_MAGIC 0x4a524e4c // "JRNL", starts the journal's header block
+#define JOURNAL_DESCRIPTOR_MAGIC 0x4a445343 // "JDSC", starts the block list of a transaction
+#define JOURNAL_COMMIT_MAGIC 0x4a434d54 // "JCMT", ends a transaction
+#define GROUP_COMMIT_SIZE 16 // number of committed transactions that forces a journal write
+#define COMMIT_INTERVAL_MS 200 // how often the background thread writes the committed transactions to the journal
+#define CHECKPOINT_THRESHOLD 1024 // number of journaled blocks that forces a checkpoint
+
+// the first block of the journal file; transactions start at startBlock, numbered from startSeq
+struct JournalHeader {
+    __u32 magic;
+    __u32 startSeq;
+    __u32 startBlock;
+};
+
+// a transaction's block list, which may run over several blocks, followed by its data blocks
+struct JournalDescriptor {
+    __u32 magic;
+    __u32 seq;
+    __u32 count; // number of data blocks
+    __u32 blockNums[]; // their home locations on the device
+};
+
+// the block after a transaction's data; the transaction is only replayed if its checksum matches
+struct JournalCommit {
+    __u32 magic;
+    __u32 seq;
+    __u32 checksum; // covers the descriptor and data blocks
+};
+
+// a write-ahead journal of a device's metadata block writes, kept in a separate file next to its disk image
+// each command's writes form one transaction; committed transactions are written to the journal in groups, with one
+// write and one flush, and a background thread lazily writes the journaled blocks to their home locations
+// file data isn't journaled: it's written straight to the device, which is flushed before the next group write, so the
+// metadata pointing to it never reaches the journal ahead of it (as ext3's ordered mode)
+class Journal {
+public:
+    typedef std::array<char, BLOCK_SIZE> Block;
+
+    Journal(MountedDevice* device); // a journal for a device; it's not used until it's opened
+    ~Journal(); // close the journal
+    static std::string filename(const std::string& diskImage); // the name of a disk image's (or overlay's) journal file
+    int open(bool create); // open (or create) the journal file, replaying any transactions left in it
+    void close(); // write everything to its home location and stop the background thread
+    bool read(int blockNum, char* buffer); // copy a block's latest contents if they aren't on the device yet
+    void write(int blockNum, int count, const char* buffer, bool metadata); // add a run of blocks to the running transaction, or write data home
+    void commit(); // end the running transaction; it reaches the journal with the next group write
+    void sync(); // write every committed transaction to the journal and every journaled block to the device
+
+private:
+    class CachedBlock { // a block whose latest contents haven't been written to its home location yet
+    public:
+        Block data;
+        __u32 seq; // the transaction that wrote these contents
+    };
+    class Transaction {
+    public:
+        __u32 seq;
+        std::map<int, Block> blocks; // block number to contents, sorted so they're written in order
+    };
+
+    MountedDevice* device;
+    std::string path; // the journal file
+    int fd = -1; // file descriptor of the journal file
+    std::mutex lock; // guards everything below; the background thread shares it with the device's users
+    std::map<int, Block> running; // the blocks written by the current command
+    std::vector<Transaction> committed; // transactions waiting for the next group write
+    std::map<int, CachedBlock> cache; // latest contents of every block not yet at its home location
+    std::map<int, CachedBlock> journaled; // latest journaled contents of every block not yet checkpointed
+    __u32 nextSeq = 1; // the number of the next transaction
+    __u32 journaledSeq = 0; // the last transaction written to the journal
+    int tail = 1; // the journal block where the next group write starts
+    bool unflushedData = false; // has data been written to the device since it was last flushed?
+    std::mutex checkpointing; // only one checkpoint runs at a time
+    std::thread background; // writes the journal and checkpoints it
+    std::condition_variable wakeup;
+    bool stopping = false;
+
+    void run_background(); // the background thread's loop
+    void write_committed(); // write all the committed transactions to the journal with one write and one flush; lock held
+    void checkpoint(); // write the journaled blocks to their home locations and release their space in the journal
+    void write_header(__u32 startSeq, int startBlock); // rewrite the journal's header block and flush it
+    int replay(); // write the complete transactions in the journal to the device; returns the number replayed
+    static __u32 checksum(const char* data, size_t size, __u32 hash = 2166136261u); // FNV-1a hash of the given data
+};
@@ -1,7 +1,10 @@
 #include "FileSystem.hpp"
+#include "DeviceCheck.hpp"
+#include "Defragmenter.hpp"
 
 // mount a device into the file system simulation
-CachedINode* MountTable::mount(const std::string& diskImage, const std::string& mountPath) {
+// the options are comma-separated, e.g., overlay to leave the disk image untouched and write to an overlay file instead
+CachedINode* MountTable::mount(const std::string& diskImage, const std::string& mountPath, const std::string& options) {
     CachedINode* mnt = nullptr;
 
     if (diskImage == "") {
@@ -26,7 +29,7 @@ CachedINode* MountTable::mount(const std::string& diskImage, const std::string&
     for (MountedDevice& d : devices) {
         if (d.fd == -1) { // look for a file descriptor of -1, indicating a free entry
             if (mountPath != "/") { // skip checks for root of file system
-                mnt = fs.inodeTable.get(mountPath);
+                mnt = fs->inodeTable.get(mountPath);
                 if (!mnt) {
                     std::cerr << "mount: cannot mount, " << mountPath << " not found\n";
                     return nullptr;
@@ -45,10 +48,11 @@ CachedINode* MountTable::mount(const std::string& diskImage, const std::string&
 
             d.diskImage = diskImage;
             d.mountPath = mountPath;
+            d.options = options;
             if (d.mount() != SUCCESS) {
-                if (mountPath == "/") exit(FAILURE); // terminate simulation if the root device can't be mounted
-                mnt->put();
-                return nullptr; // when attempting to mount other devices, return failure
+                if (mnt)
+                    mnt->put();
+                return nullptr; // the caller decides what to do without a device; without a root there's no file system
             }
 
             if (mountPath != "/") { // skip when mounting root of the file system
@@ -77,13 +81,246 @@ int MountTable::umount(const std::string& mountPath) {
     return FAILURE;
 }
 
+// check the consistency of a mounted device; optionally repair its free block and inode counts
+int MountTable::fsck(const std::string& mountPath, bool repair) {
+    if (mountPath == "") {
+        std::cerr << "fsck: cannot check, no mount point given\n";
+        return FAILURE;
+    }
+    for (MountedDevice& d : devices) {
+        if (d.fd != -1 && d.mountPath == mountPath) {
+            if (repair && !d.writable("fsck"))
+                return FAILURE;
+            fs->inodeTable.sync(); // the check reads the inode tables directly, so make sure they are up to date
+            int result = DeviceCheck(&d).run(repair);
+            if (repair)
+                d.index_free(); // the repairs may have rewritten the block bitmap
+            return result;
+        }
+    }
+    std::cerr << "fsck: cannot check, invalid mount point\n";
+    return FAILURE;
+}
+
+// make every file on a mounted device contiguous; optionally shrink its disk image to just the blocks in use
+int MountTable::defrag(const std::string& mountPath, bool shrink) {
+    if (mountPath == "") {
+        std::cerr << "defrag: cannot defragment, no mount point given\n";
+        return FAILURE;
+    }
+    for (MountedDevice& d : devices) {
+        if (d.fd != -1 && d.mountPath == mountPath) {
+            if (fs->openFileTable.device_busy(&d)) {
+                std::cerr << "defrag: cannot defragment, device has open files\n";
+                return FAILURE;
+            }
+            if (!d.writable("defrag"))
+                return FAILURE;
+            if (shrink && d.ram) {
+                std::cerr << "defrag: cannot shrink, " << mountPath << " is a RAM disk\n";
+                return FAILURE;
+            }
+            if (shrink && d.overlay) {
+                std::cerr << "defrag: cannot shrink, " << mountPath << " has an overlay and its disk image is read-only\n";
+                return FAILURE;
+            }
+            fs->inodeTable.sync(); // the inode tables are rewritten directly, so make sure they are up to date
+            int result = Defragmenter(&d).run(shrink);
+            fs->inodeTable.reload(&d); // pick up the new block numbers of the cached inodes
+            d.index_free(); // and the new free space
+            return result;
+        }
+    }
+    std::cerr << "defrag: cannot defragment, invalid mount point\n";
+    return FAILURE;
+}
+
+// start or stop journaling a mounted device's block writes; the journal is a file next to its disk image, or its overlay
+int MountTable::journal(const std::string& mountPath, bool enable) {
+    if (mountPath == "") {
+        std::cerr << "journal: cannot change journaling, no mount point given\n";
+        return FAILURE;
+    }
+    for (MountedDevice& d : devices) {
+        if (d.fd == -1 || d.mountPath != mountPath)
+            continue;
+        if (enable) {
+            if (!d.writable("journal"))
+                return FAILURE;
+            if (d.ram) {
+                std::cerr << "journal: cannot journal " << mountPath << ", it is a RAM disk\n";
+                return FAILURE;
+            }
+            if (d.journal) {
+                std::cerr << "journal: " << mountPath << " is already journaled\n";
+                return FAILURE;
+            }
+            d.journal = std::make_unique<Journal>(&d);
+            if (d.journal->open(true) != SUCCESS) {
+                d.journal.reset();
+                return FAILURE;
+            }
+            printf("journal: %s is journaled in %s\n", mountPath.c_str(), d.journal_path().c_str());
+        } else {
+            if (!d.journal) {
+                std::cerr << "journal: " << mountPath << " is not journaled\n";
+                return FAILURE;
+            }
+            fs->inodeTable.sync(&d);
+            d.journal->close();
+            d.journal.reset();
+            unlink(d.journal_path().c_str());
+        }
+        return SUCCESS;
+    }
+    std::cerr << "journal: cannot change journaling, invalid mount point\n";
+    return FAILURE;
+}
+
+// show how many blocks a mounted device's overlay holds, or discard or merge it into the disk image
+int MountTable::overlay(const std::string& mountPath, const std::string& action) {
+    if (mountPath == "") {
+        std::cerr << "overlay: cannot change overlay, no mount point given\n";
+        return FAILURE;
+    }
+    for (MountedDevice& d : devices) {
+        if (d.fd == -1 || d.mountPath != mountPath)
+            continue;
+        if (!d.overlay) {
+            std::cerr << "overlay: " << mountPath << " is not mounted with an overlay\n";
+            return FAILURE;
+        }
+        if (action == "") {
+            printf("overlay: %s has %d changed blocks in %s\n", mountPath.c_str(), d.overlay->size(), d.overlay->path.c_str());
+            return SUCCESS;
+        }
+        if (action != "discard" && action != "merge") {
+            std::cerr << "overlay: invalid action " << action << ", use discard or merge\n";
+            return FAILURE;
+        }
+        if (action == "discard" && fs->openFileTable.device_busy(&d)) {
+            std::cerr << "overlay: cannot discard, device has open files\n";
+            return FAILURE;
+        }
+        fs->inodeTable.sync(&d); // everything written so far reaches the overlay first
+        if (d.journal)
+            d.journal->sync();
+
+        if (action == "merge") {
+            int baseFd = open(d.diskImage.c_str(), O_RDWR);
+            if (baseFd < 0) {
+                std::cerr << "overlay: cannot merge, cannot open " << d.diskImage << " for writing\n";
+                return FAILURE;
+            }
+            int merged = d.overlay->merge(baseFd);
+            ::close(baseFd);
+            printf("overlay: merged %d blocks into %s\n", merged, d.diskImage.c_str());
+        } else {
+            d.overlay->discard();
+            d.read_super(); // the free counts and cached inodes go back to what the disk image has
+            fs->inodeTable.reload(&d);
+            printf("overlay: discarded the changes to %s\n", d.diskImage.c_str());
+        }
+        return SUCCESS;
+    }
+    std::cerr << "overlay: cannot change overlay, invalid mount point\n";
+    return FAILURE;
+}
+
+// finish a command on every device: the modified cached inodes are written back, a block at a time, so a device
+// without a journal is as up to date after each command as when inodes were written back on their last put; then the
+// running transaction of a journaled device ends, holding all of the command's changes
+void MountTable::commit() {
+    for (MountedDevice& d : devices) {
+        if (d.fd == -1)
+            continue;
+        fs->inodeTable.sync(&d, false); // lazy access times stay lazy
+        if (d.journal)
+            d.journal->commit();
+    }
+}
+
+// write everything journaled to its home location
+void MountTable::sync() {
+    for (MountedDevice& d : devices) {
+        if (d.fd != -1 && d.journal)
+            d.journal->sync();
+    }
+}
+
+// close every mounted device's journal, overlay and disk image, once everything has been written back; its cached
+// inodes go with the engine, so they aren't put
+void MountTable::close() {
+    for (MountedDevice& d : devices) {
+        if (d.fd == -1)
+            continue;
+        if (d.journal) {
+            d.journal->close();
+            d.journal.reset();
+        }
+        d.overlay.reset();
+        d.ram.reset();
+        ::close(d.fd);
+        d.fd = -1;
+    }
+}
+
+// write every RAM disk mounted with persist back to its disk image
+void MountTable::save() {
+    for (MountedDevice& d : devices) {
+        if (d.fd != -1 && d.ram && d.ram->persist)
+            d.ram->save(d.diskImage);
+    }
+}
+
+// the blocks the file system has read from and written to the devices so far, counting the unmounted ones too so the
+// totals never go down
+void MountTable::io_counts(long* reads, long* writes) {
+    *reads = *writes = 0;
+    for (MountedDevice& d : devices) {
+        *reads += d.blocksRead.load(std::memory_order_relaxed);
+        *writes += d.blocksWritten.load(std::memory_order_relaxed);
+    }
+}
+
+// the mounted device with a given file descriptor, or null if none has it
+MountedDevice* MountTable::find(int fd) {
+    for (MountedDevice& d : devices) {
+        if (d.fd != -1 && d.fd == fd)
+            return &d;
+    }
+    return nullptr;
+}
+
+// start or end keeping every device's bitmaps and free counts in memory, for a burst of allocations
+void MountTable::batch(bool on) {
+    for (MountedDevice& d : devices) {
+        if (d.fd == -1)
+            continue;
+        if (on)
+            d.begin_batch();
+        else
+            d.end_batch();
+    }
+}
+
 // show a list of all mounted devices
 void MountTable::display() {
-    std::cout << "Dev Disk image name Mount point Num blk Free blk Num ino Free ino\n"
-                 "--- --------------- ----------- ------- -------- ------- --------\n";
+    std::cout << "Dev Disk image name Mount point Num blk Free blk Num ino Free ino Options\n"
+                 "--- --------------- ----------- ------- -------- ------- -------- -------\n";
     for (const MountedDevice& d : devices) {
         if (d.fd == -1) continue; // skip unused entries
-        printf("%-3d %-15s %-11s %-7d %-8d %-7d %-8d\n",
-            d.fd, d.diskImage.c_str(), d.mountPath.c_str(), d.nblocks, d.nbfree, d.ninodes, d.nifree);
+        printf("%-3d %-15s %-11s %-7d %-8d %-7d %-8d %s\n",
+            d.fd, d.diskImage.c_str(), d.mountPath.c_str(), d.nblocks, d.nbfree, d.ninodes, d.nifree, d.options.c_str());
     }
 }
+
+// the root of the device mounted on a given directory, or null if nothing is mounted there
+CachedINode* MountTable::mounted_root(MountedDevice* device, int inodeNum) {
+    for (const MountedDevice& d : devices) {
+        if (d.fd == -1 || d.mountPoint == d.root) continue; // skip unused entries and the root of the file system
+        if (d.mountPoint->device == device && d.mountPoint->inodeNum == inodeNum)
+            return d.mountPoint->deviceRoot;
+    }
+    return nullptr;
+}
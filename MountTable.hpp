@@ -8,7 +8,19 @@ private:
     MountedDevice devices[MOUNT_TABLE_SIZE];
 
 public:
-    CachedINode* mount(const std::string& diskImage, const std::string& mountPath); // mount a device into the file system simulation
+    CachedINode* mount(const std::string& diskImage, const std::string& mountPath, const std::string& options = ""); // mount a device into the file system simulation
     int umount(const std::string& mountPath); // unmount a device from the file system simulation
     void display(); // show a list of all mounted devices
+    int fsck(const std::string& mountPath, bool repair); // check the consistency of a mounted device
+    int defrag(const std::string& mountPath, bool shrink); // make every file on a mounted device contiguous
+    int journal(const std::string& mountPath, bool enable); // start or stop journaling a mounted device's block writes
+    int overlay(const std::string& mountPath, const std::string& action); // show, discard or merge a mounted device's overlay
+    void commit(); // write back the modified cached inodes and end the running transaction of every journaled device
+    void sync(); // write everything journaled to its home location
+    void save(); // write every RAM disk mounted with persist back to its disk image
+    void close(); // close every mounted device, once everything has been written back
+    void io_counts(long* reads, long* writes); // the blocks read from and written to the devices so far
+    void batch(bool on); // start or end keeping every device's bitmaps and free counts in memory
+    MountedDevice* find(int fd); // the mounted device with a given file descriptor, or null
+    CachedINode* mounted_root(MountedDevice* device, int inodeNum); // the root of the device mounted on a given directory, if any
 };
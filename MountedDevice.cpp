@@ -1,26 +1,170 @@
 #include "FileSystem.hpp"
+#include "Profiler.hpp"
 #include "DataBlock.hpp"
+#include "OpenFile.hpp"
 
 // open a Linux disk image file and initialize this device object
 int MountedDevice::mount() {
     TRACE(1, "mounting Linx file %s as %s in simulated file system\n", diskImage.c_str(), mountPath.c_str());
-    if ((fd = open(diskImage.c_str(), O_RDWR)) < 0) {
+    std::string overlayPath; // with the overlay option, the disk image is only read and the writes go here
+    bool inMemory = false; // with the ram option, the disk image is loaded into memory
+    bool persist = false; // with the persist option, a RAM disk is written back to its disk image when it's unmounted
+    int createBlocks = 0; // with the create= option, a new file system of this many blocks is made in memory
+    readOnly = false;
+    atimeMode = STRICTATIME;
+    lazyTime = false;
+    std::istringstream optionList(options);
+    for (std::string option; std::getline(optionList, option, ',');) {
+        if (option == "ro")
+            readOnly = true;
+        else if (option == "rw")
+            readOnly = false;
+        else if (option == "strictatime")
+            atimeMode = STRICTATIME;
+        else if (option == "relatime")
+            atimeMode = RELATIME;
+        else if (option == "noatime")
+            atimeMode = NOATIME;
+        else if (option == "lazytime")
+            lazyTime = true;
+        else if (option == "ram")
+            inMemory = true;
+        else if (option == "persist")
+            persist = true;
+        else if (option.compare(0, 7, "create=") == 0) {
+            const char* number = option.c_str() + 7;
+            char* end;
+            errno = 0;
+            unsigned long blocks = strtoul(number, &end, 10);
+            if (!isdigit((unsigned char)*number) || *end || errno || blocks == 0 || blocks > INT32_MAX) {
+                std::cerr << "mount: cannot mount, create= needs a number of blocks, not '" << number << "'\n";
+                return FAILURE;
+            }
+            createBlocks = blocks;
+            inMemory = true; // like ram, whichever comes first
+        }
+        else if (option == "overlay")
+            overlayPath = diskImage + ".overlay";
+        else if (option.compare(0, 8, "overlay=") == 0 && option.size() > 8)
+            overlayPath = option.substr(8);
+        else if (option != "") {
+            std::cerr << "mount: cannot mount, unknown option " << option << "\n";
+            return FAILURE;
+        }
+    }
+
+    if (persist && !inMemory) {
+        std::cerr << "mount: cannot mount, persist needs the ram or create= option\n";
+        return FAILURE;
+    }
+    if (inMemory && !overlayPath.empty()) {
+        std::cerr << "mount: cannot mount, a RAM disk can't have an overlay\n";
+        return FAILURE;
+    }
+    if (readOnly && !overlayPath.empty()) {
+        std::cerr << "mount: cannot mount, a read-only device can't have an overlay\n";
+        return FAILURE;
+    }
+
+    if (inMemory) {
+        if (!createBlocks && !readOnly && access(Journal::filename(diskImage).c_str(), F_OK) == 0 && replay_journal() != SUCCESS)
+            return FAILURE;
+        ram = std::make_unique<RamDisk>();
+        fd = createBlocks ? ram->create(diskImage, createBlocks) : ram->load(diskImage);
+        if (fd < 0) {
+            ram.reset();
+            return FAILURE;
+        }
+        ram->persist = persist;
+    } else if ((fd = open(diskImage.c_str(), (readOnly || !overlayPath.empty()) ? O_RDONLY : O_RDWR)) < 0) {
         std::cerr << "mount: cannot open disk image " << diskImage << "\n";
         return FAILURE;
     }
+    if (!overlayPath.empty()) {
+        struct stat status;
+        fstat(fd, &status);
+        overlay = std::make_unique<Overlay>(this);
+        if (overlay->open(overlayPath, status.st_size / BLOCK_SIZE) != SUCCESS) {
+            overlay.reset();
+            close(fd);
+            fd = -1;
+            return FAILURE;
+        }
+    }
+    struct stat journalStatus;
+    if ((readOnly || overlay) && ::stat(Journal::filename(diskImage).c_str(), &journalStatus) == 0 && journalStatus.st_size > BLOCK_SIZE)
+        std::cerr << "mount: warning, " << Journal::filename(diskImage) << " may hold transactions that can't be replayed on a read-only "
+                  << (readOnly ? "device" : "disk image under an overlay") << "\n";
+    if (!ram && !readOnly && access(journal_path().c_str(), F_OK) == 0) { // the device is journaled; replay whatever is left first
+        journal = std::make_unique<Journal>(this);
+        if (journal->open(false) != SUCCESS) {
+            journal.reset();
+            overlay.reset();
+            close(fd);
+            fd = -1;
+            return FAILURE;
+        }
+    }
     DataBlock block = DataBlock(this);
     block.get(SUPER_BLOCK);
     SuperBlock* sp = (SuperBlock*)block.buffer;
     if (sp->s_magic != EXT2_SUPER_MAGIC) {
-        std::cerr << "mount: " << diskImage << " is not an ext2 filesystem (magic = " << std::hex << sp->s_magic << ")\n";
+        std::cerr << "mount: " << diskImage << " is not an ext2 filesystem (magic = " << std::hex << sp->s_magic << std::dec << ")\n";
+        journal.reset();
+        overlay.reset();
+        ram.reset();
+        close(fd);
+        fd = -1;
         return FAILURE;
     }
     TRACE(2, "%s is an EXT2 file system\n", diskImage.c_str());
+    read_super();
+
+    root = fs->inodeTable.get(this, ROOT_DIR_INODE_NUM); // cache the root of the device
+    mountPoint = root; // by default, the device is mounted at its own root
 
+    return SUCCESS;
+}
+
+// replay whatever is left in the disk image's journal before the image is loaded into memory, since a RAM disk isn't
+// journaled; the journal is left empty, so it isn't replayed again over the blocks a persisted RAM disk saves
+int MountedDevice::replay_journal() {
+    if ((fd = open(diskImage.c_str(), O_RDWR)) < 0) {
+        std::cerr << "mount: cannot open disk image " << diskImage << "\n";
+        return FAILURE;
+    }
+    Journal replayer(this);
+    int result = replayer.open(false);
+    replayer.close();
+    close(fd);
+    fd = -1;
+    return result;
+}
+
+// the device's journal file; a device with an overlay keeps it next to the overlay, since the disk image under it may
+// be shared by other sessions, each with its own overlay
+std::string MountedDevice::journal_path() {
+    return Journal::filename(overlay ? overlay->path : diskImage);
+}
+
+// can the device be changed? if it's mounted read-only, the command explains why it can't go ahead
+bool MountedDevice::writable(const std::string& command) {
+    if (!readOnly)
+        return true;
+    std::cerr << command << ": cannot change " << mountPath << ", it is mounted read-only\n";
+    return false;
+}
+
+// read the device's sizes, free counts and layout from its superblock and group descriptor
+void MountedDevice::read_super() {
+    DataBlock block = DataBlock(this);
+    block.get(SUPER_BLOCK);
+    SuperBlock* sp = (SuperBlock*)block.buffer;
     ninodes = sp->s_inodes_count;
     nifree = sp->s_free_inodes_count;
     nblocks = sp->s_blocks_count;
     nbfree = sp->s_free_blocks_count;
+    inodeSize = (sp->s_rev_level == EXT2_GOOD_OLD_REV) ? EXT2_GOOD_OLD_INODE_SIZE : sp->s_inode_size; // ext4 uses 256 bytes
     TRACE(2, "num inodes = %d, num blocks = %d\n", ninodes, nblocks);
 
     block.get(GROUP_DESCRIPTOR_0); // read group descriptor block
@@ -29,47 +173,268 @@ int MountedDevice::mount() {
     imap = gp->bg_inode_bitmap;
     inodeStart = gp->bg_inode_table;
     TRACE(2, "block bitmap = %d, inode bitmap = %d, inode table start = %d\n", bmap, imap, inodeStart);
-
-    root = fs.inodeTable.get(this, ROOT_DIR_INODE_NUM); // cache the root of the device
-    mountPoint = root; // by default, the device is mounted at its own root
-
-    return SUCCESS;
+    index_free();
 }
 
 // close the disk image file and mark this device object as free
 int MountedDevice::umount() {
-    if (fs.inodeTable.device_busy(this)) {
+    if (fs->inodeTable.device_busy(this)) {
         std::cerr << "umount: cannot unmount, device is busy\n";
         return FAILURE;
     }
-    close(fd);
-    fd = -1; // mark mount table entry as unused
+    fs->inodeTable.sync(this); // including access times held back by lazytime
     mountPoint->deviceRoot = nullptr; // clear pointer to the unmounted device's root inode
     mountPoint->put(); // release the cached inode for the device's mount point
     root->put(); // release the cached inode for the device's root
+    if (journal) {
+        journal->close(); // everything journaled reaches its home location before the disk image is closed
+        journal.reset();
+    }
+    overlay.reset(); // the overlay file is kept, so the next mount with it carries on from here
+    if (ram) {
+        if (ram->persist)
+            ram->save(diskImage);
+        ram.reset();
+    }
+    close(fd);
+    fd = -1; // mark mount table entry as unused
 
     return SUCCESS;
 }
 
-// allocate a block/inode
-int MountedDevice::allocate(BitmapType type) {
+// read one block from the device; its latest contents may still be in the journal
+void MountedDevice::read_block(int blockNum, char* buffer) {
+    blocksRead.fetch_add(1, std::memory_order_relaxed);
+    if (fs->blockTrace.enabled)
+        fs->blockTrace.log(this, blockNum, 1, false);
+    if (!journal || !journal->read(blockNum, buffer))
+        read_disk(blockNum, buffer);
+}
+
+// write one block to the device; on a journaled device, metadata becomes part of the running transaction
+void MountedDevice::write_block(int blockNum, const char* buffer) {
+    blocksWritten.fetch_add(1, std::memory_order_relaxed);
+    if (fs->blockTrace.enabled)
+        fs->blockTrace.log(this, blockNum, 1, true);
+    if (journal)
+        journal->write(blockNum, 1, buffer, block_use(blockNum) != DATA_USE);
+    else
+        write_disk(blockNum, buffer);
+}
+
+// read a run of consecutive blocks from the disk image with a single system call
+void MountedDevice::read_blocks(int blockNum, int count, char* buffer) {
+    blocksRead.fetch_add(count, std::memory_order_relaxed);
+    if (fs->blockTrace.enabled)
+        fs->blockTrace.log(this, blockNum, count, false);
+    if (ram)
+        ram->read(blockNum, count, buffer);
+    else
+        pread(fd, buffer, (long)count * BLOCK_SIZE, (long)blockNum * BLOCK_SIZE);
+    if (overlay)
+        overlay->read_run(blockNum, count, buffer);
+    if (journal) { // replace any blocks whose latest contents are still in the journal
+        for (int i = 0; i < count; i++)
+            journal->read(blockNum + i, buffer + i * BLOCK_SIZE);
+    }
+}
+
+// write a run of consecutive blocks to the disk image with a single system call
+void MountedDevice::write_blocks(int blockNum, int count, const char* buffer) {
+    blocksWritten.fetch_add(count, std::memory_order_relaxed);
+    if (fs->blockTrace.enabled)
+        fs->blockTrace.log(this, blockNum, count, true);
+    if (journal)
+        journal->write(blockNum, count, buffer, block_use(blockNum) != DATA_USE);
+    else
+        write_disk(blockNum, buffer, count);
+}
+
+// read one block straight from the disk image, or from its overlay if the block was written there, or from memory;
+// positioned reads let several threads share the file descriptor
+void MountedDevice::read_disk(int blockNum, char* buffer) {
+    if (ram)
+        ram->read(blockNum, 1, buffer);
+    else if (!overlay || !overlay->read(blockNum, buffer))
+        pread(fd, buffer, BLOCK_SIZE, (long)blockNum * BLOCK_SIZE);
+}
+
+// write a run of blocks straight to the disk image, or to its overlay, or to memory
+void MountedDevice::write_disk(int blockNum, const char* buffer, int count) {
+    if (ram)
+        ram->write(blockNum, count, buffer);
+    else if (overlay)
+        overlay->write(blockNum, count, buffer);
+    else
+        pwrite(fd, buffer, (long)count * BLOCK_SIZE, (long)blockNum * BLOCK_SIZE);
+}
+
+// what a block being read or written is for: the metadata at fixed places is known by its location, and the rest by
+// the thread's blockUse, which the code reading and writing directories and index blocks sets
+BlockUse MountedDevice::block_use(int blockNum) {
+    if (blockNum <= GROUP_DESCRIPTOR_0)
+        return SUPER_USE;
+    if (blockNum == bmap || blockNum == imap)
+        return BITMAP_USE;
+    int inodeBlocks = ninodes / (BLOCK_SIZE / inodeSize); // the inodes table's length
+    if (blockNum >= inodeStart && blockNum < inodeStart + inodeBlocks)
+        return INODE_TABLE_USE;
+    return blockUse;
+}
+
+// make the blocks written to the device durable, wherever they went
+void MountedDevice::flush() {
+    if (ram)
+        return; // a RAM disk only reaches its disk image when it's unmounted
+    if (overlay)
+        overlay->flush();
+    else
+        fdatasync(fd);
+}
+
+// the block number of the inodes table block holding an inode
+int MountedDevice::inode_block(int inodeNum) {
+    return inodeStart + (inodeNum - 1) / (BLOCK_SIZE / inodeSize);
+}
+
+// the byte offset of an inode within its inodes table block
+int MountedDevice::inode_offset(int inodeNum) {
+    return (inodeNum - 1) % (BLOCK_SIZE / inodeSize) * inodeSize;
+}
+
+// allocate a block/inode: the first free one at or after the goal, skipping blocks set aside for other writers unless
+// they're all that's left; with a reservation window, a block is taken from the writer's window; free blocks are
+// found through the free extent tree rather than by scanning the bitmap; returns 0 if the device has none left
+int MountedDevice::allocate(BitmapType type, int goal, Reservation* window) {
+    PROFILE_SCOPE("MountedDevice::allocate");
     DataBlock block(this);
     const char* types[2] = { "inode", "block" };
     int bitmap = (type == INODE) ? imap : bmap;
-    int size = (type == INODE) ? ninodes : nblocks;
 
-    block.get(bitmap);
-    for (int i = 0; i < size; i++) {
-        if (!block.test_bit(i)) {
-            block.set_bit(i);
-            block.put(); // write back modified dataBlock
-            update_free(type, -1);
-            TRACE(2, "allocated %s number %d\n", types[type], i + 1);
-            return i + 1;
+    if (!batching)
+        block.get(bitmap);
+    DataBlock& bits = batching ? bitmaps[type] : block;
+    int num;
+    if (type == INODE)
+        num = find_free_inode(bits);
+    else if (window)
+        num = allocate_reserved(bits, goal, window);
+    else if (!(num = find_free_block(bits, goal, nullptr, true)))
+        num = find_free_block(bits, goal, nullptr, false); // everything free is reserved by writers, so take one anyway
+    if (!num) {
+        TRACE(1, "cannot allocate a new %s, device %d is full\n", types[type], fd); // the caller reports it
+        return 0;
+    }
+    bits.set_bit(num - 1);
+    if (!batching)
+        block.put(); // write back modified dataBlock
+    if (type == BLOCK)
+        freeExtents.take(num, 1);
+    update_free(type, -1);
+    TRACE(2, "allocated %s number %d for goal %d\n", types[type], num, goal);
+    return num;
+}
+
+// find a free block for a writer: in its reservation window, preferably at the goal; once the window is used up (or
+// if there isn't one yet) a bigger one is reserved, starting at the first free block after the goal that isn't in
+// another writer's window; returns the block number, or 0 if the device is full
+int MountedDevice::allocate_reserved(DataBlock& bits, int goal, Reservation* window) {
+    if (window->start) {
+        int from = (goal > window->start && goal < window->end) ? goal : window->start;
+        int blockNum = find_free_block(bits, from, window, false);
+        if (blockNum >= from && blockNum < window->end)
+            return blockNum;
+        window->size = std::min(2 * window->size, RESERVE_WINDOW_MAX_BLOCKS);
+        unreserve(window);
+    }
+
+    int blockNum = find_free_block(bits, goal, window, true);
+    if (!blockNum)
+        return find_free_block(bits, goal, window, false); // everything free is reserved by other writers
+    window->start = blockNum;
+    window->end = std::min(window->start + window->size, nblocks);
+    for (Reservation* other : reservations) // windows don't overlap
+        if (other->start > window->start && other->start < window->end)
+            window->end = other->start;
+    reservations.push_back(window);
+    TRACE(2, "reserved blocks %d to %d on device %d\n", window->start, window->end - 1, fd);
+    return blockNum;
+}
+
+// find the first free block at or after a goal, wrapping around to the start, by walking the free extent tree; with
+// avoid set, the blocks in other writers' reservation windows are skipped; returns the block number, or 0 if there
+// isn't one
+int MountedDevice::find_free_block(DataBlock& bits, int goal, Reservation* window, bool avoid) {
+    for (int pass = 0; pass < 2; pass++) {
+        int blockNum = freeExtents.next_free(pass ? 1 : goal);
+        while (blockNum && !(pass && blockNum >= goal)) {
+            if (bits.test_bit(blockNum - 1)) { // the bitmap was changed behind the tree's back; drop the block from it
+                freeExtents.take(blockNum, 1);
+                blockNum = freeExtents.next_free(blockNum + 1);
+                continue;
+            }
+            int end = avoid ? reserved_end(blockNum, window) : 0;
+            if (!end)
+                return blockNum;
+            blockNum = freeExtents.next_free(end); // skip the rest of the other writer's window
         }
     }
-    std::cerr << "PANIC: failed to allocate new " << types[type] << "\n";
-    exit(FAILURE); // terminate the program
+    return 0;
+}
+
+// find the first free inode in the inode bitmap; returns its number, or 0 if there isn't one
+int MountedDevice::find_free_inode(DataBlock& bits) {
+    for (int i = 0; i < ninodes; i++)
+        if (!bits.test_bit(i))
+            return i + 1;
+    return 0;
+}
+
+// if a block is in a reservation window other than this one, the block after that window; otherwise 0
+int MountedDevice::reserved_end(int blockNum, Reservation* window) {
+    for (Reservation* other : reservations)
+        if (other != window && blockNum >= other->start && blockNum < other->end)
+            return other->end;
+    return 0;
+}
+
+// give back the blocks of a reservation window that weren't used; they were never marked in the bitmap, so this
+// just lets other files have them
+void MountedDevice::unreserve(Reservation* window) {
+    reservations.erase(std::remove(reservations.begin(), reservations.end(), window), reservations.end());
+    window->start = window->end = 0;
+}
+
+// allocate a run of up to the wanted number of consecutive blocks: the smallest free extent that's long enough, or
+// else the longest one, after checking the bitmap agrees that all of it is free; returns its first block number and
+// sets its length, or returns 0 if the device is full
+int MountedDevice::allocate_run(int wanted, int* got) {
+    DataBlock block(this);
+    if (!batching)
+        block.get(bmap);
+    DataBlock& bits = batching ? bitmaps[BLOCK] : block;
+
+    int start;
+    for (;;) {
+        start = freeExtents.best_fit(wanted, got);
+        if (*got == 0)
+            return 0;
+        int used = start;
+        while (used < start + *got && !bits.test_bit(used - 1))
+            used++;
+        if (used == start + *got)
+            break;
+        freeExtents.take(used, 1); // the bitmap was changed behind the tree's back; drop the block from it and look again
+    }
+
+    for (int blockNum = start; blockNum < start + *got; blockNum++)
+        bits.set_bit(blockNum - 1);
+    if (!batching)
+        block.put();
+    freeExtents.take(start, *got);
+    update_free(BLOCK, -*got);
+    TRACE(2, "allocated blocks %d to %d\n", start, start + *got - 1);
+    return start;
 }
 
 //deallocate a block/inode
@@ -82,19 +447,54 @@ void MountedDevice::deallocate(BitmapType type, int num) {
         std::cerr << types[type] << " number " << num << " out of range for device " << fd << "\n";
         return;
     }
-    block.get(bitmap);
-    block.clear_bit(num - 1);
-    block.put();
+    if (!batching)
+        block.get(bitmap);
+    DataBlock& bits = batching ? bitmaps[type] : block;
+    if (!bits.test_bit(num - 1)) { // freeing it twice would count it as free twice
+        std::cerr << types[type] << " number " << num << " on device " << fd << " is already free\n";
+        return;
+    }
+    bits.clear_bit(num - 1);
+    if (!batching)
+        block.put();
+    if (type == BLOCK)
+        freeExtents.give(num, 1);
     update_free(type, 1);
     TRACE(2, "deallocated %s number %d\n", types[type], num);
 }
 
-// update count of free blocks/inodes
-void MountedDevice::update_free(BitmapType type, short change) {
+// build the free extent tree from the block bitmap; done when the device is mounted, and again whenever the bitmap
+// was rewritten directly, e.g., by fsck or defrag
+void MountedDevice::index_free() {
+    DataBlock bits(this);
+    bits.get(bmap);
+    freeExtents.clear();
+    for (int blockNum = 1; blockNum < nblocks;) {
+        if (bits.test_bit(blockNum - 1)) {
+            blockNum++;
+            continue;
+        }
+        int start = blockNum;
+        while (blockNum < nblocks && !bits.test_bit(blockNum - 1))
+            blockNum++;
+        freeExtents.give(start, blockNum - start);
+    }
+    TRACE(1, "device %d has %d free extents, the largest %d blocks\n", fd, freeExtents.count(), freeExtents.largest());
+}
+
+// update count of free blocks/inodes; while batching, only the counts in memory change until the batch ends
+void MountedDevice::update_free(BitmapType type, int change) {
     DataBlock block(this);
     const char* types[2] = { "inodes", "blocks" };
     int count;
 
+    if (batching) {
+        freeChanges[type] += change;
+        count = (type == INODE) ? (nifree += change) : (nbfree += change);
+        TRACE(3, "changed number of free %s by %d on device %d, count is now %d\n", types[type], change, fd, count);
+        return;
+    }
+
     block.get(SUPER_BLOCK);
     SuperBlock* sp = (SuperBlock*)block.buffer;
     if (type == INODE) {
@@ -115,3 +515,34 @@ void MountedDevice::update_free(BitmapType type, short change) {
     block.put();
     TRACE(2, "changed number of free %s by %d on device %d, count is now %d\n", types[type], change, fd, count);
 }
+
+// update count of directories, which is kept in the group descriptor
+void MountedDevice::update_dirs(int change) {
+    DataBlock block(this);
+    block.get(GROUP_DESCRIPTOR_0);
+    ((GroupDescriptor*)block.buffer)->bg_used_dirs_count += change;
+    block.put();
+}
+
+// keep the bitmaps and free counts in memory until the batch ends, so a burst of allocations writes them just once
+void MountedDevice::begin_batch() {
+    if (batching)
+        return;
+    bitmaps[INODE].get(this, imap);
+    bitmaps[BLOCK].get(this, bmap);
+    freeChanges[INODE] = freeChanges[BLOCK] = 0;
+    batching = true;
+}
+
+// write the bitmaps and free counts kept in memory during a batch
+void MountedDevice::end_batch() {
+    if (!batching)
+        return;
+    batching = false;
+    bitmaps[INODE].put();
+    bitmaps[BLOCK].put();
+    for (BitmapType type : { INODE, BLOCK }) {
+        if (freeChanges[type])
+            update_free(type, freeChanges[type]); // which also rereads the counts in memory from the superblock
+    }
+}
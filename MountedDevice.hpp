@@ -1,5 +1,12 @@
 #pragma once
+#include "Journal.hpp"
+#include "Overlay.hpp"
+#include "RamDisk.hpp"
+#include "DataBlock.hpp"
+#include "FreeExtents.hpp"
+#include "BlockTrace.hpp"
 class CachedINode;
+struct Reservation;
 
 // valid device bitmaps: INODE, BLOCK
 enum BitmapType {
@@ -7,6 +14,14 @@ enum BitmapType {
     BLOCK
 };
 
+// when reading a file updates its access time: always, only once it's older than the file's last change (or a day
+// old), or never
+enum AtimeMode {
+    STRICTATIME,
+    RELATIME,
+    NOATIME
+};
+
 // a Linux disk image used as a file system device
 class MountedDevice {
 public:
@@ -19,13 +34,55 @@ public:
     int bmap; // the block number where the free/used blocks bitmap is stored
     int imap; // the block number where the free/used indoes bitmap is stored
     int inodeStart; // the block number where the inodes table starts
+    int inodeSize; // the number of bytes used by each inode in the inodes table
     CachedINode* root; // a cached copy of this device's root inode
     CachedINode* mountPoint; // a cached copy of the inode in the primary file system where this device is mounted
     std::string mountPath; // absolute pathname of where the device is mounted in the simulated file system
+    std::string options; // comma-separated mount options, e.g., ro,noatime, overlay=session1.overlay, ram,persist or create=4096
+    bool readOnly = false; // with the ro option, nothing on the device may change
+    AtimeMode atimeMode = STRICTATIME; // with the relatime or noatime option, reading files updates fewer access times
+    bool lazyTime = false; // with the lazytime option, access times stay in the cached inodes until evicted or synced
+    std::unique_ptr<Journal> journal; // write-ahead journal of the block writes, if the device has one
+    std::unique_ptr<Overlay> overlay; // copy-on-write overlay holding the written blocks, if the disk image is only read
+    std::unique_ptr<RamDisk> ram; // the device's blocks, if they're all kept in memory
+    bool batching = false; // are the bitmaps and free counts being kept in memory until the batch ends?
+    DataBlock bitmaps[2]; // while batching, the INODE and BLOCK bitmaps
+    int freeChanges[2]; // while batching, the changes to the number of free inodes and blocks
+    std::vector<Reservation*> reservations; // the blocks set aside for the files being written
+    FreeExtents freeExtents; // the free blocks, as extents indexed by first block and by length
+    int openFiles = 0; // how many open file table entries are for files on this device
+    std::atomic<long> blocksRead{ 0 }; // blocks the file system has read from the device, whether or not the journal had them; the worker threads count too
+    std::atomic<long> blocksWritten{ 0 }; // blocks the file system has written to the device, whether or not through the journal
 
     int mount(); // open a Linux disk image file and initialize this device object
     int umount(); // close the disk image file and mark this device object as free
-    int allocate(BitmapType type); // allocate a block/inode
+    bool writable(const std::string& command); // can the device be changed? if not, the command says why
+    std::string journal_path(); // the device's journal file: its overlay's if it has one, otherwise its disk image's
+    void read_super(); // read the device's sizes, free counts and layout from its superblock and group descriptor
+    void index_free(); // build the free extent tree from the block bitmap
+    void read_block(int blockNum, char* buffer); // read one block from the disk image
+    void write_block(int blockNum, const char* buffer); // write one block to the disk image
+    void read_blocks(int blockNum, int count, char* buffer); // read a run of consecutive blocks from the disk image
+    void write_blocks(int blockNum, int count, const char* buffer); // write a run of consecutive blocks to the disk image
+    void read_disk(int blockNum, char* buffer); // read one block straight from the disk image, bypassing the journal
+    void write_disk(int blockNum, const char* buffer, int count = 1); // write blocks straight to the disk image, bypassing the journal
+    BlockUse block_use(int blockNum); // what a block being read or written is for
+    void flush(); // make the blocks written to the device durable
+    int inode_block(int inodeNum); // the block number of the inodes table block holding an inode
+    int inode_offset(int inodeNum); // the byte offset of an inode within its inodes table block
+    int allocate(BitmapType type, int goal = 1, Reservation* window = nullptr); // allocate a block/inode, at or after goal if it can
+    int allocate_run(int wanted, int* got); // allocate the best-fitting run of consecutive blocks; returns the first one and its length
     void deallocate(BitmapType type, int num); //deallocate a block/inode
-    void update_free(BitmapType type, short change); // update count of free blocks/inodes
+    void update_free(BitmapType type, int change); // update count of free blocks/inodes
+    void update_dirs(int change); // update count of directories
+    void begin_batch(); // keep the bitmaps and free counts in memory until the batch ends
+    void end_batch(); // write the bitmaps and free counts kept in memory during a batch
+    void unreserve(Reservation* window); // give back the blocks of a reservation window that weren't used
+
+private:
+    int replay_journal(); // replay the disk image's journal into it before it's loaded into memory
+    int allocate_reserved(DataBlock& bits, int goal, Reservation* window); // find a free block in a writer's window
+    int find_free_block(DataBlock& bits, int goal, Reservation* window, bool avoid); // find a free block at or after goal
+    int find_free_inode(DataBlock& bits); // find the first free inode
+    int reserved_end(int blockNum, Reservation* window); // the end of another window holding a block, or 0
 };
@@ -1,19 +1,116 @@
 #include "OpenFile.hpp"
+#include "Profiler.hpp"
 #include "CachedINode.hpp"
 #include "MountedDevice.hpp"
+#include "DataBlock.hpp"
 
 // initialize this open file object and return a pointer to it
 OpenFile* OpenFile::open(CachedINode* cachedINode, OpenMode mode) {
     refCount = 1;
     this->mode = mode;
     this->cachedINode = cachedINode;
+    reservation = Reservation();
     offset = (mode == APPEND) ? cachedINode->inode.i_size : 0;
     if (mode == WRITE) cachedINode->truncate();
     return this;
 }
 
+// read a requested number of bytes from the file into a buffer, starting at the current offset; return the actual
+// number of bytes read
+int OpenFile::read(char* buffer, int numBytes) {
+    PROFILE_SCOPE("OpenFile::read");
+    char* dst = buffer;
+    int startByte; // starting byte offset in the current data block at which to start reading
+    int remainingBytes; // number of bytes remaining in the current data block
+    int actualBytes; // actual number of bytes read (vs. numBytes requested)
+    int logicalBlockNum, actualBlockNum;
+
+    INode* inode = &cachedINode->inode;
+    DataBlock block(cachedINode->device);
+
+    logicalBlockNum = offset / BLOCK_SIZE;
+    startByte = offset % BLOCK_SIZE;
+    if (numBytes > (int)inode->i_size - offset) {
+        numBytes = std::max((int)inode->i_size - offset, 0); // don't attempt to read beyond the size of the file
+    }
+    actualBytes = numBytes;
+
+    while (numBytes) {
+        actualBlockNum = cachedINode->logical2physical(logicalBlockNum);
+        remainingBytes = BLOCK_SIZE - startByte;
+        if (actualBlockNum)
+            block.get(actualBlockNum);
+        else
+            memset(block.buffer, 0, BLOCK_SIZE); // a hole reads as zeros
+        if (numBytes <= remainingBytes) {
+            memcpy(dst, &block.buffer[startByte], numBytes);
+            offset += numBytes;
+            numBytes = 0;
+        } else {
+            memcpy(dst, &block.buffer[startByte], remainingBytes);
+            offset += remainingBytes;
+            numBytes -= remainingBytes;
+            dst += remainingBytes;
+            startByte = 0;
+            logicalBlockNum++;
+        }
+    }
+    cachedINode->accessed(); // update file accessed time
+    return actualBytes;
+}
+
+// write a requested number of bytes to the file from a buffer, starting at the current offset; return the actual
+// number of bytes written
+int OpenFile::write(const char* buffer, int numBytes) {
+    PROFILE_SCOPE("OpenFile::write");
+    const char* src = buffer;
+    int actualBytes = numBytes; // assume we won't fail to write all the bytes given, i.e., the device has enough free space available
+    int logicalBlockNum, actualBlockNum, startByte, remainingBytes;
+
+    INode* inode = &cachedINode->inode;
+    DataBlock block(cachedINode->device);
+
+    if (mode == APPEND)
+        offset = inode->i_size; // every write goes at the end, wherever the file's other writers have left it
+    logicalBlockNum = offset / BLOCK_SIZE;
+    startByte = offset % BLOCK_SIZE;
+    while (numBytes) {
+        actualBlockNum = cachedINode->logical2physical(logicalBlockNum);
+        if (actualBlockNum == 0) { // could be new file, starting a new block or filling a hole
+            actualBlockNum = cachedINode->allocate_block(logicalBlockNum, &reservation);
+            if (actualBlockNum == 0)
+                break;
+            memset(block.buffer, 0, BLOCK_SIZE);
+        } else
+            block.get(actualBlockNum); // start with existing data
+
+        remainingBytes = BLOCK_SIZE - startByte;
+        if (numBytes <= remainingBytes) {
+            memcpy(&block.buffer[startByte], src, numBytes);
+            offset += numBytes;
+            numBytes = 0;
+        } else {
+            memcpy(&block.buffer[startByte], src, remainingBytes);
+            offset += remainingBytes;
+            numBytes -= remainingBytes;
+            src += remainingBytes;
+            startByte = 0;
+        }
+        block.put(actualBlockNum);
+        logicalBlockNum++;
+    }
+    actualBytes -= numBytes; // whatever the file couldn't map wasn't written
+    inode->i_size = std::max(inode->i_size, (__u32)offset);
+    inode->i_atime = time(0L); // update file accessed time
+    inode->i_ctime = time(0L); // update inode change time
+    inode->i_mtime = time(0L); // update file modified time
+    cachedINode->isDirty = true;
+    return actualBytes;
+}
+
 // return a string representation of the open file mode
-std::string OpenFile::mode_str() const {
+const char* OpenFile::mode_str() const {
+    static const char* const modes[] = { "READ", "WRITE", "READWRITE", "APPEND" }; // one copy, not one per open file
     return modes[mode];
 }
 
@@ -2,6 +2,16 @@
 #include "main.hpp"
 class CachedINode;
 
+#define RESERVE_WINDOW_BLOCKS 8 // the size of a writer's first reservation window
+#define RESERVE_WINDOW_MAX_BLOCKS 1024 // the most a reservation window grows to
+
+// a range of blocks set aside for one writer, so the blocks it appends stay together even while other files grow
+struct Reservation {
+    int start = 0; // the first block of the window, or 0 if nothing's reserved
+    int end = 0; // the block after the window
+    int size = RESERVE_WINDOW_BLOCKS; // the size of the next window; it doubles each time a window is used up
+};
+
 // valid open file modes: READ, WRITE, READWRITE, APPEND
 enum OpenMode {
     READ,
@@ -12,17 +22,19 @@ enum OpenMode {
 
 // an open file shared across all the file system's processes
 class OpenFile {
-private:
-    const std::vector<std::string> modes { "READ", "WRITE", "READWRITE", "APPEND" };
-
 public:
     int refCount = 0; // number of times this open file (available simulate-wide) is being used by various Processes
     int offset; // the current byte position within the file where reading/writing will occur
-    CachedINode* cachedINode; // the file's inode
+    CachedINode* cachedINode = nullptr; // the file's inode
     OpenMode mode;
+    Reservation reservation; // the blocks set aside for writing this file
+    OpenFile* prevLink = nullptr; // the previous of its inode's open files
+    OpenFile* nextLink = nullptr; // the next of its inode's open files, or while it's unused, the next free entry
 
     OpenFile* open(CachedINode* cachedINode, OpenMode mode); // initialize this open file object and return a pointer to it
-    std::string mode_str() const; // return a string representation of the open file mode
+    int read(char* buffer, int numBytes); // read bytes from the current offset; returns the number read
+    int write(const char* buffer, int numBytes); // write bytes at the current offset; returns the number written
+    const char* mode_str() const; // return a string representation of the open file mode
 };
 
 std::ostream& operator<<(std::ostream& stream, const OpenFile& openFile); // send an OpenFile object to an output stream
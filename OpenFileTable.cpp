@@ -1,41 +1,66 @@
 #include "OpenFileTable.hpp"
+#include "CachedINode.hpp"
+#include "MountedDevice.hpp"
 
 // get an open file by its inode
 OpenFile* OpenFileTable::get(CachedINode* inode) {
-    for (OpenFile& f : openFiles) {
-        if (f.refCount != 0 && f.cachedINode == inode)
-            return &f;
-    }
-    return nullptr;
+    return inode->openFiles;
+}
+
+// check whether any of the open files are on a given device
+bool OpenFileTable::device_busy(MountedDevice* device) {
+    return device->openFiles > 0;
 }
 
-// return a matching entry in the open file table, or initialize a new entry if needed
+// initialize a new entry for each open of a file, so each has its own offset; any number of reads, read/writes and
+// appends can share a file, keeping out of each other's way with byte-range locks, but opening for write truncates
+// it, so that needs the file to itself; returns null, without a message, if the file can't be opened that way
 OpenFile* OpenFileTable::open(CachedINode* inode, OpenMode mode) {
-    OpenFile* openFile = get(inode);
-    if (openFile) {
-        // file is already open; check for incompatible mode (only multiple read operations are okay)
-        if (openFile->mode != READ) {
-            std::cerr << "open: cannot open, file is already open for write\n";
-            return nullptr;
-        } else if (mode != READ) {
-            std::cerr << "open: cannot open for write, file is already open\n";
-            return nullptr;
-        } else {
-            openFile->refCount++; // mode is compatible, increment the reference count
-        }
-    } else {
-        // file is not already open; allocate entry in the open file table
-        for (OpenFile& f : openFiles) {
-            if (f.refCount == 0) {
-                f.open(inode, mode);
-                openFile = &f;
-                break;
-            }
-        }
-        if (!openFile) {
-            std::cerr << "open: cannot open, the global open file table is full\n";
-            return nullptr;
+    if (inode->openFiles && (inode->openFiles->mode == WRITE || mode == WRITE))
+        return nullptr; // an open for write is always the file's only one, so only the first needs checking
+
+    // take an entry off the free list, adding a slab of entries to it if it's empty
+    OpenFile* openFile;
+    if (!freeList) {
+        slabs.push_back(std::make_unique<OpenFile[]>(OPEN_FILES_SLAB_SIZE));
+        OpenFile* slab = slabs.back().get();
+        for (int i = OPEN_FILES_SLAB_SIZE - 1; i >= 0; i--) {
+            slab[i].nextLink = freeList;
+            freeList = &slab[i];
         }
+        TRACE(1, "open file table grown to %zu entries\n", slabs.size() * OPEN_FILES_SLAB_SIZE);
     }
+    openFile = freeList;
+    freeList = openFile->nextLink;
+    openFile->open(inode, mode);
+    openFile->prevLink = nullptr;
+    openFile->nextLink = inode->openFiles;
+    if (inode->openFiles)
+        inode->openFiles->prevLink = openFile;
+    inode->openFiles = openFile;
+    inode->device->openFiles++;
+    inUse++;
     return openFile; // return address of the entry in the global open file table
 }
+
+// drop a reference to an entry; with the last, give back its unused reserved blocks, release its cached inode and put
+// the entry back on the free list
+void OpenFileTable::close(OpenFile* openFile) {
+    if (--openFile->refCount > 0)
+        return;
+    CachedINode* inode = openFile->cachedINode;
+    inode->device->unreserve(&openFile->reservation);
+    if (openFile->prevLink)
+        openFile->prevLink->nextLink = openFile->nextLink;
+    else
+        inode->openFiles = openFile->nextLink;
+    if (openFile->nextLink)
+        openFile->nextLink->prevLink = openFile->prevLink;
+    inode->device->openFiles--;
+    inode->put();
+    openFile->cachedINode = nullptr;
+    openFile->prevLink = nullptr;
+    openFile->nextLink = freeList;
+    freeList = openFile;
+    inUse--;
+}
@@ -1,12 +1,20 @@
 #pragma once
 #include "OpenFile.hpp"
+class MountedDevice;
 
-// a fixed-size table of the file system's open files
+// the file system's open files, allocated from slabs of OPEN_FILES_SLAB_SIZE entries that are added as they're needed
+// and never moved, so the pointers the processes hold stay good; unused entries are kept on a free list and each
+// inode links to its own entries, so opening and closing a file take constant time however many are open
 class OpenFileTable {
 private:
-    OpenFile openFiles[OPEN_FILES_TABLE_SIZE];
+    std::vector<std::unique_ptr<OpenFile[]>> slabs; // every entry, in use or not
+    OpenFile* freeList = nullptr; // the unused entries, linked through OpenFile::nextLink
 
 public:
+    int inUse = 0; // how many entries are in use
+
     OpenFile* get(CachedINode* inode); // get an open file by its inode
-    OpenFile* open(CachedINode* inode, OpenMode mode); // return a matching entry in the open file table, or initialize a new entry
+    bool device_busy(MountedDevice* device); // check whether any of the open files are on a given device
+    OpenFile* open(CachedINode* inode, OpenMode mode); // initialize a new entry for a file, if its other opens allow the mode
+    void close(OpenFile* openFile); // drop a reference to an entry; with the last, release it and its inode
 };
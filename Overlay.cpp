@@ -0,0 +1,149 @@
+#include "Overlay.hpp"
+#include "MountedDevice.hpp"
+
+// an overlay for a device; it's not used until it's opened
+Overlay::Overlay(MountedDevice* device)
+    : device(device) {
+}
+
+// close the overlay file
+Overlay::~Overlay() {
+    close();
+}
+
+// open (or create) an overlay file for a base image of blockCount blocks, reading its presence bitmap
+int Overlay::open(const std::string& path, int blockCount) {
+    this->path = path;
+    this->blockCount = blockCount;
+    bitmapBlocks = (blockCount + 8 * BLOCK_SIZE - 1) / (8 * BLOCK_SIZE);
+    present.assign((size_t)bitmapBlocks * BLOCK_SIZE, 0);
+    if ((fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644)) < 0) {
+        std::cerr << "mount: cannot open overlay " << path << "\n";
+        return FAILURE;
+    }
+
+    OverlayHeader header;
+    struct stat status;
+    fstat(fd, &status);
+    if (status.st_size == 0) { // a new overlay is empty; its data area is a hole until blocks are written
+        char block[BLOCK_SIZE] = {};
+        header.magic = OVERLAY_MAGIC;
+        header.blockCount = blockCount;
+        memcpy(block, &header, sizeof(header));
+        pwrite(fd, block, BLOCK_SIZE, 0);
+        pwrite(fd, present.data(), present.size(), BLOCK_SIZE);
+    } else if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != OVERLAY_MAGIC
+        || (int)header.blockCount != blockCount
+        || pread(fd, present.data(), present.size(), BLOCK_SIZE) != (ssize_t)present.size()) {
+        std::cerr << "mount: " << path << " is not an overlay of a " << blockCount << " block image\n";
+        ::close(fd);
+        fd = -1;
+        return FAILURE;
+    }
+    TRACE(1, "opened overlay %s with %d blocks on device %d\n", path.c_str(), size(), device->fd);
+    return SUCCESS;
+}
+
+// close the overlay file, which is kept so the next mount can carry on where this one left off
+void Overlay::close() {
+    if (fd == -1)
+        return;
+    fdatasync(fd);
+    ::close(fd);
+    fd = -1;
+}
+
+// copy a block's contents into a buffer if it's in the overlay
+bool Overlay::read(int blockNum, char* buffer) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!is_present(blockNum))
+            return false;
+    }
+    pread(fd, buffer, BLOCK_SIZE, data_offset(blockNum));
+    return true;
+}
+
+// replace the blocks of a run, already read from the base image, that are in the overlay; each run of them is read at once
+void Overlay::read_run(int blockNum, int count, char* buffer) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (int start = 0, end; start < count; start = end) {
+        if (!is_present(blockNum + start)) {
+            end = start + 1;
+            continue;
+        }
+        for (end = start + 1; end < count && is_present(blockNum + end); end++)
+            ;
+        pread(fd, buffer + (long)start * BLOCK_SIZE, (long)(end - start) * BLOCK_SIZE, data_offset(blockNum + start));
+    }
+}
+
+// write a run of blocks into the overlay with a single write, since the overlay keeps the base image's layout;
+// the data is written before the blocks are marked present, so a block is never marked with nothing behind it
+void Overlay::write(int blockNum, int count, const char* buffer) {
+    pwrite(fd, buffer, (long)count * BLOCK_SIZE, data_offset(blockNum));
+    std::lock_guard<std::mutex> guard(lock);
+    for (int i = blockNum; i < blockNum + count; i++) {
+        if (is_present(i))
+            continue;
+        present[i / 8] |= 1 << (i % 8);
+        pwrite(fd, &present[i / 8], 1, BLOCK_SIZE + i / 8);
+    }
+}
+
+// make the overlay's blocks durable
+void Overlay::flush() {
+    fdatasync(fd);
+}
+
+// the number of blocks in the overlay
+int Overlay::size() {
+    std::lock_guard<std::mutex> guard(lock);
+    int count = 0;
+    for (unsigned char byte : present)
+        count += __builtin_popcount(byte);
+    return count;
+}
+
+// copy the overlay's blocks into the base image, a run at a time, then empty the overlay; returns the number copied
+int Overlay::merge(int baseFd) {
+    std::vector<char> buffer((size_t)OVERLAY_MERGE_BLOCKS * BLOCK_SIZE);
+    int merged = 0;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (int start = 0, end; start < blockCount; start = end) {
+            if (!is_present(start)) {
+                end = start + 1;
+                continue;
+            }
+            for (end = start + 1; end < blockCount && end - start < OVERLAY_MERGE_BLOCKS && is_present(end); end++)
+                ;
+            long length = (long)(end - start) * BLOCK_SIZE;
+            pread(fd, buffer.data(), length, data_offset(start));
+            pwrite(baseFd, buffer.data(), length, (long)start * BLOCK_SIZE);
+            merged += end - start;
+        }
+    }
+    fdatasync(baseFd); // the base image has everything before the overlay lets go of it
+    discard();
+    return merged;
+}
+
+// empty the overlay, so the device reads as its base image again; the data area becomes a hole again
+void Overlay::discard() {
+    std::lock_guard<std::mutex> guard(lock);
+    std::fill(present.begin(), present.end(), 0);
+    pwrite(fd, present.data(), present.size(), BLOCK_SIZE);
+    ftruncate(fd, (long)(1 + bitmapBlocks) * BLOCK_SIZE);
+    fdatasync(fd);
+}
+
+// where a block is kept in the overlay file: after the header and bitmap, at the same position as in the base image
+long Overlay::data_offset(int blockNum) {
+    return (long)(1 + bitmapBlocks + blockNum) * BLOCK_SIZE;
+}
+
+// is a block in the overlay? the lock must be held
+bool Overlay::is_present(int blockNum) {
+    return blockNum >= 0 && blockNum < blockCount && (present[blockNum / 8] & (1 << (blockNum % 8)));
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "main.hpp"
+#include <mutex>
+class MountedDevice;
+
+#define OVERLAY_MAGIC 0x4f564c59 // "OVLY", starts the overlay file's header block
+#define OVERLAY_MERGE_BLOCKS 256 // the most blocks copied at once when merging an overlay into its base image
+
+// the first block of an overlay file; the presence bitmap follows it, then a copy of the base image's block layout
+struct OverlayHeader {
+    __u32 magic;
+    __u32 blockCount; // the number of blocks in the base image
+};
+
+// a copy-on-write overlay of a device's disk image: the base image is only read, and every block written goes to a
+// sparse overlay file instead, at the same position it has in the base image, with a bitmap of which blocks are there
+// the overlay can be discarded, leaving the base image as it was, or merged into the base image
+class Overlay {
+public:
+    Overlay(MountedDevice* device); // an overlay for a device; it's not used until it's opened
+    ~Overlay(); // close the overlay file
+    int open(const std::string& path, int blockCount); // open (or create) an overlay file for a base image of blockCount blocks
+    void close(); // close the overlay file, which is kept for the next mount
+    bool read(int blockNum, char* buffer); // copy a block's contents if it's in the overlay
+    void read_run(int blockNum, int count, char* buffer); // replace the blocks of a run that are in the overlay
+    void write(int blockNum, int count, const char* buffer); // write a run of blocks into the overlay
+    void flush(); // make the overlay's blocks durable
+    int size(); // the number of blocks in the overlay
+    int merge(int baseFd); // copy the overlay's blocks into the base image, then empty the overlay; returns the number copied
+    void discard(); // empty the overlay, so the device reads as its base image again
+
+    std::string path; // the overlay file
+
+private:
+    MountedDevice* device;
+    int fd = -1; // file descriptor of the overlay file
+    int blockCount = 0; // the number of blocks in the base image
+    int bitmapBlocks = 0; // the number of blocks in the presence bitmap
+    std::vector<unsigned char> present; // bit i is set when block i is in the overlay
+    std::mutex lock; // guards the bitmap; the journal's background thread writes while commands read
+
+    long data_offset(int blockNum); // where a block is kept in the overlay file
+    bool is_present(int blockNum); // is a block in the overlay? lock held
+};
@@ -1,26 +1,55 @@
 #include "PathComponents.hpp"
 
 // separate a pathanme into its component parts
-PathComponents::PathComponents(const std::string& pathname) {
+PathComponents::PathComponents(std::string_view pathname) {
+    names.pathname = pathname;
     if (pathname == "") return;
 
     // split the given name into its directory and its base name, e.g., "/abc/def/ghi" -> "/abc/def", "ghi"
-    char temp[STRING_SIZE]; // dirname(), basename() destroy original pathname
-    strcpy(temp, pathname.c_str());
-    parent = std::string(dirname(temp));
-    strcpy(temp, pathname.c_str());
-    child = std::string(basename(temp));
-    TRACE(1, "pathname = '%s', dir/parent = '%s', base/child = '%s'\n",
-        pathname.c_str(), parent.c_str(), child.c_str());
+    // following the rules of dirname() and basename(), but without copying the pathname
+    size_t last = pathname.find_last_not_of('/'); // ignore any trailing slashes
+    if (last == std::string_view::npos) {
+        parent = child = "/"; // nothing but slashes
+    } else {
+        std::string_view trimmed = pathname.substr(0, last + 1);
+        size_t slash = trimmed.find_last_of('/');
+        child = trimmed.substr(slash + 1); // npos + 1 wraps around to 0, i.e., the whole name
+        if (slash == std::string_view::npos) {
+            parent = ".";
+        } else {
+            size_t parentEnd = trimmed.find_last_not_of('/', slash);
+            parent = (parentEnd == std::string_view::npos) ? "/" : trimmed.substr(0, parentEnd + 1);
+        }
+    }
+    TRACE(1, "pathname = '%.*s', dir/parent = '%.*s', base/child = '%.*s'\n",
+        (int)pathname.size(), pathname.data(), (int)parent.size(), parent.data(), (int)child.size(), child.data());
+}
+
+// create an iterator representing the first name in the pathname
+PathComponents::Names::Iter PathComponents::Names::begin() const { return Iter(pathname); }
+
+// create an iterator representing the end of the names in the pathname
+PathComponents::Names::Iter PathComponents::Names::end() const { return Iter(std::string_view()); }
 
-    // split the given name into its component parts, e.g., "/abc/def/ghi" -> ["abc", "def", "ghi"]
-    std::ostringstream trace;
-    trace << pathname << " tokenizes to: ";
-    std::istringstream stream(pathname);
-    std::string component;
-    while (std::getline(stream, component, '/')) {
-        if (component != "") names.push_back(component);
-        trace << component << " ";
+// iterator for the names in a pathname; empty names (from repeated slashes) are skipped
+PathComponents::Names::Iter::Iter(std::string_view rest)
+    : rest(rest) {
+    ++*this;
+}
+PathComponents::Names::Iter& PathComponents::Names::Iter::operator++() {
+    size_t start = rest.find_first_not_of('/');
+    if (start == std::string_view::npos) {
+        rest = name = std::string_view(); // no more names
+        return *this;
     }
-    TRACE(1, "%s\n", trace.str().c_str());
+    size_t slash = rest.find('/', start);
+    name = rest.substr(start, slash - start);
+    rest = (slash == std::string_view::npos) ? std::string_view() : rest.substr(slash);
+    return *this;
+}
+bool PathComponents::Names::Iter::operator!=(const Iter& rhs) const {
+    return name.data() != rhs.name.data() || name.size() != rhs.name.size();
+}
+std::string_view PathComponents::Names::Iter::operator*() const {
+    return name;
 }
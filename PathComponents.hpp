@@ -1,13 +1,31 @@
 #pragma once
 #include "main.hpp"
 
-// the component parts of a pathname
+// the component parts of a pathname; these are views into the given pathname, so it must outlive this object
 class PathComponents {
 public:
-    std::string parent;
-    std::string child;
-    std::vector<std::string> names;
+    std::string_view parent;
+    std::string_view child;
 
-    PathComponents(const std::string& pathname); // separate a pathanme into its component parts
+    class Names { // the names within a pathname, e.g., "/abc/def/ghi" -> "abc", "def", "ghi"
+    public:
+        std::string_view pathname;
+
+        class Iter { // iterator for the names in a pathname
+        private:
+            std::string_view rest; // the remaining, unparsed portion of the pathname
+            std::string_view name; // the current name; empty at the end of the pathname
+
+        public:
+            Iter(std::string_view rest); // constructor
+            Iter& operator++(); // advance to next name
+            bool operator!=(const Iter& rhs) const; // test for inequality
+            std::string_view operator*() const; // get the current name
+        };
+        Iter begin() const; // create an iterator representing the first name
+        Iter end() const; // create an iterator representing the end of the names
+    } names;
+
+    PathComponents(std::string_view pathname); // separate a pathanme into its component parts
     ~PathComponents() = default;
 };
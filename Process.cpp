@@ -1,7 +1,13 @@
 #include "Process.hpp"
+#include "Profiler.hpp"
 #include "DataBlock.hpp"
 #include "FileSystem.hpp"
 
+// a range of bytes as it's shown to the user, e.g., "100-199", or "100-" for up to whatever the file grows to
+static std::string byte_range(int start, int end) {
+    return std::to_string(start) + "-" + (end == INT32_MAX ? "" : std::to_string(end - 1));
+}
+
 // set the command prompt
 std::string Process::prompt() {
     std::ostringstream stream;
@@ -15,13 +21,11 @@ void Process::display_open_files() {
 
     std::cout << "fd mode   offset [dev, inode]\n"
                  "-- ------ ------ ------------\n";
-    int fd = 0;
-    for (OpenFile* f : openFiles) {
-        if (f) {
-            std::cout << std::setw(2) << std::left << fd << ' ' << *f << '\n';
+    for (size_t fd = 0; fd < openFiles.size(); fd++) {
+        if (openFiles[fd]) {
+            std::cout << std::setw(2) << std::left << fd << ' ' << *openFiles[fd] << '\n';
             found = true;
         }
-        fd++;
     }
     if (!found) std::cout << "no open files\n";
 }
@@ -29,15 +33,15 @@ void Process::display_open_files() {
 // change current working directory
 int Process::chdir(const std::string& pathname) {
     if (pathname == "") {
-        if (cwd != fs.root) { // change to root if not there already
+        if (cwd != fs->root) { // change to root if not there already
             cwd->put();
-            cwd = fs.inodeTable.get(fs.root->device, fs.root->inodeNum);
+            cwd = fs->inodeTable.get(fs->root->device, fs->root->inodeNum);
             cwd_path = "/";
         }
         return SUCCESS;
     }
 
-    CachedINode* dir = fs.inodeTable.get(pathname);
+    CachedINode* dir = fs->inodeTable.get(pathname);
     if (!dir) {
         std::cerr << "cd: cannot change directory, " << pathname << " not found\n";
         return FAILURE;
@@ -62,11 +66,8 @@ int Process::pwd() {
 
 // open a file and return its file descriptor, or -1 on failure
 int Process::open(const std::string& pathname, OpenMode mode) {
-    int fileDescriptor;
-    for (fileDescriptor = 0; fileDescriptor < PROCESS_FILE_DESCRIPTORS; fileDescriptor++) {
-        if (openFiles[fileDescriptor] == nullptr) break; // found free slot for new file descriptor
-    }
-    if (fileDescriptor == PROCESS_FILE_DESCRIPTORS) {
+    int fileDescriptor = lowest_free_fd();
+    if (fileDescriptor == -1) {
         std::cerr << "open: cannot open file, the process's open file table is full\n";
         return -1;
     }
@@ -80,7 +81,7 @@ int Process::open(const std::string& pathname, OpenMode mode) {
         return -1;
     }
 
-    CachedINode* file = fs.inodeTable.get(pathname);
+    CachedINode* file = fs->inodeTable.get(pathname);
     if (!file) {
         std::cerr << "open: cannot open " << pathname << ", file not found\n";
         return -1;
@@ -90,15 +91,26 @@ int Process::open(const std::string& pathname, OpenMode mode) {
         file->put();
         return -1;
     }
-    openFiles[fileDescriptor] = fs.openFileTable.open(file, mode);
-    if (openFiles[fileDescriptor] == nullptr) {
+    if (mode != READ && !file->device->writable("open")) {
+        file->put();
+        return -1;
+    }
+    OpenFile* openFile = fs->openFileTable.open(file, mode);
+    if (openFile == nullptr) {
+        if (file->openFiles->mode == WRITE)
+            std::cerr << "open: cannot open, file is already open for write\n";
+        else
+            std::cerr << "open: cannot open for write, file is already open\n";
         file->put(); // cannot open file, release cached inode
         return -1;
     }
+    set_fd(fileDescriptor, openFile);
 
-    file->isDirty = true;
-    file->inode.i_atime = time(0L); // access time
-    if (mode != READ) file->inode.i_mtime = time(0L); // modified time
+    file->accessed(); // access time
+    if (mode != READ) {
+        file->inode.i_mtime = time(0L); // modified time
+        file->isDirty = true;
+    }
 
     TRACE(1, "file opened in mode %d and assigned file descriptor %d\n", mode, fileDescriptor);
     return fileDescriptor;
@@ -106,31 +118,29 @@ int Process::open(const std::string& pathname, OpenMode mode) {
 
 // close an open file
 int Process::close(int fileDescriptor) {
-    if (fileDescriptor < 0 || fileDescriptor >= PROCESS_FILE_DESCRIPTORS) {
+    if (fileDescriptor < 0 || fileDescriptor >= PROCESS_MAX_FILE_DESCRIPTORS) {
         std::cerr << "close: cannot close file, invalid file descriptor\n";
         return FAILURE;
     }
-    if (!openFiles[fileDescriptor]) {
+    if (!get_fd(fileDescriptor)) {
         std::cerr << "close: cannot close file, file descriptor not in use\n";
         return FAILURE;
     }
 
-    // decrement the reference count and see if it's no longer in use
-    if (--openFiles[fileDescriptor]->refCount == 0) {
-        openFiles[fileDescriptor]->cachedINode->put(); // release the cached inode
-        openFiles[fileDescriptor]->cachedINode = nullptr; // clear the reference to the inode
-    }
-    openFiles[fileDescriptor] = nullptr; // release the file descriptor for the current process
+    // as with POSIX record locks, closing any of its descriptors for a file releases all the process's locks on it
+    openFiles[fileDescriptor]->cachedINode->locks.unlock(pid, 0, INT32_MAX);
+    fs->openFileTable.close(openFiles[fileDescriptor]); // with the last reference, the entry and its inode are released
+    clear_fd(fileDescriptor); // release the file descriptor for the current process
     return SUCCESS;
 }
 
 // set the offset of an open file to a given position
 int Process::lseek(int fileDescriptor, int offset) {
-    if (fileDescriptor < 0 || fileDescriptor >= PROCESS_FILE_DESCRIPTORS) {
+    if (fileDescriptor < 0 || fileDescriptor >= PROCESS_MAX_FILE_DESCRIPTORS) {
         std::cerr << "lseek: cannot seek file, invalid file descriptor\n";
         return -1;
     }
-    if (!openFiles[fileDescriptor]) {
+    if (!get_fd(fileDescriptor)) {
         std::cerr << "lseek: cannot seek file, file descriptor not in use\n";
         return -1;
     }
@@ -146,175 +156,184 @@ int Process::lseek(int fileDescriptor, int offset) {
 
 // duplicate a file descriptor to the next available descriptor
 int Process::dup(int fileDescriptor) {
-    unsigned int dupFileDescriptor;
-    for (dupFileDescriptor = 0; dupFileDescriptor < PROCESS_FILE_DESCRIPTORS; dupFileDescriptor++) {
-        if (openFiles[dupFileDescriptor] == nullptr) break; // found free slot for new file descriptor
-    }
-    if (dupFileDescriptor == PROCESS_FILE_DESCRIPTORS) {
+    int dupFileDescriptor = lowest_free_fd();
+    if (dupFileDescriptor == -1) {
         std::cerr << "dup: cannot duplicate, the process's open file table is full\n";
         return -1;
     }
-    if (fileDescriptor < 0 || fileDescriptor >= PROCESS_FILE_DESCRIPTORS) {
+    if (fileDescriptor < 0 || fileDescriptor >= PROCESS_MAX_FILE_DESCRIPTORS) {
         std::cerr << "dup: cannot duplicate, invalid file descriptor\n";
         return -1;
     }
-    if (!openFiles[fileDescriptor]) {
+    if (!get_fd(fileDescriptor)) {
         std::cerr << "dup: cannot duplicate, file descriptor not in use\n";
         return -1;
     }
 
-    openFiles[dupFileDescriptor] = openFiles[fileDescriptor];
+    set_fd(dupFileDescriptor, openFiles[fileDescriptor]);
     openFiles[fileDescriptor]->refCount++;
     return dupFileDescriptor;
 }
 
 // duplicate a source file descriptor to a specific destination descriptor; close destination file if it's open
 int Process::dup2(int fileDescriptor, int dupFileDescriptor) {
-    if (fileDescriptor < 0 || fileDescriptor >= PROCESS_FILE_DESCRIPTORS) {
+    if (fileDescriptor < 0 || fileDescriptor >= PROCESS_MAX_FILE_DESCRIPTORS) {
         std::cerr << "dup2: cannot duplicate, invalid source file descriptor\n";
         return -1;
     }
-    if (!openFiles[fileDescriptor]) {
+    if (!get_fd(fileDescriptor)) {
         std::cerr << "dup2: cannot duplicate, file descriptor not in use\n";
         return -1;
     }
-    if (dupFileDescriptor == fileDescriptor || dupFileDescriptor < 0 || dupFileDescriptor >= PROCESS_FILE_DESCRIPTORS) {
+    if (dupFileDescriptor == fileDescriptor || dupFileDescriptor < 0 || dupFileDescriptor >= PROCESS_MAX_FILE_DESCRIPTORS) {
         std::cerr << "dup2: cannot duplicate, invalid destination file descriptor\n";
         return -1;
     }
 
     // if the destination file descriptor is open, close it
-    if (openFiles[dupFileDescriptor]) close(dupFileDescriptor);
+    if (get_fd(dupFileDescriptor)) close(dupFileDescriptor);
 
-    openFiles[dupFileDescriptor] = openFiles[fileDescriptor];
+    set_fd(dupFileDescriptor, openFiles[fileDescriptor]);
     openFiles[fileDescriptor]->refCount++;
     return dupFileDescriptor;
 }
 
+// lock or unlock a range of an open file's bytes for this process, as fcntl's F_SETLK; a length of 0 runs to whatever
+// the file grows to; with commands run one at a time, a lock another process holds fails at once instead of waiting
+// for it, and with no type given, the file's locks are listed
+int Process::lock(int fileDescriptor, const std::string& type, int start, int length) {
+    if (fileDescriptor < 0 || fileDescriptor >= PROCESS_MAX_FILE_DESCRIPTORS) {
+        std::cerr << "lock: cannot lock, invalid file descriptor\n";
+        return FAILURE;
+    }
+    if (!get_fd(fileDescriptor)) {
+        std::cerr << "lock: cannot lock, file descriptor not in use\n";
+        return FAILURE;
+    }
+    OpenFile* file = openFiles[fileDescriptor];
+    RangeLocks& locks = file->cachedINode->locks;
+    if (type == "") {
+        if (locks.empty()) {
+            std::cout << "no locks\n";
+            return SUCCESS;
+        }
+        std::cout << "bytes                  lock  processes\n"
+                     "---------------------- ----- ---------\n";
+        for (const LockedRange& range : locks.list()) {
+            std::cout << std::setw(22) << std::left << byte_range(range.start, range.end) << ' '
+                      << (range.writer >= 0 ? "write" : "read ") << std::right;
+            if (range.writer >= 0)
+                std::cout << ' ' << range.writer;
+            for (int reader : range.readers)
+                std::cout << ' ' << reader;
+            std::cout << '\n';
+        }
+        return SUCCESS;
+    }
+    if (start < 0 || length < 0) {
+        std::cerr << "lock: cannot lock, invalid range\n";
+        return FAILURE;
+    }
+    int end = length == 0 || length > INT32_MAX - start ? INT32_MAX : start + length;
+    if (type == "u") {
+        locks.unlock(pid, start, end);
+        return SUCCESS;
+    }
+    if (type != "r" && type != "w") {
+        std::cerr << "lock: cannot lock, invalid type\n"
+                     "r=read, w=write, u=unlock\n";
+        return FAILURE;
+    }
+    LockType lockType = type == "w" ? WRITE_LOCK : READ_LOCK;
+    if (lockType == READ_LOCK && file->mode != READ && file->mode != READWRITE) {
+        std::cerr << "lock: cannot read lock, file is not opened for read or read/write\n";
+        return FAILURE;
+    }
+    if (lockType == WRITE_LOCK && file->mode == READ) {
+        std::cerr << "lock: cannot write lock, file is opened for read only\n";
+        return FAILURE;
+    }
+    int holder = locks.conflict(pid, lockType, start, end);
+    if (holder >= 0) {
+        std::cerr << "lock: cannot lock bytes " << byte_range(start, end) << ", locked by process " << holder << "\n";
+        return FAILURE;
+    }
+    locks.lock(pid, lockType, start, end);
+    return SUCCESS;
+}
+
 // read a requested number of bytes from a file into a buffer; return the actual number of bytes read
 int Process::read(int fileDescriptor, char* buffer, int numBytes) {
-    char* dst = buffer;
-    int startByte; // starting byte offset in the current data block at which to start reading
-    int remainingBytes; // number of bytes remaining in the current data block
-    int actualBytes; // actual number of bytes read (vs. numBytes requested)
-    int logicalBlockNum, actualBlockNum;
-
-    OpenFile* file = openFiles[fileDescriptor];
+    PROFILE_SCOPE("Process::read");
+    OpenFile* file = get_fd(fileDescriptor);
     if (file->mode != READ && file->mode != READWRITE) {
         std::cerr << "read: cannot read file, file is not opened for read or read/write\n";
         return -1;
     }
-
-    CachedINode* cachedINode = file->cachedINode;
-    INode* inode = &cachedINode->inode;
-    DataBlock block(cachedINode->device);
-
-    logicalBlockNum = file->offset / BLOCK_SIZE;
-    startByte = file->offset % BLOCK_SIZE;
-    if (numBytes > (int)inode->i_size - file->offset) {
-        numBytes = (int)inode->i_size - file->offset; // don't attempt to read beyond the size of the file
-    }
-    actualBytes = numBytes;
-
-    while (numBytes) {
-        actualBlockNum = cachedINode->logical2physical(logicalBlockNum);
-        remainingBytes = BLOCK_SIZE - startByte;
-        block.get(actualBlockNum);
-        if (numBytes <= remainingBytes) {
-            memcpy(dst, &block.buffer[startByte], numBytes);
-            file->offset += numBytes;
-            numBytes = 0;
-        } else {
-            memcpy(dst, &block.buffer[startByte], remainingBytes);
-            file->offset += remainingBytes;
-            numBytes -= remainingBytes;
-            dst += remainingBytes;
-            startByte = 0;
-            logicalBlockNum++;
-        }
+    int end = numBytes > INT32_MAX - file->offset ? INT32_MAX : file->offset + numBytes;
+    int holder = numBytes > 0 ? file->cachedINode->locks.conflict(pid, READ_LOCK, file->offset, end) : -1;
+    if (holder >= 0) {
+        std::cerr << "read: cannot read bytes " << byte_range(file->offset, end) << ", write locked by process "
+                  << holder << "\n";
+        return -1;
     }
-    inode->i_atime = time(0L); // update file accessed time
-    cachedINode->isDirty = true;
-    return actualBytes;
+    return file->read(buffer, numBytes);
 }
 
 // used to test/debug the read() method, returns the number of bytes read
 int Process::read_bytes(int fileDescriptor, int numBytes) {
-    if (fileDescriptor < 0 || fileDescriptor >= PROCESS_FILE_DESCRIPTORS) {
+    if (fileDescriptor < 0 || fileDescriptor >= PROCESS_MAX_FILE_DESCRIPTORS) {
         std::cerr << "read: cannot read file, invalid file descriptor\n";
         return -1;
     }
-    if (!openFiles[fileDescriptor]) {
+    if (!get_fd(fileDescriptor)) {
         std::cerr << "read: cannot read file, file descriptor not in use\n";
         return -1;
     }
-    char* bytes = new char[numBytes];
+    if (numBytes < 0) {
+        std::cerr << "read: cannot read file, invalid number of bytes\n";
+        return -1;
+    }
+    char* bytes = fs->arena.allocate(numBytes);
     int actualBytes = read(fileDescriptor, bytes, numBytes);
-    delete bytes;
+    if (actualBytes < 0)
+        return -1;
     std::cout << "read: " << actualBytes << " bytes read from file\n";
     return actualBytes;
 }
 
 // write a requested number of bytes to a file from a buffer; return the actual number of bytes written
 int Process::write(int fileDescriptor, char* buffer, int numBytes) {
-    char* src = buffer;
-    int actualBytes = numBytes; // assume we won't fail to write all the bytes given, i.e., the device has enough free space available
-    int logicalBlockNum, actualBlockNum, startByte, remainingBytes;
-
-    OpenFile* file = openFiles[fileDescriptor];
+    PROFILE_SCOPE("Process::write");
+    OpenFile* file = get_fd(fileDescriptor);
     if (file->mode == READ) {
         std::cerr << "write: cannot write to file, file is opened for read only\n";
         return -1;
     }
-
-    CachedINode* cachedINode = file->cachedINode;
-    INode* inode = &cachedINode->inode;
-    DataBlock block(cachedINode->device);
-
-    logicalBlockNum = file->offset / BLOCK_SIZE;
-    startByte = file->offset % BLOCK_SIZE;
-    actualBlockNum = cachedINode->logical2physical(logicalBlockNum);
-    if (actualBlockNum == 0)
-        actualBlockNum = cachedINode->allocate_block(); // could be new file or could be starting a new block
-    else
-        block.get(actualBlockNum); // start with existing data
-
-    while (numBytes) {
-        remainingBytes = BLOCK_SIZE - startByte;
-        if (numBytes <= remainingBytes) {
-            memcpy(&block.buffer[startByte], src, numBytes);
-            file->offset += numBytes;
-            numBytes = 0;
-        } else {
-            memcpy(&block.buffer[startByte], src, remainingBytes);
-            file->offset += remainingBytes;
-            numBytes -= remainingBytes;
-            src += remainingBytes;
-            startByte = 0;
-        }
-        block.put(actualBlockNum);
-        if (numBytes) { // if there's more to write, add another data block to the file
-            actualBlockNum = cachedINode->allocate_block();
-        }
+    int start = file->mode == APPEND ? (int)file->cachedINode->inode.i_size : file->offset;
+    int end = numBytes > INT32_MAX - start ? INT32_MAX : start + numBytes;
+    int holder = numBytes > 0 ? file->cachedINode->locks.conflict(pid, WRITE_LOCK, start, end) : -1;
+    if (holder >= 0) {
+        std::cerr << "write: cannot write bytes " << byte_range(start, end) << ", locked by process " << holder << "\n";
+        return -1;
     }
-    inode->i_size += actualBytes;
-    inode->i_atime = time(0L); // update file accessed time
-    inode->i_ctime = time(0L); // update inode change time
-    inode->i_mtime = time(0L); // update file modified time
-    cachedINode->isDirty = true;
-    return actualBytes;
+    int written = file->write(buffer, numBytes);
+    if (written < numBytes)
+        std::cerr << "write: cannot write all " << numBytes << " bytes, " << status_message(Status::NO_SPACE) << "\n";
+    return written;
 }
 
-// used to test/debug the write() method, returns the number of bytes written
-int Process::write_bytes(int fileDescriptor) {
+// used to test/debug the write() method, returns the number of bytes written; the text, written as a line, can be
+// given with the command, so scripts can write, or else it's asked for
+int Process::write_bytes(int fileDescriptor, const std::string& text) {
     char buffer[STRING_SIZE];
     int numBytes, actualBytes;
 
-    if (fileDescriptor < 0 || fileDescriptor >= PROCESS_FILE_DESCRIPTORS) {
+    if (fileDescriptor < 0 || fileDescriptor >= PROCESS_MAX_FILE_DESCRIPTORS) {
         std::cerr << "write: cannot write file, invalid file descriptor\n";
         return -1;
     }
-    if (!openFiles[fileDescriptor]) {
+    if (!get_fd(fileDescriptor)) {
         std::cerr << "write: cannot write file, file descriptor not in use\n";
         return -1;
     }
@@ -322,14 +341,19 @@ int Process::write_bytes(int fileDescriptor) {
         std::cerr << "write: cannot write file, file open for read only\n";
         return -1;
     }
-    std::cout << "String to write: ";
-    fgets(buffer, STRING_SIZE, stdin);
+    if (text.empty()) {
+        std::cout << "String to write: ";
+        fgets(buffer, STRING_SIZE, stdin);
+    } else
+        snprintf(buffer, STRING_SIZE, "%s\n", text.c_str());
     numBytes = (int)strlen(buffer);
     if (numBytes == 1) { // a single character is just the newline, so it's an empty string
         std::cerr << "write: nothing to write\n";
         return -1;
     }
     actualBytes = write(fileDescriptor, buffer, numBytes);
+    if (actualBytes < 0)
+        return -1;
     std::cout << "write: " << actualBytes << " bytes written to file";
     return actualBytes;
 }
@@ -345,7 +369,7 @@ int Process::cat(const std::string& pathname) {
         return -1;
     }
 
-    while ((numBytes = read(fileDescriptor, dataBlock, BLOCK_SIZE))) {
+    while ((numBytes = read(fileDescriptor, dataBlock, BLOCK_SIZE)) > 0) {
         dataBlock[numBytes] = '\0';
         printf("%s", dataBlock);
     }
@@ -353,3 +377,39 @@ int Process::cat(const std::string& pathname) {
     close(fileDescriptor);
     return SUCCESS;
 }
+
+// the lowest unused file descriptor, found a word of the bitmap at a time; if they're all in use, the table grows by
+// another word's worth, up to PROCESS_MAX_FILE_DESCRIPTORS, after which it returns -1
+int Process::lowest_free_fd() {
+    for (size_t word = 0; word < fdBits.size(); word++) {
+        if (~fdBits[word])
+            return word * 64 + __builtin_ctzll(~fdBits[word]);
+    }
+    int fileDescriptor = fdBits.size() * 64;
+    if (fileDescriptor >= PROCESS_MAX_FILE_DESCRIPTORS)
+        return -1;
+    fdBits.push_back(0);
+    openFiles.resize(fileDescriptor + 64, nullptr);
+    return fileDescriptor;
+}
+
+// the open file for a descriptor, or null if it isn't in use
+OpenFile* Process::get_fd(int fileDescriptor) {
+    return fileDescriptor >= 0 && fileDescriptor < (int)openFiles.size() ? openFiles[fileDescriptor] : nullptr;
+}
+
+// use a descriptor for an open file, growing the table to hold it if it's past the end, as dup2 can ask for
+void Process::set_fd(int fileDescriptor, OpenFile* openFile) {
+    while (fileDescriptor >= (int)openFiles.size()) {
+        fdBits.push_back(0);
+        openFiles.resize(openFiles.size() + 64, nullptr);
+    }
+    openFiles[fileDescriptor] = openFile;
+    fdBits[fileDescriptor / 64] |= 1ULL << (fileDescriptor % 64);
+}
+
+// stop using a descriptor
+void Process::clear_fd(int fileDescriptor) {
+    openFiles[fileDescriptor] = nullptr;
+    fdBits[fileDescriptor / 64] &= ~(1ULL << (fileDescriptor % 64));
+}
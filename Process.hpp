@@ -18,9 +18,10 @@ public:
     int gid; // group ID
     Process* next;
     ProcessStatus status = READY;
-    CachedINode* cwd; // current working directory
+    CachedINode* cwd = nullptr; // current working directory; null until the process first runs
     std::string cwd_path; // cwd as a full absolute path string
-    OpenFile* openFiles[PROCESS_FILE_DESCRIPTORS] = { nullptr }; // pointers into the global open file table
+    std::vector<OpenFile*> openFiles; // pointers into the global open file table, by file descriptor; grows as needed
+    std::vector<uint64_t> fdBits; // a bit for each descriptor, set while it's in use
 
     std::string prompt(); // set the command prompt
     void display_open_files(); // display all the open files for this process
@@ -31,10 +32,17 @@ public:
     int lseek(int fileDescriptor, int offset); // set the offset of an open file to a given position
     int dup(int fileDescriptor); // duplicate a file descriptor to the next available descriptor
     int dup2(int fileDescriptor, int dupFileDescriptor); // duplicate a source file descriptor to a specific destination
+    int lock(int fileDescriptor, const std::string& type, int start, int length); // lock or unlock a range of a file's bytes, or list its locks
     int read(int fileDescriptor, char* buffer, int numBytes); // read a requested number of bytes from a file
     int write(int fileDescriptor, char* buffer, int numBytes); // write a requested number of bytes to a file
     int cat(const std::string& pathname); // display the contents of a file
 
     int read_bytes(int fileDescriptor, int numBytes); // used to test/debug the read() method, returns the number of bytes read
-    int write_bytes(int fileDescriptor); // used to test/debug the write() method, returns the number of bytes written
+    int write_bytes(int fileDescriptor, const std::string& text = ""); // used to test/debug the write() method, returns the number of bytes written
+
+private:
+    int lowest_free_fd(); // the lowest unused file descriptor, growing the table if they're all used, or -1 at the limit
+    OpenFile* get_fd(int fileDescriptor); // the open file for a descriptor, or null if it isn't in use
+    void set_fd(int fileDescriptor, OpenFile* openFile); // use a descriptor for an open file
+    void clear_fd(int fileDescriptor); // stop using a descriptor
 };
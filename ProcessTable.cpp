@@ -16,7 +16,19 @@ ProcessTable::ProcessTable() {
 // create the first running process
 void ProcessTable::create_superuser() {
     TRACE(1, "%s\n", "assigning superuser (pid = 0) as the running process");
-    fs.running = &processes[SUPER_USER];
-    fs.running->cwd = fs.inodeTable.get(fs.root->device, fs.root->inodeNum);
-    fs.running->cwd_path = "/";
+    fs->running = &processes[SUPER_USER];
+    fs->running->cwd = fs->inodeTable.get(fs->root->device, fs->root->inodeNum);
+    fs->running->cwd_path = "/";
+}
+
+// a process by its id, or null if there isn't one; a process that hasn't run yet starts in the root directory
+Process* ProcessTable::get(int pid) {
+    if (pid < 0 || pid >= PROCESS_TABLE_SIZE)
+        return nullptr;
+    Process* process = &processes[pid];
+    if (!process->cwd) {
+        process->cwd = fs->inodeTable.get(fs->root->device, fs->root->inodeNum);
+        process->cwd_path = "/";
+    }
+    return process;
 }
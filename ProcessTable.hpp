@@ -9,4 +9,5 @@ private:
 public:
     ProcessTable();
     void create_superuser(); // create the first running process
+    Process* get(int pid); // a process by its id, started in the root directory if it hasn't run yet, or null
 };
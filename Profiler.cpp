@@ -0,0 +1,125 @@
+#include "Profiler.hpp"
+#include <fstream>
+Profiler profiler;
+thread_local ProfileNode* Profiler::current = nullptr;
+
+// a worker thread's own call tree, merged into the profiler's worker tree when the thread ends
+struct ThreadProfile {
+    ProfileNode root{ "thread", nullptr };
+    ~ThreadProfile() { profiler.merge(root); }
+};
+static thread_local ThreadProfile threadProfile;
+
+// the node for a function called from this one, added the first time it's called from here; the same name can be at
+// different addresses in different source files, so names are compared when the pointers differ
+ProfileNode* ProfileNode::child(const char* name) {
+    for (auto& node : children) {
+        if (node->name == name || strcmp(node->name, name) == 0)
+            return node.get();
+    }
+    children.push_back(std::make_unique<ProfileNode>(name, this));
+    return children.back().get();
+}
+
+// the time spent in this function, less the time spent in the timed functions it called
+long ProfileNode::self() {
+    long total = nanoseconds;
+    for (auto& node : children)
+        total -= node->nanoseconds;
+    return std::max(total, 0L);
+}
+
+// add another tree's calls and times to this one's, adding the nodes this one doesn't have
+void ProfileNode::merge(const ProfileNode& other) {
+    calls += other.calls;
+    nanoseconds += other.nanoseconds;
+    for (auto& node : other.children)
+        child(node->name)->merge(*node);
+}
+
+// the top of this thread's tree: the root for the thread running commands, and a tree of its own for any other
+ProfileNode* Profiler::top() {
+    return std::this_thread::get_id() == commandThread ? &root : &threadProfile.root;
+}
+
+// add an ended worker thread's tree to the worker tree
+void Profiler::merge(const ProfileNode& tree) {
+    std::lock_guard<std::mutex> guard(lock);
+    workers.merge(tree);
+}
+
+// zero every count, keeping the nodes, since some of them may be in scopes that are still running
+void Profiler::clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<ProfileNode*> stack = { &root, &workers };
+    while (!stack.empty()) {
+        ProfileNode* node = stack.back();
+        stack.pop_back();
+        node->calls = node->nanoseconds = 0;
+        for (auto& child : node->children)
+            stack.push_back(child.get());
+    }
+}
+
+// show the call tree, each node with its calls, its total and self times, and its average time per call
+void Profiler::report() {
+#ifndef PROFILE
+    std::cout << "profile: the timers aren't compiled in, rebuild with 'make profile=1'\n";
+#endif
+    std::cout << std::left << std::setw(40) << "function" << std::right << std::setw(10) << "calls" << std::setw(12)
+              << "total ms" << std::setw(12) << "self ms" << std::setw(12) << "avg us" << "\n";
+    for (auto& command : root.children)
+        report(command.get(), 0);
+    std::lock_guard<std::mutex> guard(lock);
+    if (!workers.children.empty()) {
+        std::cout << workers.name << "\n";
+        for (auto& function : workers.children)
+            report(function.get(), 1);
+    }
+}
+
+// show a node and, indented below it, the ones it called, the most expensive first
+void Profiler::report(ProfileNode* node, int depth) {
+    if (node->calls == 0)
+        return;
+    std::cout << std::left << std::setw(40) << std::string(2 * depth, ' ') + node->name << std::right << std::setw(10)
+              << node->calls << std::fixed << std::setprecision(3) << std::setw(12) << node->nanoseconds / 1e6
+              << std::setw(12) << node->self() / 1e6 << std::setw(12) << node->nanoseconds / 1e3 / node->calls
+              << std::defaultfloat << "\n";
+    std::vector<ProfileNode*> children;
+    for (auto& child : node->children)
+        children.push_back(child.get());
+    std::sort(children.begin(), children.end(), [](ProfileNode* a, ProfileNode* b) {
+        return a->nanoseconds > b->nanoseconds;
+    });
+    for (ProfileNode* child : children)
+        report(child, depth + 1);
+}
+
+// write the tree as folded stacks, one line per path with its self time in microseconds, e.g.,
+// "mv;INodeTable::link;INodeTable::get;DataBlock::get 42", for flamegraph.pl and similar tools
+int Profiler::fold(const std::string& path) {
+    std::ofstream stream(path);
+    if (!stream) {
+        std::cerr << "profile: cannot create " << path << "\n";
+        return FAILURE;
+    }
+    for (auto& command : root.children)
+        fold(command.get(), "", stream);
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto& function : workers.children)
+        fold(function.get(), workers.name, stream);
+    return SUCCESS;
+}
+
+// write the stack through a node, then the stacks through the ones it called
+void Profiler::fold(ProfileNode* node, const std::string& stack, std::ostream& stream) {
+    if (node->calls == 0)
+        return;
+    std::string path = stack.empty() ? node->name : stack + ";" + node->name;
+    long self = node->self() / 1000;
+    if (self > 0)
+        stream << path << " " << self << "\n";
+    for (auto& child : node->children)
+        fold(child.get(), path, stream);
+}
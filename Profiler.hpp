@@ -0,0 +1,77 @@
+#pragma once
+#include "main.hpp"
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+// time the rest of the enclosing scope as a node of the call tree, e.g., PROFILE_SCOPE("INodeTable::get"); the
+// timers are only compiled in with -DPROFILE ('make profile=1'), so without it they cost nothing at all
+#ifdef PROFILE
+#define PROFILE_CONCAT(a, b) a##b
+#define PROFILE_NAME(line) PROFILE_CONCAT(profileScope, line)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_NAME(__LINE__)(name)
+#else
+#define PROFILE_SCOPE(name) \
+    do {                    \
+    } while (0)
+#endif
+
+// a function as it was called along one path from a command: how often, for how long, and what it called
+struct ProfileNode {
+    const char* name; // the function, or the command at the top of the tree
+    ProfileNode* parent; // its caller, or null for the root
+    std::vector<std::unique_ptr<ProfileNode>> children; // what it called
+    long calls = 0; // how many times it was called along this path
+    long nanoseconds = 0; // the time spent in it, including what it called
+
+    ProfileNode(const char* name, ProfileNode* parent) : name(name), parent(parent) {}
+    ProfileNode* child(const char* name); // the node for a function called from this one, added on its first call
+    long self(); // the time spent in it, less what it called
+    void merge(const ProfileNode& other); // add another tree's calls and times to this one's, node by node
+};
+
+// the call tree the scoped timers build: each command run is a child of the root, and each timed function a child
+// of whichever timed function or command called it
+// the worker threads some commands start (the tree walker's, the exporter's) time their scopes in trees of their
+// own, which are merged into the profiler's worker tree as each thread ends, so no tree is ever shared while it grows
+class Profiler {
+public:
+    ProfileNode root{ "all", nullptr }; // the top of the tree for the thread running commands
+    ProfileNode workers{ "worker threads", nullptr }; // the top of the merged trees of the threads that have ended
+    static thread_local ProfileNode* current; // the node whose scope is running on this thread, or null before the first
+
+    Profiler() : commandThread(std::this_thread::get_id()) {}
+    ProfileNode* top(); // the top of this thread's tree
+    void merge(const ProfileNode& tree); // add an ended worker thread's tree to the worker tree
+    void clear(); // zero every count, keeping the nodes, since some of them may be in scopes that are still running
+    void report(); // show the call tree, with the calls and times of each node
+    int fold(const std::string& path); // write the tree as folded stacks, for flamegraph tools
+
+private:
+    std::thread::id commandThread; // the thread running commands, whose scopes go under root
+    std::mutex lock; // guards the worker tree
+
+    void report(ProfileNode* node, int depth); // show a node and the ones below it
+    void fold(ProfileNode* node, const std::string& stack, std::ostream& stream); // write the stacks through a node
+};
+
+extern Profiler profiler; // globally defined in Profiler.cpp
+
+// times a scope, adding it to the node for its name under the scope it's in on its thread
+class ProfileScope {
+public:
+    ProfileScope(const char* name)
+        : node((profiler.current ? profiler.current : profiler.top())->child(name)), start(std::chrono::steady_clock::now()) {
+        profiler.current = node;
+    }
+    ~ProfileScope() {
+        node->calls++;
+        node->nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        profiler.current = node->parent;
+    }
+
+private:
+    ProfileNode* node; // where its time goes
+    std::chrono::steady_clock::time_point start; // when the scope started
+};
@@ -0,0 +1,195 @@
+#include "RamDisk.hpp"
+#include <sys/mman.h>
+
+// release the memory; the memory file itself goes away when the device closes its descriptor
+RamDisk::~RamDisk() {
+    if (blocks)
+        munmap(blocks, (size_t)blockCount * BLOCK_SIZE);
+}
+
+// copy a disk image into memory; returns the memory file's descriptor, or -1
+int RamDisk::load(const std::string& diskImage) {
+    int imageFd = ::open(diskImage.c_str(), O_RDONLY);
+    if (imageFd < 0) {
+        std::cerr << "mount: cannot open disk image " << diskImage << "\n";
+        return -1;
+    }
+    struct stat status;
+    fstat(imageFd, &status);
+    int fd = allocate(diskImage, status.st_size / BLOCK_SIZE);
+    if (fd >= 0) {
+        size_t size = (size_t)blockCount * BLOCK_SIZE;
+        for (size_t done = 0; done < size;) {
+            ssize_t n = pread(imageFd, blocks + done, size - done, done);
+            if (n <= 0)
+                break; // whatever wasn't read stays zero
+            done += n;
+        }
+        TRACE(1, "loaded %d blocks of %s into memory\n", blockCount, diskImage.c_str());
+    }
+    ::close(imageFd);
+    return fd;
+}
+
+// make a new, empty file system of the given size in memory; returns the memory file's descriptor, or -1
+int RamDisk::create(const std::string& name, int numBlocks) {
+    if (numBlocks < RAM_DISK_MIN_BLOCKS || numBlocks > RAM_DISK_MAX_BLOCKS) {
+        std::cerr << "mount: cannot create a file system of " << numBlocks << " blocks, it must have "
+                  << RAM_DISK_MIN_BLOCKS << " to " << RAM_DISK_MAX_BLOCKS << "\n";
+        return -1;
+    }
+    int fd = allocate(name, numBlocks);
+    if (fd >= 0)
+        format();
+    return fd;
+}
+
+// write the blocks in memory to a disk image, replacing whatever was there
+int RamDisk::save(const std::string& diskImage) {
+    int imageFd = ::open(diskImage.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (imageFd < 0) {
+        std::cerr << "umount: cannot save RAM disk to " << diskImage << "\n";
+        return FAILURE;
+    }
+    size_t size = (size_t)blockCount * BLOCK_SIZE;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pwrite(imageFd, blocks + done, size - done, done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    ftruncate(imageFd, size);
+    fdatasync(imageFd);
+    ::close(imageFd);
+    if (done < size) {
+        std::cerr << "umount: cannot save RAM disk to " << diskImage << ", write failed\n";
+        return FAILURE;
+    }
+    TRACE(1, "saved %d blocks from memory to %s\n", blockCount, diskImage.c_str());
+    return SUCCESS;
+}
+
+// copy a run of blocks out of memory; anything past the end of the disk reads as zeros
+void RamDisk::read(int blockNum, int count, char* buffer) {
+    int inside = clamp(blockNum, count);
+    memcpy(buffer, blocks + (long)blockNum * BLOCK_SIZE, (size_t)inside * BLOCK_SIZE);
+    memset(buffer + (long)inside * BLOCK_SIZE, 0, (size_t)(count - inside) * BLOCK_SIZE);
+}
+
+// copy a run of blocks into memory; anything past the end of the disk is dropped
+void RamDisk::write(int blockNum, int count, const char* buffer) {
+    memcpy(blocks + (long)blockNum * BLOCK_SIZE, buffer, (size_t)clamp(blockNum, count) * BLOCK_SIZE);
+}
+
+// make an anonymous memory file big enough for the blocks and map it; returns its descriptor, or -1
+int RamDisk::allocate(const std::string& name, int numBlocks) {
+    int fd = memfd_create(name.c_str(), 0);
+    if (fd < 0 || ftruncate(fd, (long)numBlocks * BLOCK_SIZE) < 0) {
+        std::cerr << "mount: cannot allocate " << numBlocks << " blocks of memory for " << name << "\n";
+        if (fd >= 0)
+            ::close(fd);
+        return -1;
+    }
+    void* memory = mmap(nullptr, (size_t)numBlocks * BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        std::cerr << "mount: cannot map " << numBlocks << " blocks of memory for " << name << "\n";
+        ::close(fd);
+        return -1;
+    }
+    blocks = (char*)memory;
+    blockCount = numBlocks;
+    return fd;
+}
+
+// write an empty ext2 file system into memory, laid out the way mke2fs lays out a single block group: the
+// superblock, group descriptor, block and inode bitmaps, inode table, then the root and lost+found directories
+void RamDisk::format() {
+    int ninodes = blockCount / RAM_DISK_BLOCKS_PER_INODE;
+    ninodes = (ninodes + INODES_PER_BLOCK - 1) / INODES_PER_BLOCK * INODES_PER_BLOCK; // fill the last inode table block
+    const int blockBitmap = GROUP_DESCRIPTOR_0 + 1;
+    const int inodeBitmap = blockBitmap + 1;
+    const int inodeTable = inodeBitmap + 1;
+    const int rootBlock = inodeTable + ninodes / INODES_PER_BLOCK;
+    const int lostBlock = rootBlock + 1;
+    const int lostINode = EXT2_GOOD_OLD_FIRST_INO; // lost+found is the first inode that isn't reserved
+    const int groupBlocks = blockCount - 1; // the group starts after the boot block
+    const __u32 now = time(0L);
+
+    SuperBlock* sp = (SuperBlock*)(blocks + SUPER_BLOCK * BLOCK_SIZE);
+    sp->s_inodes_count = ninodes;
+    sp->s_blocks_count = blockCount;
+    sp->s_free_blocks_count = groupBlocks - lostBlock; // blocks 1 through lostBlock are in use
+    sp->s_free_inodes_count = ninodes - lostINode;
+    sp->s_first_data_block = SUPER_BLOCK;
+    sp->s_blocks_per_group = 8 * BLOCK_SIZE;
+    sp->s_clusters_per_group = 8 * BLOCK_SIZE;
+    sp->s_inodes_per_group = ninodes;
+    sp->s_wtime = sp->s_lastcheck = now;
+    sp->s_max_mnt_count = -1;
+    sp->s_magic = EXT2_SUPER_MAGIC;
+    sp->s_state = EXT2_VALID_FS;
+    sp->s_errors = EXT2_ERRORS_CONTINUE;
+    sp->s_rev_level = EXT2_DYNAMIC_REV;
+    sp->s_first_ino = EXT2_GOOD_OLD_FIRST_INO;
+    sp->s_inode_size = sizeof(INode);
+    for (__u8& byte : sp->s_uuid)
+        byte = rand();
+
+    GroupDescriptor* gp = (GroupDescriptor*)(blocks + GROUP_DESCRIPTOR_0 * BLOCK_SIZE);
+    gp->bg_block_bitmap = blockBitmap;
+    gp->bg_inode_bitmap = inodeBitmap;
+    gp->bg_inode_table = inodeTable;
+    gp->bg_free_blocks_count = sp->s_free_blocks_count;
+    gp->bg_free_inodes_count = sp->s_free_inodes_count;
+    gp->bg_used_dirs_count = 2;
+
+    // bit i stands for block (or inode) i+1; the bits past the end of the group are set, so they're never allocated
+    auto setBits = [](char* bitmap, int from, int to) {
+        for (int i = from; i < to; i++)
+            bitmap[i / 8] |= 1 << (i % 8);
+    };
+    setBits(blocks + (long)blockBitmap * BLOCK_SIZE, 0, lostBlock);
+    setBits(blocks + (long)blockBitmap * BLOCK_SIZE, groupBlocks, 8 * BLOCK_SIZE);
+    setBits(blocks + (long)inodeBitmap * BLOCK_SIZE, 0, lostINode);
+    setBits(blocks + (long)inodeBitmap * BLOCK_SIZE, ninodes, 8 * BLOCK_SIZE);
+
+    auto makeDir = [&](int inodeNum, int blockNum, int mode, int links, int parentNum) {
+        INode* inode = (INode*)(blocks + (long)inodeTable * BLOCK_SIZE + (inodeNum - 1) * sizeof(INode));
+        inode->i_mode = mode;
+        inode->i_size = BLOCK_SIZE;
+        inode->i_atime = inode->i_ctime = inode->i_mtime = now;
+        inode->i_links_count = links;
+        inode->i_blocks = BLOCK_SIZE / 512;
+        inode->i_block[0] = blockNum;
+
+        char* block = blocks + (long)blockNum * BLOCK_SIZE;
+        DirectoryEntry* dot = (DirectoryEntry*)block;
+        dot->inode = inodeNum;
+        dot->rec_len = 12;
+        dot->name_len = 1;
+        dot->name[0] = '.';
+        DirectoryEntry* dotdot = (DirectoryEntry*)(block + PARENT_DIR_ENTRY_OFFSET);
+        dotdot->inode = parentNum;
+        dotdot->rec_len = BLOCK_SIZE - PARENT_DIR_ENTRY_OFFSET;
+        dotdot->name_len = 2;
+        dotdot->name[0] = dotdot->name[1] = '.';
+        return dotdot;
+    };
+    DirectoryEntry* last = makeDir(ROOT_DIR_INODE_NUM, rootBlock, DIR_FILE_MODE, 3, ROOT_DIR_INODE_NUM);
+    last->rec_len = 12;
+    DirectoryEntry* lost = (DirectoryEntry*)((char*)last + last->rec_len);
+    lost->inode = lostINode;
+    lost->rec_len = BLOCK_SIZE - 2 * 12;
+    lost->name_len = strlen("lost+found");
+    memcpy(lost->name, "lost+found", lost->name_len);
+    makeDir(lostINode, lostBlock, S_IFDIR | 0700, 2, ROOT_DIR_INODE_NUM);
+    TRACE(1, "made a file system of %d blocks and %d inodes in memory\n", blockCount, ninodes);
+}
+
+// the number of blocks of a run that lie within the disk
+int RamDisk::clamp(int blockNum, int count) {
+    if (blockNum < 0 || blockNum >= blockCount)
+        return 0;
+    return std::min(count, blockCount - blockNum);
+}
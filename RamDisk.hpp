@@ -0,0 +1,28 @@
+#pragma once
+#include "main.hpp"
+
+#define RAM_DISK_MIN_BLOCKS 64 // the smallest file system that create= makes
+#define RAM_DISK_MAX_BLOCKS (8 * BLOCK_SIZE) // the largest, which still fits in one block group
+#define RAM_DISK_BLOCKS_PER_INODE 4 // how many blocks create= allows for each inode
+
+// a device's blocks kept in memory: either loaded from a disk image or made as a new, empty file system
+// the memory is an anonymous memory file mapped into the simulator, so the device still has a file descriptor and
+// the kernel can copy out of it, but block reads and writes are just memory copies
+class RamDisk {
+public:
+    int blockCount = 0; // the number of blocks in memory
+    bool persist = false; // is it written back to its disk image when it's unmounted?
+
+    ~RamDisk(); // release the memory
+    int load(const std::string& diskImage); // copy a disk image into memory; returns the memory file's descriptor, or -1
+    int create(const std::string& name, int numBlocks); // make a new, empty file system in memory; returns the descriptor, or -1
+    int save(const std::string& diskImage); // write the blocks in memory to a disk image
+    void read(int blockNum, int count, char* buffer); // copy a run of blocks out of memory
+    void write(int blockNum, int count, const char* buffer); // copy a run of blocks into memory
+
+private:
+    char* blocks = nullptr; // the mapped memory file
+    int allocate(const std::string& name, int numBlocks); // make a memory file big enough for the blocks and map it
+    void format(); // write an empty ext2 file system, with a root directory and lost+found, into memory
+    int clamp(int blockNum, int count); // the number of blocks of a run that lie within the disk
+};
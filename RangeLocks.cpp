@@ -0,0 +1,120 @@
+#include "RangeLocks.hpp"
+
+// forget every lock
+void RangeLocks::clear() {
+    runs.clear();
+}
+
+// are none of the file's bytes locked?
+bool RangeLocks::empty() {
+    return runs.empty();
+}
+
+// the first process found whose lock on some of a range stops another process locking it, or -1 if none does; a read
+// lock is only stopped by another's write lock, and a write lock by any other lock
+int RangeLocks::conflict(int pid, LockType type, int start, int end) {
+    auto run = runs.upper_bound(start);
+    if (run != runs.begin() && std::prev(run)->second.end > start)
+        run--;
+    for (; run != runs.end() && run->first < end; run++) {
+        const Holders& holders = run->second;
+        if (holders.writer >= 0 && holders.writer != pid)
+            return holders.writer;
+        if (type == WRITE_LOCK) {
+            for (int reader : holders.readers) {
+                if (reader != pid)
+                    return reader;
+            }
+        }
+    }
+    return -1;
+}
+
+// lock a range for a process, which replaces whatever it held on it; the caller checks for conflicts first
+void RangeLocks::lock(int pid, LockType type, int start, int end) {
+    split(start);
+    split(end);
+    int at = start;
+    auto run = runs.lower_bound(start);
+    while (at < end) {
+        if (run == runs.end() || run->first > at) { // fill the unlocked gap before the next run
+            int gapEnd = run == runs.end() ? end : std::min(run->first, end);
+            run = runs.emplace_hint(run, at, Holders{ gapEnd });
+        }
+        Holders& holders = run->second;
+        if (type == WRITE_LOCK) {
+            holders.writer = pid;
+            holders.readers.clear(); // only its own read lock can have been here
+        } else {
+            if (holders.writer == pid)
+                holders.writer = -1;
+            auto reader = std::lower_bound(holders.readers.begin(), holders.readers.end(), pid);
+            if (reader == holders.readers.end() || *reader != pid)
+                holders.readers.insert(reader, pid);
+        }
+        at = holders.end;
+        run++;
+    }
+    merge(start, end);
+}
+
+// release whatever a process holds on a range, dropping the runs nobody holds any more
+void RangeLocks::unlock(int pid, int start, int end) {
+    split(start);
+    split(end);
+    for (auto run = runs.lower_bound(start); run != runs.end() && run->first < end;) {
+        Holders& holders = run->second;
+        if (holders.writer == pid)
+            holders.writer = -1;
+        auto reader = std::lower_bound(holders.readers.begin(), holders.readers.end(), pid);
+        if (reader != holders.readers.end() && *reader == pid)
+            holders.readers.erase(reader);
+        if (holders.writer < 0 && holders.readers.empty())
+            run = runs.erase(run);
+        else
+            run++;
+    }
+    merge(start, end);
+}
+
+// the locked runs, in order of first byte
+std::vector<LockedRange> RangeLocks::list() {
+    std::vector<LockedRange> ranges;
+    for (auto& [start, holders] : runs)
+        ranges.push_back({ start, holders.end, holders.writer, holders.readers });
+    return ranges;
+}
+
+// start a new run at a byte that's inside one, with the same holders as the rest of it
+void RangeLocks::split(int at) {
+    auto run = runs.upper_bound(at);
+    if (run == runs.begin())
+        return;
+    run--;
+    if (run->first < at && run->second.end > at) {
+        Holders rest = run->second;
+        run->second.end = at;
+        runs.emplace_hint(std::next(run), at, rest);
+    }
+}
+
+// join each run in a range, and the runs on either side of it, to the one before it if they're adjacent and have the
+// same holders, so a process locking a range piece by piece ends up with one run
+void RangeLocks::merge(int start, int end) {
+    auto run = runs.lower_bound(start);
+    if (run != runs.begin())
+        run--;
+    while (run != runs.end() && run->first <= end) {
+        auto next = std::next(run);
+        if (next == runs.end())
+            break;
+        Holders& holders = run->second;
+        if (holders.end == next->first && holders.writer == next->second.writer &&
+            holders.readers == next->second.readers) {
+            holders.end = next->second.end;
+            runs.erase(next);
+        } else {
+            run = next;
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "main.hpp"
+#include <map>
+
+// the kinds of byte-range lock, as fcntl's F_RDLCK and F_WRLCK
+enum LockType {
+    READ_LOCK, // shared: other processes can read the range, and read lock it too, but not write it
+    WRITE_LOCK // exclusive: other processes can't read or write the range, or lock any of it
+};
+
+// a run of bytes with the same locks on all of it
+struct LockedRange {
+    int start; // the first byte
+    int end; // the byte after the last, INT32_MAX for up to whatever the file grows to
+    int writer; // the process holding a write lock on it, or -1
+    std::vector<int> readers; // the processes holding read locks on it, in order of pid
+};
+
+// a file's byte-range locks, as fcntl's POSIX record locks: each process holds at most one lock on any byte, locking a
+// range again replaces whatever it held there, and unlocking can split a lock in two; the locked bytes are kept as
+// runs that don't overlap, in a balanced tree by first byte, so finding the locks on a range takes a lookup and a step
+// for each run in it, however many locks the file has
+class RangeLocks {
+public:
+    void clear(); // forget every lock
+    bool empty(); // are none of the file's bytes locked?
+    int conflict(int pid, LockType type, int start, int end); // a process whose lock stops a process locking a range, or -1 if none does
+    void lock(int pid, LockType type, int start, int end); // lock a range, replacing whatever the process held there
+    void unlock(int pid, int start, int end); // release whatever a process holds on a range
+    std::vector<LockedRange> list(); // the locked runs, in order
+
+private:
+    struct Holders {
+        int end; // the byte after the run
+        int writer = -1; // the process holding a write lock on the run, or -1
+        std::vector<int> readers; // the processes holding read locks on it, in order of pid
+    };
+    std::map<int, Holders> runs; // the locked runs, by first byte; unlocked bytes have no run
+
+    void split(int at); // start a new run at a byte, if it's inside one
+    void merge(int start, int end); // join the neighbouring runs in a range that have the same holders
+};
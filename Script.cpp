@@ -0,0 +1,129 @@
+#include "Script.hpp"
+#include "Shell.hpp"
+#include <fstream>
+
+// a path or word argument, or an empty string if it wasn't given
+const std::string& Arguments::str(int i) const {
+    static const std::string none;
+    return i < op.count ? script.strings[script.args[op.first + i]] : none;
+}
+
+// a number argument, or zero if it wasn't given
+long Arguments::num(int i) const {
+    return i < op.count ? script.args[op.first + i] : 0;
+}
+
+// the command line as words, with the command's name first, for commands that parse their own arguments
+std::vector<std::string> Arguments::all() const {
+    std::vector<std::string> words = { op.command->name };
+    for (int i = 0; i < op.count; i++)
+        words.push_back(str(i));
+    return words;
+}
+
+// forget every operation and string
+void Script::clear() {
+    operations.clear();
+    args.clear();
+    strings.clear();
+    index.clear();
+}
+
+// parse a command line and add its operation: look the command up, then check each word against the type of argument
+// the command expects; returns FAILURE, with nothing added, if the command or an argument isn't valid
+int Script::compile(std::string_view line, const std::string& file, int lineNum) {
+    auto nextWord = [&line]() {
+        size_t start = std::min(line.find_first_not_of(" \t\r"), line.size());
+        line.remove_prefix(start);
+        std::string_view word = line.substr(0, line.find_first_of(" \t\r"));
+        line.remove_prefix(word.size());
+        return word;
+    };
+
+    std::string_view name = nextWord();
+    const Command* command = Shell::lookup(name);
+    if (!command) {
+        if (file.empty())
+            std::cerr << "* invalid command\n";
+        else
+            error(file, lineNum) << "invalid command " << name << "\n";
+        return FAILURE;
+    }
+
+    Operation op = { command, (int)args.size(), 0 };
+    for (const char* type = command->args;; op.count++) {
+        if (*type == 't') { // the rest of the line, as it was typed
+            size_t start = line.find_first_not_of(" \t");
+            size_t end = line.find_last_not_of("\r");
+            if (start != std::string_view::npos && end != std::string_view::npos && start <= end) {
+                args.push_back(intern(line.substr(start, end + 1 - start)));
+                op.count++;
+            }
+            break;
+        }
+        std::string_view word = nextWord();
+        if (word.empty())
+            break;
+        if (*type == '\0') {
+            error(file, lineNum) << command->name << ": too many arguments\n";
+            args.resize(op.first);
+            return FAILURE;
+        }
+        if (*type == 'n') {
+            std::string digits(word);
+            char* end;
+            long number = strtol(digits.c_str(), &end, 10);
+            if (*end != '\0') {
+                error(file, lineNum) << command->name << ": invalid number " << word << "\n";
+                args.resize(op.first);
+                return FAILURE;
+            }
+            args.push_back(number);
+        } else
+            args.push_back(intern(word));
+        if (*type != '*')
+            type++;
+    }
+    operations.push_back(op);
+    return SUCCESS;
+}
+
+// compile every line of a script file, skipping blank lines and # comments; returns FAILURE if any line isn't valid,
+// after reporting every one that isn't
+int Script::load(const std::string& path) {
+    std::ifstream stream(path);
+    if (!stream) {
+        std::cerr << "script: cannot open " << path << "\n";
+        return FAILURE;
+    }
+    std::string line;
+    int lineNum = 0, errors = 0;
+    while (std::getline(stream, line)) {
+        lineNum++;
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#')
+            continue;
+        if (compile(line, path, lineNum) == FAILURE)
+            errors++;
+    }
+    TRACE(1, "compiled %zu operations with %zu distinct strings from %s\n", operations.size(), strings.size(),
+        path.c_str());
+    return errors ? FAILURE : SUCCESS;
+}
+
+// the index of a string in strings, adding it if it's new
+int Script::intern(std::string_view string) {
+    auto found = index.find(string);
+    if (found != index.end())
+        return found->second;
+    strings.emplace_back(string);
+    index.emplace(strings.back(), strings.size() - 1);
+    return strings.size() - 1;
+}
+
+// start an error message, with where it is in a script file if it's from one
+std::ostream& Script::error(const std::string& file, int lineNum) {
+    if (!file.empty())
+        std::cerr << file << " line " << lineNum << ": ";
+    return std::cerr;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "main.hpp"
+#include <unordered_map>
+#include <deque>
+
+class Shell;
+class Script;
+struct Operation;
+
+// an operation's arguments as its command sees them; any that weren't given are empty strings or zeros
+struct Arguments {
+    const Script& script; // the script holding the operation's strings
+    const Operation& op; // the operation being run
+
+    const std::string& str(int i) const; // a path or word argument
+    long num(int i) const; // a number argument
+    std::vector<std::string> all() const; // every argument as a string, for commands that parse their own
+};
+
+// a command the shell knows: its names, the types of its arguments and the function that runs it
+struct Command {
+    const char* name; // what's typed to run it
+    const char* alias; // another name for it, or null
+    const char* args; // a letter for each argument: s for a path or word, n for a number, t for the rest of the line,
+                      // or * for any number of words
+    int (*run)(Shell& shell, const Arguments& args); // run it once its arguments are parsed, and return its result
+    bool control = false; // does it drive the shell itself, like script or replay? those aren't recorded
+};
+
+// a command with its arguments already parsed: numbers converted, and paths and words interned in the script
+struct Operation {
+    const Command* command; // the command to run
+    int first; // the index of its first argument in the script's args
+    int count; // how many arguments it was given
+};
+
+// commands compiled once into operations, so running them is bound by the file system's work rather than by parsing:
+// each command is looked up by hash, its numbers converted and its strings interned, so a path that's used a million
+// times is stored once
+class Script {
+public:
+    std::vector<Operation> operations; // the commands, in order
+    std::vector<long> args; // every operation's arguments: numbers, or indexes into strings
+    std::deque<std::string> strings; // each distinct path, word or text; a deque, so the index's keys never move
+
+    void clear(); // forget every operation and string
+    int compile(std::string_view line, const std::string& file = "", int lineNum = 0); // parse a command line and add its operation
+    int load(const std::string& path); // compile every line of a script file
+    int intern(std::string_view string); // the index of a string, adding it if it's new
+
+private:
+    std::unordered_map<std::string_view, int> index; // each string's index, by its contents in strings
+
+    std::ostream& error(const std::string& file, int lineNum); // start an error message, with where it is in a script file
+};
@@ -0,0 +1,278 @@
+#include "Shell.hpp"
+#include "Profiler.hpp"
+#include <thread>
+
+// every command, with the arguments it takes (see Command::args) and how it's run; Shell::lookup hashes the names
+static const Command commands[] = {
+    { "quit", "exit", "", [](Shell& shell, const Arguments& a) { shell.quit(); return SUCCESS; }, true },
+    { "menu", "help", "", [](Shell& shell, const Arguments& a) { shell.menu(); return SUCCESS; } },
+    { "cache", "minodes", "", [](Shell& shell, const Arguments& a) { fs->inodeTable.display(); return SUCCESS; } },
+    { "pwd", nullptr, "", [](Shell& shell, const Arguments& a) { return fs->running->pwd(); } },
+    { "cd", nullptr, "s", [](Shell& shell, const Arguments& a) { return fs->running->chdir(a.str(0)); } },
+    { "cd..", nullptr, "", [](Shell& shell, const Arguments& a) { return fs->running->chdir(".."); } },
+    { "ls", "dir", "s", [](Shell& shell, const Arguments& a) { return fs->inodeTable.ls(a.str(0)); } },
+    { "mkdir", "md", "s", [](Shell& shell, const Arguments& a) { return fs->inodeTable.mkdir(a.str(0)); } },
+    { "creat", nullptr, "s", [](Shell& shell, const Arguments& a) { return fs->inodeTable.creat(a.str(0)); } },
+    { "rmdir", "rd", "s", [](Shell& shell, const Arguments& a) { return fs->inodeTable.rmdir(a.str(0)); } },
+    { "link", nullptr, "ss", [](Shell& shell, const Arguments& a) { return fs->inodeTable.link(a.str(0), a.str(1)); } },
+    { "unlink", "rm", "s", [](Shell& shell, const Arguments& a) { return fs->inodeTable.unlink(a.str(0)); } },
+    { "symlink", nullptr, "ss", [](Shell& shell, const Arguments& a) {
+         return fs->inodeTable.symlink(a.str(0), a.str(1));
+     } },
+    { "stat", nullptr, "s", [](Shell& shell, const Arguments& a) { return fs->inodeTable.stat(a.str(0)); } },
+    { "chmod", nullptr, "ss", [](Shell& shell, const Arguments& a) {
+         return fs->inodeTable.chmod(a.str(0), a.str(1));
+     } },
+    { "utime", "touch", "s", [](Shell& shell, const Arguments& a) { return fs->inodeTable.utime(a.str(0)); } },
+    { "pfd", nullptr, "", [](Shell& shell, const Arguments& a) { fs->running->display_open_files(); return SUCCESS; } },
+    { "open", nullptr, "sn", [](Shell& shell, const Arguments& a) {
+         return fs->running->open(a.str(0), (OpenMode)a.num(1));
+     } },
+    { "close", nullptr, "n", [](Shell& shell, const Arguments& a) { return fs->running->close(a.num(0)); } },
+    { "lseek", nullptr, "nn", [](Shell& shell, const Arguments& a) { return fs->running->lseek(a.num(0), a.num(1)); } },
+    { "dup", nullptr, "n", [](Shell& shell, const Arguments& a) { return fs->running->dup(a.num(0)); } },
+    { "dup2", nullptr, "nn", [](Shell& shell, const Arguments& a) { return fs->running->dup2(a.num(0), a.num(1)); } },
+    { "lock", nullptr, "nsnn", [](Shell& shell, const Arguments& a) {
+         return fs->running->lock(a.num(0), a.str(1), a.num(2), a.num(3));
+     } },
+    { "read", nullptr, "nn", [](Shell& shell, const Arguments& a) {
+         return fs->running->read_bytes(a.num(0), a.num(1));
+     } },
+    { "cat", nullptr, "s", [](Shell& shell, const Arguments& a) { return fs->running->cat(a.str(0)); } },
+    { "write", nullptr, "nt", [](Shell& shell, const Arguments& a) {
+         return fs->running->write_bytes(a.num(0), a.str(1));
+     } },
+    { "cp", nullptr, "ss", [](Shell& shell, const Arguments& a) { return fs->inodeTable.cp(a.str(0), a.str(1)); } },
+    { "mv", nullptr, "ss", [](Shell& shell, const Arguments& a) { return fs->inodeTable.mv(a.str(0), a.str(1)); } },
+    { "mount", nullptr, "sss", [](Shell& shell, const Arguments& a) {
+         return fs->mountTable.mount(a.str(0), a.str(1), a.str(2)) ? SUCCESS : FAILURE;
+     } },
+    { "umount", nullptr, "s", [](Shell& shell, const Arguments& a) { return fs->mountTable.umount(a.str(0)); } },
+    { "du", nullptr, "s", [](Shell& shell, const Arguments& a) { return fs->inodeTable.du(a.str(0)); } },
+    { "find", nullptr, "*", [](Shell& shell, const Arguments& a) { return fs->inodeTable.find(a.all()); } },
+    { "fsck", nullptr, "ss", [](Shell& shell, const Arguments& a) {
+         return fs->mountTable.fsck(a.str(0), a.str(1) == "-y");
+     } },
+    { "defrag", nullptr, "ss", [](Shell& shell, const Arguments& a) {
+         return fs->mountTable.defrag(a.str(0), a.str(1) == "shrink");
+     } },
+    { "import", nullptr, "ss", [](Shell& shell, const Arguments& a) {
+         return fs->inodeTable.import(a.str(0), a.str(1));
+     } },
+    { "export", nullptr, "ss", [](Shell& shell, const Arguments& a) {
+         return fs->inodeTable.export_tree(a.str(0), a.str(1));
+     } },
+    { "compact", nullptr, "s", [](Shell& shell, const Arguments& a) { return fs->inodeTable.compact(a.str(0)); } },
+    { "fallocate", nullptr, "snn", [](Shell& shell, const Arguments& a) {
+         return fs->inodeTable.fallocate(a.str(0), a.num(1), a.num(2));
+     } },
+    { "punch", nullptr, "snn", [](Shell& shell, const Arguments& a) {
+         return fs->inodeTable.punch(a.str(0), a.num(1), a.num(2));
+     } },
+    { "journal", nullptr, "ss", [](Shell& shell, const Arguments& a) {
+         return fs->mountTable.journal(a.str(0), a.str(1) != "off");
+     } },
+    { "sync", nullptr, "", [](Shell& shell, const Arguments& a) {
+         fs->inodeTable.sync(); // including access times held back by lazytime
+         fs->mountTable.sync();
+         return SUCCESS;
+     } },
+    { "overlay", nullptr, "ss", [](Shell& shell, const Arguments& a) {
+         return fs->mountTable.overlay(a.str(0), a.str(1));
+     } },
+    { "blktrace", nullptr, "s", [](Shell& shell, const Arguments& a) {
+         if (a.str(0) == "on")
+             fs->blockTrace.start();
+         else if (a.str(0) == "off")
+             fs->blockTrace.stop();
+         else
+             fs->blockTrace.report();
+         return SUCCESS;
+     } },
+    { "profile", nullptr, "ss", [](Shell& shell, const Arguments& a) {
+         if (a.str(0) == "clear")
+             profiler.clear();
+         else if (a.str(0) == "folded")
+             return profiler.fold(a.str(1).empty() ? "profile.folded" : a.str(1));
+         else
+             profiler.report();
+         return SUCCESS;
+     } },
+    { "script", nullptr, "s", [](Shell& shell, const Arguments& a) { return shell.run_script(a.str(0)); }, true },
+    { "record", nullptr, "s", [](Shell& shell, const Arguments& a) { return shell.record(a.str(0)); }, true },
+    { "replay", nullptr, "ssn", [](Shell& shell, const Arguments& a) {
+         return shell.replay(a.str(0), a.str(1), a.num(2));
+     }, true },
+};
+
+// the main user input loop for the simulation
+void Shell::run(const std::string& diskImage, const std::string& options) {
+    fs = engine.get();
+    if (fs->init(diskImage, options) != SUCCESS)
+        exit(FAILURE);
+
+    std::cout << "Enter menu or help to see a summary of available commands\n";
+    std::string input;
+    while (true) {
+        std::cout << "\n"
+                  << fs->running->prompt() << "$ ";
+        std::getline(std::cin, input);
+        line.clear();
+        if (line.compile(input) == SUCCESS)
+            execute(line, line.operations[0]);
+
+        if (TRACE_LEVEL >= 2) fs->inodeTable.display();
+    }
+}
+
+// display the available commands for the file system
+void Shell::menu() {
+    std::cout << "EXT2 File System Simulator Project\n\n"
+                 "help   menu    cache  minodes  quit   exit\n"
+                 "ls     cd      pwd    mkdir    creat  rmdir  rd\n"
+                 "link   unlink  rm     symlink  stat   chmod  utime  touch\n"
+                 "pfd    open    close  lseek    dup    dup2   lock\n"
+                 "read   cat     write  cp       mv\n"
+                 "mount  umount  overlay  sync\n"
+                 "du     find   fsck   defrag journal compact blktrace profile\n"
+                 "import export fallocate punch\n"
+                 "script record replay\n";
+}
+
+// terminate the file system simulation
+void Shell::quit() {
+    trace.stop();
+    fs->shutdown();
+    exit(SUCCESS);
+}
+
+// run a compiled file system command, as one transaction on journaled devices, and return its result; while
+// recording, the command is logged with its timing and the blocks it read and wrote
+int Shell::execute(const Script& script, const Operation& op) {
+    fs->arena.reset(); // release the previous command's scratch memory
+    TRACE(1, "cmd='%s' with %d arguments\n", op.command->name, op.count);
+    PROFILE_SCOPE(op.command->name);
+    Arguments args{ script, op };
+    if (!trace.recording || op.command->control) {
+        int result = op.command->run(*this, args);
+        fs->mountTable.commit(); // its modified inodes reach the devices, as one transaction on journaled ones
+        return result;
+    }
+
+    long reads, writes, readsAfter, writesAfter;
+    fs->mountTable.io_counts(&reads, &writes);
+    int pid = fs->running->pid;
+    auto start = Clock::now();
+    int result = op.command->run(*this, args);
+    fs->mountTable.commit();
+    auto duration = Clock::now() - start;
+    fs->mountTable.io_counts(&readsAfter, &writesAfter);
+    trace.log(args, pid, result, start, duration, readsAfter - reads, writesAfter - writes);
+    return result;
+}
+
+// compile a script file, then run its commands one after another; nothing runs if any line isn't valid
+int Shell::run_script(const std::string& path) {
+    if (depth == SCRIPT_MAX_DEPTH) {
+        std::cerr << "script: cannot run " << path << ", scripts nested more than " << SCRIPT_MAX_DEPTH << " deep\n";
+        return FAILURE;
+    }
+    auto start = Clock::now();
+    Script script;
+    if (script.load(path) == FAILURE)
+        return FAILURE;
+    auto compiled = Clock::now();
+    depth++;
+    for (const Operation& op : script.operations)
+        execute(script, op);
+    depth--;
+    auto finished = Clock::now();
+    std::cout << "script: " << script.operations.size() << " commands from " << path << " compiled in "
+              << std::chrono::duration<double>(compiled - start).count() << " s, run in "
+              << std::chrono::duration<double>(finished - compiled).count() << " s\n";
+    return SUCCESS;
+}
+
+// start recording every command run after this one to a trace file, or stop recording with "off" or no file
+int Shell::record(const std::string& path) {
+    if (path.empty() || path == "off") {
+        trace.stop();
+        return SUCCESS;
+    }
+    return trace.start(path);
+}
+
+// print the percentiles of a set of latencies, in microseconds
+static void print_latencies(const std::string& label, std::vector<long>& latencies) {
+    if (latencies.empty())
+        return;
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) { return latencies[(size_t)(p / 100 * (latencies.size() - 1))] / 1000.0; };
+    std::cout << label << " latency (us): p50 " << percentile(50) << ", p90 " << percentile(90) << ", p99 "
+              << percentile(99) << ", p99.9 " << percentile(99.9) << ", max " << percentile(100) << "\n";
+}
+
+// run a trace's commands again, either as fast as possible or paced to start when they did when they were recorded,
+// and report the throughput and latency percentiles next to the recorded ones; each command runs as the process that
+// recorded it or, given a number of processes, once in each of them in turn, each with its own descriptors and cwd
+int Shell::replay(const std::string& path, const std::string& pacing, int processes) {
+    if (pacing != "" && pacing != "fast" && pacing != "paced") {
+        std::cerr << "replay: cannot replay " << path << ", pacing must be fast or paced\n";
+        return FAILURE;
+    }
+    if (processes < 0 || processes > PROCESS_TABLE_SIZE) {
+        std::cerr << "replay: cannot replay " << path << ", there are only " << PROCESS_TABLE_SIZE << " processes\n";
+        return FAILURE;
+    }
+    Script script;
+    std::vector<TracedOperation> traced;
+    if (Trace::load(path, &script, &traced) == FAILURE)
+        return FAILURE;
+
+    Process* running = fs->running;
+    int copies = std::max(processes, 1);
+    std::vector<long> latencies, recorded;
+    latencies.reserve(traced.size() * copies);
+    long changed = 0; // commands whose results differ from the recorded ones
+    auto began = Clock::now();
+    for (size_t i = 0; i < traced.size(); i++) {
+        if (pacing == "paced")
+            std::this_thread::sleep_until(began + std::chrono::nanoseconds(traced[i].start));
+        for (int copy = 0; copy < copies; copy++) {
+            Process* process = fs->processTable.get(processes ? copy : traced[i].pid);
+            fs->running = process ? process : running;
+            auto start = Clock::now();
+            int result = execute(script, script.operations[i]);
+            latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+            changed += (result != traced[i].result);
+        }
+        recorded.push_back(traced[i].duration);
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - began).count();
+    fs->running = running;
+
+    std::cout << "replay: " << latencies.size() << " commands in " << elapsed << " s, "
+              << (elapsed > 0 ? latencies.size() / elapsed : 0) << " commands/s";
+    if (changed)
+        std::cout << ", " << changed << " with different results than recorded";
+    std::cout << "\n";
+    print_latencies("replayed", latencies);
+    print_latencies("recorded", recorded);
+    return SUCCESS;
+}
+
+// find a command by its name or alias in a hash table built from the command table on first use; returns null if
+// there's no such command
+const Command* Shell::lookup(std::string_view name) {
+    static const std::unordered_map<std::string_view, const Command*> registry = [] {
+        std::unordered_map<std::string_view, const Command*> table;
+        for (const Command& command : commands) {
+            table[command.name] = &command;
+            if (command.alias)
+                table[command.alias] = &command;
+        }
+        return table;
+    }();
+    auto found = registry.find(name);
+    return found == registry.end() ? nullptr : found->second;
+}
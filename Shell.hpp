@@ -0,0 +1,24 @@
+#pragma once
+#include "FileSystem.hpp"
+#include "Trace.hpp"
+
+#define SCRIPT_MAX_DEPTH 8 // how deeply scripts can run other scripts
+
+// the simulator's command line: it reads commands, runs them on the file system and prints their results
+class Shell {
+public:
+    void run(const std::string& diskImage, const std::string& options); // the main user input loop for the simulation
+    void menu(); // display the available commands for the file system
+    int execute(const Script& script, const Operation& op); // run a compiled file system command and return its result
+    int run_script(const std::string& path); // compile a script file, then run all its commands
+    int record(const std::string& path); // start recording the commands to a trace file, or stop with "off"
+    int replay(const std::string& path, const std::string& pacing, int processes); // run a trace's commands again and time them
+    void quit(); // terminate the file system simulation
+    static const Command* lookup(std::string_view name); // find a command by its name or alias, or return null
+
+private:
+    Script line; // the command line being run, compiled as a script of one command
+    int depth = 0; // how many scripts are running, each started by the one before
+    Trace trace; // where the commands are being recorded, if they are
+    std::unique_ptr<FileSystem> engine = std::make_unique<FileSystem>(); // the file system the commands run on
+};
@@ -0,0 +1,9 @@
+#include "Status.hpp"
+
+// describe a status, e.g., "file not found"; the command line adds it to its "cannot" messages
+const char* status_message(Status status) {
+    static const char* messages[] = { "success", "invalid argument", "file not found", "file already exists",
+        "not a directory", "is a directory", "directory not empty", "file in use", "device is mounted read-only",
+        "no space left on device", "file system not mounted", "bytes locked by another process" };
+    return messages[(int)status];
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+// the result of a file system operation called through the library interface; the command line turns the failures
+// into messages
+enum class Status {
+    OK,
+    INVALID, // a name, offset or length is missing or out of range
+    NOT_FOUND, // the file, or a directory on its path, doesn't exist
+    EXISTS, // the name is already used in its directory
+    NOT_DIRECTORY, // a directory was needed
+    IS_DIRECTORY, // a directory isn't allowed
+    NOT_EMPTY, // the directory still has entries
+    IN_USE, // the file is open, or is the cwd or a mount point
+    READ_ONLY, // the device is mounted read-only
+    NO_SPACE, // the device has no free inodes or blocks, or the file can't map any more
+    NOT_MOUNTED, // the disk image couldn't be mounted, or no file system is open
+    LOCKED, // another process holds a byte-range lock on some of the bytes
+};
+
+const char* status_message(Status status); // describe a status, e.g., "file not found"
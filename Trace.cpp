@@ -0,0 +1,131 @@
+#include "Trace.hpp"
+#include "Shell.hpp"
+
+// finish the trace file, if one is open
+Trace::~Trace() {
+    stop();
+}
+
+// start recording to a new trace file, replacing any that's there
+int Trace::start(const std::string& path) {
+    if (recording) {
+        std::cerr << "record: cannot record to " << path << ", already recording to " << this->path << "\n";
+        return FAILURE;
+    }
+    stream.open(path, std::ios::binary | std::ios::trunc);
+    if (!stream) {
+        std::cerr << "record: cannot create " << path << "\n";
+        return FAILURE;
+    }
+    stream.write(TRACE_FILE_MAGIC, strlen(TRACE_FILE_MAGIC));
+    this->path = path;
+    numbers.clear();
+    operations = 0;
+    began = Clock::now();
+    recording = true;
+    return SUCCESS;
+}
+
+// finish the trace file
+void Trace::stop() {
+    if (!recording)
+        return;
+    stream.close();
+    recording = false;
+    std::cout << "record: " << operations << " operations recorded to " << path << "\n";
+}
+
+// record one operation that has just run
+void Trace::log(const Arguments& args, int pid, int result, Clock::time_point start, Clock::duration duration,
+    long reads, long writes) {
+    TraceRecord record = {};
+    record.name = number(args.op.command->name);
+    std::vector<int64_t> values(args.op.count);
+    const char* type = args.op.command->args;
+    for (int i = 0; i < args.op.count; i++) {
+        values[i] = (*type == 'n') ? args.num(i) : number(args.str(i)); // strings are written before the record
+        if (*type != '*')
+            type++;
+    }
+    record.count = args.op.count;
+    record.pid = pid;
+    record.result = result;
+    record.reads = reads;
+    record.writes = writes;
+    record.start = std::chrono::duration_cast<std::chrono::nanoseconds>(start - began).count();
+    record.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    stream.put(TRACE_OPERATION);
+    stream.write((const char*)&record, sizeof(record));
+    stream.write((const char*)values.data(), values.size() * sizeof(int64_t));
+    operations++;
+}
+
+// a string's number, writing it to the trace first if this is the first time it's used
+uint32_t Trace::number(const std::string& string) {
+    auto found = numbers.find(string);
+    if (found != numbers.end())
+        return found->second;
+    uint32_t length = string.size();
+    stream.put(TRACE_STRING);
+    stream.write((const char*)&length, sizeof(length));
+    stream.write(string.data(), length);
+    uint32_t number = numbers.size();
+    numbers[string] = number;
+    return number;
+}
+
+// read a trace file back, compiling its operations into a script and keeping how each one ran when it was recorded;
+// returns FAILURE if the file isn't a trace, is cut short or names a command this shell doesn't have
+int Trace::load(const std::string& path, Script* script, std::vector<TracedOperation>* traced) {
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream) {
+        std::cerr << "replay: cannot open " << path << "\n";
+        return FAILURE;
+    }
+    char magic[sizeof(TRACE_FILE_MAGIC)] = {};
+    if (!stream.read(magic, strlen(TRACE_FILE_MAGIC)) || strcmp(magic, TRACE_FILE_MAGIC) != 0) {
+        std::cerr << "replay: cannot replay " << path << ", not a trace file\n";
+        return FAILURE;
+    }
+    std::vector<std::string> strings;
+    auto string = [&strings](int64_t number) { return number >= 0 && number < (int64_t)strings.size() ? strings[number] : ""; };
+    bool complete = false; // did the trace end between entries?
+    while (stream) {
+        int tag = stream.get();
+        if (tag == EOF) {
+            complete = true;
+        } else if (tag == TRACE_STRING) {
+            uint32_t length;
+            stream.read((char*)&length, sizeof(length));
+            strings.emplace_back(length, '\0');
+            stream.read(strings.back().data(), length);
+        } else if (tag == TRACE_OPERATION) {
+            TraceRecord record;
+            stream.read((char*)&record, sizeof(record));
+            std::vector<int64_t> values(record.count);
+            stream.read((char*)values.data(), values.size() * sizeof(int64_t));
+            if (!stream)
+                break; // cut short
+            const Command* command = Shell::lookup(string(record.name));
+            if (!command) {
+                std::cerr << "replay: cannot replay " << path << ", unknown command " << string(record.name) << "\n";
+                return FAILURE;
+            }
+            Operation op = { command, (int)script->args.size(), record.count };
+            const char* type = command->args;
+            for (int64_t value : values) {
+                script->args.push_back(*type == 'n' ? value : script->intern(string(value)));
+                if (*type != '*')
+                    type++;
+            }
+            script->operations.push_back(op);
+            traced->push_back({ record.pid, record.result, record.start, record.duration });
+        } else
+            break; // not an entry
+    }
+    if (!complete) {
+        std::cerr << "replay: cannot replay " << path << ", the trace is damaged or cut short\n";
+        return FAILURE;
+    }
+    return SUCCESS;
+}
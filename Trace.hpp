@@ -0,0 +1,54 @@
+#pragma once
+#include "Script.hpp"
+#include <fstream>
+#include <chrono>
+
+#define TRACE_FILE_MAGIC "EXT2TRC1" // the first bytes of every trace file, with its format version
+#define TRACE_STRING 'S' // a trace entry holding a string, which the entries after it refer to by number
+#define TRACE_OPERATION 'O' // a trace entry holding one recorded operation
+
+typedef std::chrono::steady_clock Clock;
+
+// one recorded operation as it's stored in a trace file, after its tag; its arguments follow it as count 64-bit
+// numbers, which are string numbers for every argument that isn't a number
+struct TraceRecord {
+    uint32_t name; // the command's name, as a string number
+    uint16_t count; // how many arguments follow
+    uint16_t pid; // the process that ran it
+    int32_t result; // what the command returned
+    uint32_t reads; // blocks the file system read from its devices while it ran
+    uint32_t writes; // blocks the file system wrote to its devices while it ran
+    int64_t start; // when it started, in nanoseconds since the recording started
+    int64_t duration; // how long it took, in nanoseconds
+};
+
+// an operation read back from a trace file: compiled into a script for replaying, plus how it ran when it was recorded
+struct TracedOperation {
+    int pid; // the process that ran it
+    int result; // what the command returned
+    long start; // when it started, in nanoseconds since the recording started
+    long duration; // how long it took, in nanoseconds
+};
+
+// records the operations the shell runs to a compact binary trace file, each with its arguments, result, timing and
+// block I/O; strings are written once, the first time they're used, and referred to by number after that
+class Trace {
+public:
+    bool recording = false; // is a trace file open?
+
+    ~Trace(); // finish the trace file, if one is open
+    int start(const std::string& path); // start recording to a new trace file
+    void stop(); // finish the trace file
+    void log(const Arguments& args, int pid, int result, Clock::time_point start, Clock::duration duration,
+        long reads, long writes); // record one operation that has just run
+    static int load(const std::string& path, Script* script, std::vector<TracedOperation>* traced); // read a trace file back
+
+private:
+    std::ofstream stream; // the trace file
+    std::string path; // its name
+    Clock::time_point began; // when the recording started
+    std::unordered_map<std::string, uint32_t> numbers; // each string written so far, with its number
+    long operations; // how many operations have been recorded
+
+    uint32_t number(const std::string& string); // a string's number, writing it to the trace if it's new
+};
@@ -0,0 +1,103 @@
+#include "TreeWalker.hpp"
+#include "DataBlock.hpp"
+#include "Directory.hpp"
+#include "FileSystem.hpp"
+
+// use one worker thread per available core
+TreeWalker::TreeWalker()
+    : numWorkers(std::max(1, (int)std::thread::hardware_concurrency()))
+    , queues(numWorkers) {
+}
+
+// visit start and everything beneath it; the visitor is called concurrently from all the workers
+void TreeWalker::walk(CachedINode* start, const std::string& startPath, const Visitor& visit) {
+    fs->inodeTable.sync(); // the workers read inodes straight from the devices, so make sure they are up to date
+
+    TreeEntry root;
+    root.path = startPath;
+    root.file.device = start->device;
+    root.file.inodeNum = start->inodeNum;
+    root.file.inode = start->inode;
+    visit(0, root);
+    if (!S_ISDIR(root.file.inode.i_mode))
+        return;
+
+    pending = 1;
+    queues[0].dirs.push_back(root);
+    std::vector<std::thread> threads;
+    for (int worker = 1; worker < numWorkers; worker++)
+        threads.emplace_back(&TreeWalker::work, this, worker, std::cref(visit));
+    work(0, visit); // the calling thread is worker 0
+    for (std::thread& t : threads)
+        t.join();
+    TRACE(1, "walked %s with %d workers\n", startPath.c_str(), numWorkers);
+}
+
+// expand directories until the whole tree has been walked
+void TreeWalker::work(int worker, const Visitor& visit) {
+    TreeEntry dir;
+    while (pending > 0) {
+        if (take(worker, dir)) {
+            expand(worker, dir, visit);
+            pending--; // only after its sub-directories have been queued, so pending can't reach 0 too early
+        } else {
+            std::this_thread::yield(); // other workers are still expanding directories that may produce more work
+        }
+    }
+}
+
+// get the next directory from this worker's queue (newest first), or steal one from another worker (oldest first)
+bool TreeWalker::take(int worker, TreeEntry& dir) {
+    for (int i = 0; i < numWorkers; i++) {
+        WorkQueue& queue = queues[(worker + i) % numWorkers];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.dirs.empty())
+            continue;
+        if (i == 0) {
+            dir = std::move(queue.dirs.back());
+            queue.dirs.pop_back();
+        } else {
+            dir = std::move(queue.dirs.front());
+            queue.dirs.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+// visit a directory's entries and queue its sub-directories
+void TreeWalker::expand(int worker, const TreeEntry& dir, const Visitor& visit) {
+    CachedINode directory = dir.file; // Directory needs a modifiable inode, even though nothing will change
+    DataBlock inodeBlock(directory.device); // neighboring entries often have their inodes in the same block
+    TreeEntry child;
+    std::string prefix = dir.path;
+    if (prefix.empty() || prefix.back() != '/') prefix += '/';
+
+    for (const auto& entry : Directory(&directory)) {
+        if (entry.inodeNum == 0 || entry.name == "." || entry.name == "..")
+            continue; // skip unused entries along with the links to this directory and its parent
+        child.path = prefix;
+        child.path.append(entry.name);
+        child.file.device = directory.device;
+        child.file.inodeNum = entry.inodeNum;
+
+        CachedINode* mounted = fs->mountTable.mounted_root(child.file.device, child.file.inodeNum);
+        if (mounted) { // cross over into the root of the device mounted here
+            child.file.device = mounted->device;
+            child.file.inodeNum = mounted->inodeNum;
+            child.file.inode = mounted->inode;
+        } else {
+            int blockNum = directory.device->inode_block(entry.inodeNum);
+            if (blockNum != inodeBlock.blockNum)
+                inodeBlock.get(blockNum);
+            memcpy(&child.file.inode, &inodeBlock.buffer[directory.device->inode_offset(entry.inodeNum)], sizeof(INode));
+        }
+        visit(worker, child);
+
+        if (S_ISDIR(child.file.inode.i_mode)) {
+            pending++;
+            std::lock_guard<std::mutex> guard(queues[worker].lock);
+            queues[worker].dirs.push_back(child);
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "CachedINode.hpp"
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// a file or directory found while walking a directory tree
+class TreeEntry {
+public:
+    std::string path; // the entry's pathname, starting with the pathname the walk began at
+    CachedINode file; // a private copy of the entry's inode; it is not part of the inode table
+};
+
+// walks a directory tree with a pool of worker threads, crossing into mounted devices along the way;
+// each worker expands directories from its own queue and steals from the other queues when its own is empty
+class TreeWalker {
+public:
+    typedef std::function<void(int worker, const TreeEntry& entry)> Visitor;
+    int numWorkers; // number of threads walking the tree, including the calling thread
+
+    TreeWalker(); // use one worker thread per available core
+    void walk(CachedINode* start, const std::string& startPath, const Visitor& visit); // visit start and everything beneath it
+
+private:
+    class WorkQueue { // directories waiting to be expanded by a worker
+    public:
+        std::mutex lock;
+        std::deque<TreeEntry> dirs;
+    };
+    std::vector<WorkQueue> queues; // one queue per worker
+    std::atomic<int> pending; // number of directories queued or being expanded
+
+    void work(int worker, const Visitor& visit); // expand directories until the whole tree has been walked
+    bool take(int worker, TreeEntry& dir); // get the next directory from this worker's queue, or steal one from another worker
+    void expand(int worker, const TreeEntry& dir, const Visitor& visit); // visit a directory's entries and queue its sub-directories
+};
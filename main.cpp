@@ -1,12 +1,13 @@
 /*
     Partial simulation of the ext2 file system
  */
-#include "FileSystem.hpp"
-FileSystem fs;
+#include "Shell.hpp"
 
 int main(int argc, char* argv[]) {
     std::string diskImage("disk0");
-    if (argc == 2) diskImage = argv[1];
+    std::string options; // mount options for the root device, e.g., overlay
+    if (argc >= 2) diskImage = argv[1];
+    if (argc >= 3) options = argv[2];
 
-    fs.start(diskImage);
+    Shell().run(diskImage, options);
 }
@@ -1,10 +1,16 @@
 #pragma once
 #include <ext2fs/ext2_fs.h> // sudo apt-get install e2fslibs-dev
+#include <ext2fs/ext3_extents.h>
 #include <iostream>
 #include <iomanip>
 #include <string>
+#include <string_view>
+#include <memory>
 #include <sstream>
 #include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <functional>
 #include <ctime>
 #include <string.h>
 #include <unistd.h>
@@ -18,23 +24,29 @@ typedef struct ext2_super_block SuperBlock;
 typedef struct ext2_group_desc GroupDescriptor;
 typedef struct ext2_inode INode;
 typedef struct ext2_dir_entry_2 DirectoryEntry;
+typedef struct ext3_extent_header ExtentHeader;
+typedef struct ext3_extent_idx ExtentIndex;
+typedef struct ext3_extent Extent;
 
 #define SUPER_BLOCK 1
 #define GROUP_DESCRIPTOR_0 2
 
 // define the scalability of our simulation by specifying the table sizes
 #define PROCESS_TABLE_SIZE 2
-#define INODE_TABLE_SIZE 64
+#define INODE_TABLE_SIZE 64 // the cached inode table starts with this many entries, and doubles when they're all held
 #define MOUNT_TABLE_SIZE 4
-#define OPEN_FILES_TABLE_SIZE 32
-#define PROCESS_FILE_DESCRIPTORS 16
+#define OPEN_FILES_SLAB_SIZE 64 // the open file table grows by this many entries at a time
+#define PROCESS_MAX_FILE_DESCRIPTORS 65536 // the most files a process can have open; its descriptor table grows as needed
 
 #define STRING_SIZE 256
+#define ARENA_CHUNK_SIZE 65536 // bytes of per-command scratch memory reserved up front
 #define BLOCK_SIZE 1024
 #define BLOCKNUMS_PER_BLOCK (BLOCK_SIZE / (int)sizeof(int))
 #define INODES_PER_BLOCK (BLOCK_SIZE / (int)sizeof(INode))
 #define ROOT_DIR_INODE_NUM 2
 #define PARENT_DIR_ENTRY_OFFSET 12 // byte offset location of parent directory entry
+#define COMPACT_MIN_BLOCKS 4 // directories with fewer blocks than this are never compacted automatically
+#define COMPACT_FILL_PERCENT 25 // directories filled less than this are compacted automatically when an entry is removed
 
 #define DIR_FILE_MODE 0040755 // DIR type and rwxr-xr-x permissions
 #define REG_FILE_MODE 0100644 // REG type and rw-r--r-- permissions